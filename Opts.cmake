@@ -9,5 +9,8 @@ option(BUILD_TESTING "" OFF)
 option(RE2_BUILD_TESTING "" OFF)
 option(MPLReg_ENABLE_TESTS "Compile and run registry unit tests" ON)
 option(mpmc_ring_ENABLE_TESTS "Compile and run registry unit tests" ON)
+option(relay_ENABLE_TESTS "Compile and run relay unit tests" ON)
+option(relay_WITH_LZ4 "Compress relay frames with LZ4" OFF)
 option(spring_ENABLE_TESTS "Compile and run spring unit tests" ON)
+option(store_ENABLE_TESTS "Compile and run store unit tests" ON)
 option(extractor_ENABLE_TESTS "Compile and run extractor unit tests" ON)
@@ -1,3 +1,5 @@
 #pragma once
 
 #include "extractor_common.hpp"
+#include "file_sink.hpp"
+#include "record_filter.hpp"
@@ -1,41 +1,188 @@
 #pragma once
 
 #include <tuple>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <exception>
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
-#include <ring.h>
+#include <ring.hpp>
 
+#include "record_filter.hpp"
 
 struct ChannelNotFound: public std::exception {};
 
+namespace relay {
+class RemoteRing;
+}
+
+namespace store {
+class LogStore;
+}
+
+class FileSink;
+
+/**
+ * Loss accounting of an Extractor, from the sequence numbers the
+ * ring stamps on each record. Members of a consumer group only
+ * count records, as the sequence is split between them.
+ */
+struct ExtractorStats {
+    /// Records popped.
+    uint64_t records = 0;
+    /// Records that never arrived: dropped on a full ring or lost
+    /// with a producer. Records dropped after the last one popped
+    /// are counted once a later record arrives.
+    uint64_t lost = 0;
+    /// Times the sequence skipped ahead.
+    uint64_t gaps = 0;
+    /// Records that arrived after a later one, e.g. from another
+    /// lane or a concurrent producer. They are not counted as lost.
+    uint64_t reordered = 0;
+    /// Records dropped because they did not pass the filter; see
+    /// Extractor::SetFilter().
+    uint64_t filtered = 0;
+    /// Remote rings: the connection to the relay is lost, e.g. the
+    /// relay was stopped. Pop() returns nullptr from then on.
+    bool disconnected = false;
+};
+
+/**
+ * A consumer group that Extractors of the same channel share the
+ * records of a broadcast ring with (see ring_lookup_group()).
+ */
+struct ConsumerGroup {
+    std::string name;
+};
+
 /**
  * Used by client to lookup the registry information of any
  * Spring we are interested in and then actually reading from
  * their exposed ring buffers.
+ *
+ * Rings the registry reports as kFar are read through the relay
+ * of the host they live on (see relay::RelayServer).
+ *
+ * A local ring that has no NUMA node yet gets the node the
+ * Extractor is created on for the pages it faults in from then on;
+ * see ring_prefer(). Setting MPL_NUMA_NODE moves the ring, pages
+ * and all, to that node instead ("none" leaves it where it is); see
+ * ring_bind().
  * 
  */
 class Extractor {
 public:
     Extractor(std::string ownr_name, std::string channel_name,
               std::string addr = "127.0.0.1", in_port_t port = 40040);
+    /**
+     * Read a broadcast ring as a member of group: the Extractors
+     * of a group split its records between them while other
+     * Extractors still see all of them. Remote rings are read as
+     * if there were no group.
+     */
+    Extractor(std::string ownr_name, std::string channel_name,
+              ConsumerGroup group, std::string addr = "127.0.0.1",
+              in_port_t port = 40040);
     Extractor(Extractor const&) = delete;
     Extractor(Extractor&&) = delete;
     Extractor& operator=(Extractor const&) = delete;
     Extractor& operator=(Extractor&&) = delete;
     ~Extractor();
 
+    /**
+     * The next record, or nullptr if there is none. By default Pop()
+     * does not wait; see SetWaitStrategy().
+     */
     elem* Pop();
 
+    /**
+     * Like Pop(), but when the Spring runs in per-thread mode
+     * its lanes are merged in timestamp order (best effort).
+     * Records of a remote ring arrive in the order the relay
+     * drained them.
+     */
+    elem* PopOrdered();
+
+    /**
+     * Render a popped record as text. Structured records (see
+     * Spring::Log()) are formatted here against the format string
+     * their Spring published; text records are returned as is.
+     */
+    std::string Render(elem const* e) const;
+
+    /**
+     * Pop up to max records, render them and append them to sink.
+     *
+     * @return The number of records drained.
+     */
+    std::size_t DrainTo(FileSink& sink, std::size_t max = SIZE_MAX);
+
+    /**
+     * Like the above, but into an indexed store, keyed by this
+     * Extractor's owner and channel and each record's id.
+     */
+    std::size_t DrainTo(store::LogStore& ls, std::size_t max = SIZE_MAX);
+
+    /// Loss accounting of the records popped so far.
+    ExtractorStats Stats() const { return stats_; }
+
+    /**
+     * Choose how Pop() and PopOrdered() wait for a record when the
+     * ring is empty (see ring_wait). DrainTo() waits the same way.
+     * Records of a remote ring arrive as the relay sends them,
+     * regardless.
+     */
+    void SetWaitStrategy(ring_wait const& w);
+
+    /**
+     * Pop only records that f passes; the others are dropped and
+     * counted in ExtractorStats::filtered. On a local ring without
+     * lanes or broadcast slots they are looked at where they are
+     * and never copied out of the ring. Pass RecordFilter{} to see
+     * every record again.
+     */
+    void SetFilter(RecordFilter f);
+
+    /**
+     * Remove the ring segment once the Spring that owned it has
+     * exited and all of its records have been popped.
+     *
+     * @return true if the segment was removed. Always false for
+     * a remote ring; its relay host sweeps it.
+     */
+    bool Reclaim();
+
 private:
+    elem* Account(elem* e);
+    void Sequence(elem const& e);
+    bool Keep(elem const& e);
+    elem* Next(bool ordered);
+    elem* PopQueue();
+
+    std::string owner_;
+    std::string channel_;
     /**
      * A multi-producer multi-consumer lockfree ring buffer
      * that resides in a shared memory by all interested parties.
      * This is unique for all BufferLocation instances that
      * compare equal.
      */
-    ring* ring_;
+    ring* ring_ = nullptr;
+    /// ring_ as a typed ring whose pop is compiled in here, unless
+    /// it has lanes or is a broadcast ring.
+    mpl::ring<elem> queue_;
+    /// Set instead of ring_ when the ring is on another host.
+    std::unique_ptr<relay::RemoteRing> remote_;
+    ExtractorStats stats_;
+    /// The sequence number expected next, valid once a record was
+    /// popped.
+    uint32_t next_seq_ = 0;
+    /// Whether this Extractor shares a broadcast ring with the
+    /// other members of a consumer group.
+    bool grouped_ = false;
+    ring_wait wait_ = {};
+    RecordFilter filter_;
 };
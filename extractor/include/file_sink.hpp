@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+struct SinkError: public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+struct SinkOptions {
+    /// Size of each of the two write buffers, rounded up to a page.
+    std::size_t buf_size = 1 << 20;
+    /// Start a new file once the current one reaches this size; 0
+    /// disables size based rotation.
+    std::size_t max_file_size = 64 << 20;
+    /// Start a new file once the current one is this many seconds
+    /// old; 0 disables time based rotation.
+    unsigned max_file_age = 0;
+    /// Write through io_uring if the kernel allows it, otherwise
+    /// pwritev() on a writer thread.
+    bool use_io_uring = true;
+};
+
+class SinkIo;
+
+/**
+ * Writes records to a series of files named
+ * <dir>/<prefix>.<n>.log, one record per line.
+ *
+ * Records are gathered into two page aligned buffers. A full
+ * buffer is handed to the kernel as one write while the other one
+ * fills, so Append() only waits for the disk when it falls a whole
+ * buffer behind.
+ */
+class FileSink {
+public:
+    /**
+     * @throw SinkError if the first file cannot be created.
+     */
+    FileSink(std::string dir, std::string prefix, SinkOptions opts = {});
+    FileSink(FileSink const&) = delete;
+    FileSink(FileSink&&) = delete;
+    FileSink& operator=(FileSink const&) = delete;
+    FileSink& operator=(FileSink&&) = delete;
+    ~FileSink();
+
+    /**
+     * Queue rec followed by a newline.
+     *
+     * @throw SinkError if an earlier write or a rotation failed.
+     */
+    void Append(std::string_view rec);
+
+    /**
+     * Write out everything appended so far and wait for it.
+     */
+    void Flush();
+
+    /// The file records are currently appended to.
+    std::string const& Path() const { return path_; }
+
+    /// Whether writes go through io_uring.
+    bool UsingIoUring() const;
+
+private:
+    struct Buffer {
+        char*           data = nullptr;
+        std::size_t     len = 0;
+        /// File offset of the write in flight.
+        std::uint64_t   off = 0;
+        bool            inflight = false;
+    };
+
+    void Submit();
+    void Reap(unsigned b);
+    void Open();
+    void Rotate();
+    bool Expired() const;
+
+    std::string dir_;
+    std::string prefix_;
+    SinkOptions opts_;
+    std::unique_ptr<SinkIo> io_;
+    Buffer bufs_[2];
+    unsigned cur_ = 0;
+    unsigned seq_ = 0;
+    int fd_ = -1;
+    std::uint64_t off_ = 0;
+    std::uint64_t opened_ = 0;
+    std::string path_;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * Selects records by their text: a record passes if it starts with
+ * one of the prefixes or contains one of the substrings of the
+ * filter. The patterns are prepared once, when the filter is built,
+ * and scanned for with SIMD compares (AVX2 or SSE2, picked at run
+ * time) where the CPU has them.
+ *
+ * Structured records (see Spring::Log()) are matched by their
+ * format string rather than by their rendered text.
+ */
+class RecordFilter {
+public:
+    /// Passes every record.
+    RecordFilter() = default;
+
+    /// Passes records that contain s.
+    static RecordFilter Substring(std::string s);
+
+    /// Passes records that start with s.
+    static RecordFilter Prefix(std::string s);
+
+    /// Passes records that contain any of patterns.
+    static RecordFilter AnyOf(std::vector<std::string> patterns);
+
+    /// Also pass the records that other passes.
+    RecordFilter& Or(RecordFilter const& other);
+
+    /// Whether the record text [text, text + len) passes.
+    bool Match(char const* text, std::size_t len) const;
+
+    /// Whether the filter passes only some records.
+    explicit operator bool() const { return !patterns_.empty(); }
+
+private:
+    struct Pattern {
+        std::string text;
+        bool        prefix;
+    };
+
+    std::vector<Pattern> patterns_;
+};
@@ -1,5 +1,7 @@
 #include "extractor_lcl.hpp"
 
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 #include <netinet/in.h>
@@ -7,9 +9,50 @@
 #include <sys/socket.h>
 
 #include <registry_client.hpp>
+#include <relay.hpp>
+
+#include <store.hpp>
+
+#include "file_sink.hpp"
+
+namespace {
+
+/**
+ * Place ring r, which a consumer reads, on the node the consumer
+ * runs on, unless it was placed already. Only pages to come go
+ * there: moving those it has would take them away from the other
+ * members of a broadcast ring, and back again with every member
+ * that attaches on another node. MPL_NUMA_NODE moves the ring to
+ * that node, pages and all, or says "none" to leave it alone.
+ */
+void
+place_ring(ring* r)
+{
+    char const* env = getenv("MPL_NUMA_NODE");
+    if (env && strcmp(env, "none") == 0)
+        return;
+    if (env) {
+        int node = atoi(env);
+        if (node != ring_node(r))
+            ring_bind(r, node);
+        return;
+    }
+    int node = ring_cpu_node();
+    if (node >= 0 && ring_node(r) < 0)
+        ring_prefer(r, node);
+}
+
+}
 
 Extractor::Extractor(std::string ownr_name, std::string channel_name,
                      std::string addr, in_port_t port)
+    : Extractor{ownr_name, channel_name, ConsumerGroup{}, addr, port}
+{}
+
+Extractor::Extractor(std::string ownr_name, std::string channel_name,
+                     ConsumerGroup group, std::string addr, in_port_t port)
+    : owner_{ownr_name},
+      channel_{channel_name}
 {
     using namespace registry;
     sockaddr_in reg_sin = {AF_INET, port, 0};
@@ -20,29 +63,214 @@ Extractor::Extractor(std::string ownr_name, std::string channel_name,
         throw ChannelNotFound{};
     bool found = false;
     for (auto const& itm: result) {
-        if (itm.GetLocation().name == channel_name) {
+        auto const& loc = itm.GetLocation();
+        if (loc.name == channel_name) {
             auto ring_name = ownr_name + "_" + channel_name;
-            ring_ = ring_lookup(ring_name.c_str());
-            found = true;
+            if (loc.region == BufferLocation::kFar) {
+                try {
+                    remote_ = std::make_unique<relay::RemoteRing>(loc.addr, ring_name);
+                    found = true;
+                } catch (relay::RelayError const&) {}
+            } else {
+                ring_ = ring_lookup_group(ring_name.c_str(), group.name.c_str());
+                found = ring_ != nullptr;
+                if (found)
+                    queue_ = mpl::ring<elem>{ring_};
+                grouped_ = found && !group.name.empty() &&
+                           (ring_->flags & RING_F_BROADCAST);
+            }
             break;
         }
     }
     if (!found)
         throw ChannelNotFound{};
+    /* Producers write their records wherever they run; the consumer
+     * reads every one of them */
+    if (ring_)
+        place_ring(ring_);
     
 }
 
+namespace {
+
+/// A dequeue for ring_wait_for().
+struct PopOp {
+    ring*   r;
+    elem*   e;
+    int     (*dequeue)(ring*, elem**);
+};
+
+int
+pop(void* arg)
+{
+    auto op = static_cast<PopOp*>(arg);
+    if (op->dequeue(op->r, &op->e) == 0)
+        return 1;
+    op->e = nullptr;
+    return 0;
+}
+
+}
+
+void
+Extractor::SetWaitStrategy(ring_wait const& w)
+{
+    wait_ = w;
+}
+
+void
+Extractor::SetFilter(RecordFilter f)
+{
+    filter_ = std::move(f);
+}
+
 elem*
 Extractor::Pop()
 {
-    elem* e;
-    auto ret = ring_dequeue(ring_, &e);
-    if(0 == ret)
+    return Account(Next(false));
+}
+
+elem*
+Extractor::PopOrdered()
+{
+    return Account(Next(true));
+}
+
+/**
+ * The next record that passes the filter. Records of a remote ring
+ * or one with lanes are copied before they are looked at.
+ */
+elem*
+Extractor::Next(bool ordered)
+{
+    /* Without lanes the queue is already in order */
+    if (queue_)
+        return PopQueue();
+    for (;;) {
+        elem* e;
+        if (remote_) {
+            e = remote_->Pop();
+            stats_.disconnected = !e && remote_->Closed();
+        } else {
+            PopOp op{ring_, nullptr, ordered ? ring_dequeue_ordered : ring_dequeue};
+            ring_wait_for(ring_, &wait_, RING_EV_DATA, pop, &op);
+            e = op.e;
+        }
+        if (!e || Keep(*e))
+            return e;
+        free(e);
+    }
+}
+
+elem*
+Extractor::PopQueue()
+{
+    auto e = static_cast<elem*>(malloc(sizeof(elem)));
+    bool popped = filter_ ? queue_.pop_if(*e, [this](elem const& r) { return Keep(r); }, wait_)
+                          : queue_.pop(*e, wait_);
+    if (!popped) {
+        free(e);
+        return nullptr;
+    }
+    return e;
+}
+
+/**
+ * Whether e passes the filter. One that does not is accounted for
+ * as dropped.
+ */
+bool
+Extractor::Keep(elem const& e)
+{
+    bool pass;
+    if (e.fmt == 0) {
+        pass = filter_.Match(e.data, strnlen(e.data, sizeof(e.data)));
+    } else {
+        char const* fmt = remote_ ? remote_->Format(e.fmt) : ring_fmt_lookup(ring_, e.fmt);
+        pass = fmt && filter_.Match(fmt, strlen(fmt));
+    }
+    if (!pass) {
+        Sequence(e);
+        stats_.filtered++;
+    }
+    return pass;
+}
+
+/**
+ * Compare the sequence number of e with the one expected next.
+ * Differences are taken modulo 2^32 so that wrap-around is seamless.
+ */
+elem*
+Extractor::Account(elem* e)
+{
+    if (!e)
         return e;
-    return nullptr;
+    Sequence(*e);
+    stats_.records++;
+    return e;
 }
 
-Extractor::~Extractor()
+void
+Extractor::Sequence(elem const& e)
 {
+    /* The members of a group each see a share of the sequence */
+    if (grouped_)
+        return;
+    if (stats_.records + stats_.filtered == 0) {
+        next_seq_ = e.seq + 1;
+        return;
+    }
+    auto d = static_cast<int32_t>(e.seq - next_seq_);
+    if (d > 0) {
+        stats_.gaps++;
+        stats_.lost += d;
+        next_seq_ = e.seq + 1;
+    } else if (d < 0) {
+        stats_.reordered++;
+        if (stats_.lost > 0)
+            stats_.lost--;
+    } else {
+        next_seq_++;
+    }
+}
+
+std::size_t
+Extractor::DrainTo(FileSink& sink, std::size_t max)
+{
+    std::size_t n = 0;
+    for (; n < max; n++) {
+        elem* e = Pop();
+        if (!e)
+            break;
+        sink.Append(Render(e));
+        free(e);
+    }
+    return n;
+}
+
+std::size_t
+Extractor::DrainTo(store::LogStore& ls, std::size_t max)
+{
+    std::size_t n = 0;
+    for (; n < max; n++) {
+        elem* e = Pop();
+        if (!e)
+            break;
+        ls.Append(owner_, channel_, e->id, Render(e));
+        free(e);
+    }
+    return n;
+}
+
+bool
+Extractor::Reclaim()
+{
+    if (remote_)
+        return false;
+    return 0 == ring_reclaim(ring_);
+}
 
+Extractor::~Extractor()
+{
+    ring_free(ring_);
 }
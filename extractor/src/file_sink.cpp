@@ -0,0 +1,213 @@
+#include "file_sink.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sink_io.hpp"
+
+namespace {
+
+constexpr std::size_t kSinkAlign = 4096;
+
+std::uint64_t
+now_sec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+/**
+ * One past the highest <n> of the <prefix>.<n>.log files in dir,
+ * so that a restarted sink never overwrites earlier files.
+ */
+unsigned
+next_seq(std::string const& dir, std::string const& prefix)
+{
+    unsigned seq = 0;
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+        return seq;
+    while (auto de = readdir(d)) {
+        std::string name = de->d_name;
+        if (name.compare(0, prefix.size() + 1, prefix + ".") != 0)
+            continue;
+        char* end;
+        auto n = strtoul(name.c_str() + prefix.size() + 1, &end, 10);
+        if (end != name.c_str() + prefix.size() + 1 && strcmp(end, ".log") == 0)
+            seq = std::max<unsigned>(seq, n + 1);
+    }
+    closedir(d);
+    return seq;
+}
+
+void
+throw_errno(std::string const& what, int err)
+{
+    throw SinkError{what + ": " + strerror(err)};
+}
+
+}
+
+FileSink::FileSink(std::string dir, std::string prefix, SinkOptions opts)
+    : dir_{std::move(dir)},
+      prefix_{std::move(prefix)},
+      opts_{opts}
+{
+    opts_.buf_size = (std::max<std::size_t>(opts_.buf_size, 1) + kSinkAlign - 1)
+                     & ~(kSinkAlign - 1);
+    for (auto& b : bufs_) {
+        void* p;
+        if (posix_memalign(&p, kSinkAlign, opts_.buf_size) != 0)
+            throw SinkError{"cannot allocate sink buffers"};
+        b.data = static_cast<char*>(p);
+    }
+    if (opts_.use_io_uring)
+        io_ = make_uring_io();
+    if (!io_)
+        io_ = make_pwrite_io();
+    seq_ = next_seq(dir_, prefix_);
+    try {
+        Open();
+    } catch (SinkError const&) {
+        for (auto& b : bufs_)
+            free(b.data);
+        throw;
+    }
+}
+
+FileSink::~FileSink()
+{
+    try {
+        Flush();
+    } catch (SinkError const&) {}
+    io_.reset();
+    if (fd_ >= 0)
+        close(fd_);
+    for (auto& b : bufs_)
+        free(b.data);
+}
+
+bool
+FileSink::UsingIoUring() const
+{
+    return io_->IsUring();
+}
+
+void
+FileSink::Append(std::string_view rec)
+{
+    std::size_t need = rec.size() + 1;
+    if ((opts_.max_file_size &&
+         off_ + bufs_[cur_].len > 0 &&
+         off_ + bufs_[cur_].len + need > opts_.max_file_size) ||
+        Expired())
+        Rotate();
+
+    if (bufs_[cur_].len + need > opts_.buf_size)
+        Submit();
+    if (need > opts_.buf_size) {
+        /* Too large to buffer; write it out in place. */
+        Flush();
+        std::string line{rec};
+        line += '\n';
+        std::size_t done = 0;
+        while (done < line.size()) {
+            ssize_t n = pwrite(fd_, line.data() + done, line.size() - done, off_ + done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw_errno("write " + path_, n < 0 ? errno : EIO);
+            done += n;
+        }
+        off_ += line.size();
+        return;
+    }
+
+    auto& b = bufs_[cur_];
+    memcpy(b.data + b.len, rec.data(), rec.size());
+    b.data[b.len + rec.size()] = '\n';
+    b.len += need;
+}
+
+void
+FileSink::Flush()
+{
+    Submit();
+    for (unsigned i = 0; i < 2; i++)
+        if (bufs_[i].inflight)
+            Reap(i);
+}
+
+/**
+ * Hand the current buffer to the kernel and switch to the other
+ * one, waiting for its previous write if that is still going.
+ */
+void
+FileSink::Submit()
+{
+    auto& b = bufs_[cur_];
+    if (b.len == 0)
+        return;
+    io_->Submit(cur_, fd_, b.data, b.len, off_);
+    b.inflight = true;
+    b.off = off_;
+    off_ += b.len;
+    cur_ ^= 1;
+    if (bufs_[cur_].inflight)
+        Reap(cur_);
+}
+
+void
+FileSink::Reap(unsigned i)
+{
+    auto& b = bufs_[i];
+    ssize_t res = io_->Wait(i);
+    b.inflight = false;
+    std::size_t len = b.len;
+    b.len = 0;
+    if (res < 0)
+        throw_errno("write " + path_, -res);
+    /* Finish a short write in place. */
+    for (std::size_t done = res; done < len; ) {
+        ssize_t n = pwrite(fd_, b.data + done, len - done, b.off + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            throw_errno("write " + path_, n < 0 ? errno : EIO);
+        done += n;
+    }
+}
+
+void
+FileSink::Open()
+{
+    path_ = dir_ + "/" + prefix_ + "." + std::to_string(seq_++) + ".log";
+    fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+        throw_errno("open " + path_, errno);
+    off_ = 0;
+    opened_ = now_sec();
+}
+
+void
+FileSink::Rotate()
+{
+    Flush();
+    close(fd_);
+    fd_ = -1;
+    Open();
+}
+
+bool
+FileSink::Expired() const
+{
+    return opts_.max_file_age && now_sec() - opened_ >= opts_.max_file_age;
+}
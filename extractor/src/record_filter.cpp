@@ -0,0 +1,143 @@
+#include "record_filter.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/**
+ * Whether n bytes of pattern p occur in [s, s + len), n > 1. Blocks
+ * of candidate positions are found by comparing the first and the
+ * last byte of p at once, and only those are compared in full.
+ */
+using find_fn = bool (*)(char const* s, std::size_t len, char const* p, std::size_t n);
+
+bool
+find_scalar(char const* s, std::size_t len, char const* p, std::size_t n)
+{
+    return memmem(s, len, p, n) != nullptr;
+}
+
+#if defined(__x86_64__)
+
+/// Compare the candidates of a block, one bit per position in mask.
+inline bool
+verify(char const* s, std::size_t i, uint32_t mask, char const* p, std::size_t n)
+{
+    for (; mask; mask &= mask - 1) {
+        std::size_t at = i + __builtin_ctz(mask);
+        if (memcmp(s + at + 1, p + 1, n - 2) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool
+find_sse2(char const* s, std::size_t len, char const* p, std::size_t n)
+{
+    __m128i const first = _mm_set1_epi8(p[0]);
+    __m128i const last = _mm_set1_epi8(p[n - 1]);
+    std::size_t i = 0;
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        __m128i f = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + i));
+        __m128i l = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + i + n - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first),
+                                                        _mm_cmpeq_epi8(l, last)));
+        if (mask && verify(s, i, mask, p, n))
+            return true;
+    }
+    return find_scalar(s + i, len - i, p, n);
+}
+
+__attribute__((target("avx2")))
+bool
+find_avx2(char const* s, std::size_t len, char const* p, std::size_t n)
+{
+    __m256i const first = _mm256_set1_epi8(p[0]);
+    __m256i const last = _mm256_set1_epi8(p[n - 1]);
+    std::size_t i = 0;
+    for (; i + n - 1 + 32 <= len; i += 32) {
+        __m256i f = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(s + i));
+        __m256i l = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(s + i + n - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(f, first),
+                                                              _mm256_cmpeq_epi8(l, last)));
+        if (mask && verify(s, i, mask, p, n))
+            return true;
+    }
+    return find_sse2(s + i, len - i, p, n);
+}
+
+find_fn
+pick_find()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? find_avx2 : find_sse2;
+}
+
+#endif
+
+bool
+find(char const* s, std::size_t len, std::string const& p)
+{
+    if (p.size() > len)
+        return false;
+    if (p.size() <= 1)
+        return p.empty() || memchr(s, p[0], len) != nullptr;
+#if defined(__x86_64__)
+    static find_fn const fn = pick_find();
+#else
+    find_fn const fn = find_scalar;
+#endif
+    return fn(s, len, p.data(), p.size());
+}
+
+}
+
+RecordFilter
+RecordFilter::Substring(std::string s)
+{
+    RecordFilter f;
+    f.patterns_.push_back({std::move(s), false});
+    return f;
+}
+
+RecordFilter
+RecordFilter::Prefix(std::string s)
+{
+    RecordFilter f;
+    f.patterns_.push_back({std::move(s), true});
+    return f;
+}
+
+RecordFilter
+RecordFilter::AnyOf(std::vector<std::string> patterns)
+{
+    RecordFilter f;
+    for (auto& p : patterns)
+        f.patterns_.push_back({std::move(p), false});
+    return f;
+}
+
+RecordFilter&
+RecordFilter::Or(RecordFilter const& other)
+{
+    patterns_.insert(patterns_.end(), other.patterns_.begin(), other.patterns_.end());
+    return *this;
+}
+
+bool
+RecordFilter::Match(char const* text, std::size_t len) const
+{
+    if (patterns_.empty())
+        return true;
+    for (auto const& p : patterns_) {
+        if (p.prefix ? len >= p.text.size() && memcmp(text, p.text.data(), p.text.size()) == 0
+                     : find(text, len, p.text))
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,181 @@
+#include "extractor_lcl.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+#include <relay.hpp>
+
+namespace {
+
+/**
+ * One decoded argument of a structured record.
+ */
+struct Arg {
+    int                 tag;
+    union {
+        int64_t         i;
+        uint64_t        u;
+        double          f;
+    };
+    std::string_view    s;
+};
+
+bool
+NextArg(char const*& p, char const* end, Arg& a)
+{
+    if (p >= end || *p == RING_ARG_END)
+        return false;
+    a.tag = *p++;
+    if (a.tag == RING_ARG_STR) {
+        uint16_t n;
+        if (end - p < static_cast<std::ptrdiff_t>(sizeof(n)))
+            return false;
+        memcpy(&n, p, sizeof(n));
+        p += sizeof(n);
+        if (end - p < n)
+            return false;
+        a.s = std::string_view{p, n};
+        p += n;
+        return true;
+    }
+    if (end - p < 8)
+        return false;
+    memcpy(&a.u, p, 8);
+    p += 8;
+    return a.tag >= RING_ARG_I64 && a.tag <= RING_ARG_PTR;
+}
+
+int64_t
+AsI64(Arg const& a)
+{
+    switch (a.tag) {
+    case RING_ARG_F64:  return static_cast<int64_t>(a.f);
+    case RING_ARG_STR:  return strtoll(std::string{a.s}.c_str(), nullptr, 0);
+    default:            return a.i;
+    }
+}
+
+double
+AsF64(Arg const& a)
+{
+    switch (a.tag) {
+    case RING_ARG_F64:  return a.f;
+    case RING_ARG_U64:  return static_cast<double>(a.u);
+    case RING_ARG_STR:  return strtod(std::string{a.s}.c_str(), nullptr);
+    default:            return static_cast<double>(a.i);
+    }
+}
+
+std::string
+AsStr(Arg const& a)
+{
+    switch (a.tag) {
+    case RING_ARG_STR:  return std::string{a.s};
+    case RING_ARG_F64:  return std::to_string(a.f);
+    case RING_ARG_U64:  return std::to_string(a.u);
+    default:            return std::to_string(a.i);
+    }
+}
+
+/**
+ * Format a single argument with a conversion spec made of the
+ * flags, width and precision of the original (spec) and conv.
+ */
+void
+FormatArg(std::string& out, std::string spec, char conv, Arg const& a)
+{
+    char buf[256];
+    switch (conv) {
+    case 'd': case 'i':
+        spec += "lld";
+        snprintf(buf, sizeof(buf), spec.c_str(), static_cast<long long>(AsI64(a)));
+        break;
+    case 'u': case 'x': case 'X': case 'o':
+        spec += "ll";
+        spec += conv;
+        snprintf(buf, sizeof(buf), spec.c_str(),
+                 static_cast<unsigned long long>(AsI64(a)));
+        break;
+    case 'c':
+        spec += 'c';
+        snprintf(buf, sizeof(buf), spec.c_str(), static_cast<int>(AsI64(a)));
+        break;
+    case 'f': case 'F': case 'e': case 'E':
+    case 'g': case 'G': case 'a': case 'A':
+        spec += conv;
+        snprintf(buf, sizeof(buf), spec.c_str(), AsF64(a));
+        break;
+    case 'p':
+        spec += 'p';
+        snprintf(buf, sizeof(buf), spec.c_str(),
+                 reinterpret_cast<void*>(static_cast<uintptr_t>(a.u)));
+        break;
+    case 's':
+        spec += 's';
+        snprintf(buf, sizeof(buf), spec.c_str(), AsStr(a).c_str());
+        break;
+    default:
+        snprintf(buf, sizeof(buf), "<bad conversion %%%c>", conv);
+        break;
+    }
+    out += buf;
+}
+
+std::string
+RenderRecord(char const* fmt, char const* data, std::size_t sz)
+{
+    std::string out;
+    char const* p = data;
+    char const* end = data + sz;
+
+    for (char const* f = fmt; *f; ) {
+        if (*f != '%') {
+            out += *f++;
+            continue;
+        }
+        if (f[1] == '%') {
+            out += '%';
+            f += 2;
+            continue;
+        }
+        std::string spec{*f++};
+        while (*f && strchr("-+ #0", *f))
+            spec += *f++;
+        while (isdigit(*f))
+            spec += *f++;
+        if (*f == '.') {
+            spec += *f++;
+            while (isdigit(*f))
+                spec += *f++;
+        }
+        /* Arguments are stored at full width; drop length modifiers */
+        while (*f && strchr("hlLqjzt", *f))
+            f++;
+        if (!*f)
+            break;
+        char conv = *f++;
+        Arg a;
+        if (!NextArg(p, end, a)) {
+            out += "<missing>";
+            continue;
+        }
+        FormatArg(out, spec, conv, a);
+    }
+    return out;
+}
+
+}
+
+std::string
+Extractor::Render(elem const* e) const
+{
+    if (e->fmt == 0)
+        return std::string{e->data, strnlen(e->data, sizeof(e->data))};
+    char const* fmt = remote_ ? remote_->Format(e->fmt)
+                              : ring_fmt_lookup(ring_, e->fmt);
+    if (!fmt)
+        return "<unknown format " + std::to_string(e->fmt) + ">";
+    return RenderRecord(fmt, e->data, sizeof(e->data));
+}
@@ -0,0 +1,278 @@
+#include "sink_io.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define SINK_HAVE_URING 1
+#endif
+
+namespace {
+
+/**
+ * pwritev() all of len, retrying on short writes.
+ *
+ * @return len or -errno.
+ */
+ssize_t
+pwrite_all(int fd, char const* p, std::size_t len, off_t off)
+{
+    std::size_t done = 0;
+    while (done < len) {
+        iovec iov = {const_cast<char*>(p + done), len - done};
+        ssize_t n = pwritev(fd, &iov, 1, off + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -errno;
+        if (n == 0)
+            return -EIO;
+        done += n;
+    }
+    return done;
+}
+
+#ifdef SINK_HAVE_URING
+
+/**
+ * A minimal io_uring driven through the raw system calls: one
+ * IORING_OP_WRITEV per buffer, completions reaped on demand.
+ */
+class UringIo: public SinkIo {
+public:
+    static std::unique_ptr<SinkIo> Create() {
+        std::unique_ptr<UringIo> u{new UringIo};
+        if (!u->Setup())
+            return nullptr;
+        return u;
+    }
+
+    ~UringIo() override {
+        if (sqes_)
+            munmap(sqes_, sqes_sz_);
+        if (cq_ptr_ && cq_ptr_ != sq_ptr_)
+            munmap(cq_ptr_, cq_sz_);
+        if (sq_ptr_)
+            munmap(sq_ptr_, sq_sz_);
+        if (fd_ >= 0)
+            close(fd_);
+    }
+
+    void Submit(unsigned tag, int fd, char const* p,
+                std::size_t len, off_t off) override {
+        iov_[tag] = {const_cast<char*>(p), len};
+        done_[tag] = false;
+        unsigned tail = *sq_tail_;
+        unsigned idx = tail & *sq_mask_;
+        auto sqe = &sqes_[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&iov_[tag]);
+        sqe->len = 1;
+        sqe->off = off;
+        sqe->user_data = tag;
+        sq_array_[idx] = idx;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        int ret;
+        do {
+            ret = syscall(__NR_io_uring_enter, fd_, 1, 0, 0, nullptr, 0);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) {
+            res_[tag] = -errno;
+            done_[tag] = true;
+        }
+    }
+
+    ssize_t Wait(unsigned tag) override {
+        while (!done_[tag]) {
+            unsigned head = *cq_head_;
+            if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+                int ret = syscall(__NR_io_uring_enter, fd_, 0, 1,
+                                  IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (ret < 0 && errno != EINTR)
+                    return -errno;
+                continue;
+            }
+            auto cqe = &cqes_[head & *cq_mask_];
+            if (cqe->user_data < kMaxTags) {
+                res_[cqe->user_data] = cqe->res;
+                done_[cqe->user_data] = true;
+            }
+            __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        }
+        return res_[tag];
+    }
+
+    bool IsUring() const override { return true; }
+
+private:
+    static constexpr unsigned kDepth = 4;
+
+    UringIo() = default;
+
+    bool Setup() {
+        io_uring_params p = {};
+        fd_ = syscall(__NR_io_uring_setup, kDepth, &p);
+        if (fd_ < 0)
+            return false;
+        sq_sz_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_sz_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sq_sz_ = cq_sz_ = std::max(sq_sz_, cq_sz_);
+        sq_ptr_ = Map(sq_sz_, IORING_OFF_SQ_RING);
+        if (!sq_ptr_)
+            return false;
+        cq_ptr_ = single ? sq_ptr_ : Map(cq_sz_, IORING_OFF_CQ_RING);
+        if (!cq_ptr_)
+            return false;
+        sqes_sz_ = p.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(Map(sqes_sz_, IORING_OFF_SQES));
+        if (!sqes_)
+            return false;
+
+        auto sq = static_cast<char*>(sq_ptr_);
+        auto cq = static_cast<char*>(cq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    void* Map(std::size_t sz, off_t off) {
+        void* p = mmap(nullptr, sz, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd_, off);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    int fd_ = -1;
+    void* sq_ptr_ = nullptr;
+    void* cq_ptr_ = nullptr;
+    std::size_t sq_sz_ = 0;
+    std::size_t cq_sz_ = 0;
+    std::size_t sqes_sz_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    iovec iov_[kMaxTags] = {};
+    ssize_t res_[kMaxTags] = {};
+    bool done_[kMaxTags] = {};
+};
+
+#endif
+
+class PwriteIo: public SinkIo {
+public:
+    PwriteIo()
+        : writer_{&PwriteIo::Run, this} {}
+
+    ~PwriteIo() override {
+        {
+            std::lock_guard<std::mutex> lk{mtx_};
+            stop_ = true;
+        }
+        cv_.notify_all();
+        writer_.join();
+    }
+
+    void Submit(unsigned tag, int fd, char const* p,
+                std::size_t len, off_t off) override {
+        {
+            std::lock_guard<std::mutex> lk{mtx_};
+            jobs_[tag] = Job{fd, p, len, off, true, false, 0};
+        }
+        cv_.notify_all();
+    }
+
+    ssize_t Wait(unsigned tag) override {
+        std::unique_lock<std::mutex> lk{mtx_};
+        cv_.wait(lk, [&]{ return jobs_[tag].done; });
+        jobs_[tag].done = false;
+        return jobs_[tag].res;
+    }
+
+    bool IsUring() const override { return false; }
+
+private:
+    struct Job {
+        int         fd;
+        char const* p;
+        std::size_t len;
+        off_t       off;
+        bool        pending;
+        bool        done;
+        ssize_t     res;
+    };
+
+    /* Writes are taken in file offset order; FileSink never has
+     * more than one queued behind the one in progress. */
+    void Run() {
+        std::unique_lock<std::mutex> lk{mtx_};
+        for (;;) {
+            cv_.wait(lk, [&]{ return stop_ || Next() != nullptr; });
+            auto j = Next();
+            if (!j)
+                return;
+            j->pending = false;
+            auto job = *j;
+            lk.unlock();
+            auto res = pwrite_all(job.fd, job.p, job.len, job.off);
+            lk.lock();
+            j->res = res;
+            j->done = true;
+            cv_.notify_all();
+        }
+    }
+
+    Job* Next() {
+        Job* j = nullptr;
+        for (auto& c : jobs_)
+            if (c.pending && (!j || c.off < j->off))
+                j = &c;
+        return j;
+    }
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    Job jobs_[kMaxTags] = {};
+    bool stop_ = false;
+    std::thread writer_;
+};
+
+}
+
+std::unique_ptr<SinkIo>
+make_uring_io()
+{
+#ifdef SINK_HAVE_URING
+    return UringIo::Create();
+#else
+    return nullptr;
+#endif
+}
+
+std::unique_ptr<SinkIo>
+make_pwrite_io()
+{
+    return std::make_unique<PwriteIo>();
+}
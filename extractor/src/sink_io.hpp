@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include <sys/types.h>
+
+/**
+ * Asynchronous positional writes of whole buffers. Each write is
+ * identified by a small tag (the FileSink buffer index); a tag is
+ * reused only after Wait() returned for it.
+ */
+class SinkIo {
+public:
+    static constexpr unsigned kMaxTags = 2;
+
+    virtual ~SinkIo() = default;
+
+    /// Start writing len bytes at p to fd at offset off.
+    virtual void Submit(unsigned tag, int fd, char const* p,
+                        std::size_t len, off_t off) = 0;
+
+    /**
+     * Block until the write tagged tag completes.
+     *
+     * @return The number of bytes written or -errno.
+     */
+    virtual ssize_t Wait(unsigned tag) = 0;
+
+    virtual bool IsUring() const = 0;
+};
+
+/**
+ * An io_uring backed SinkIo, or nullptr if the kernel does not
+ * offer io_uring.
+ */
+std::unique_ptr<SinkIo>
+make_uring_io();
+
+/// A SinkIo that calls pwritev() on a writer thread.
+std::unique_ptr<SinkIo>
+make_pwrite_io();
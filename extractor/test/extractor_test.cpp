@@ -1,9 +1,23 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 #include <gtest/gtest.h>
 
 #include <ring.h>
 #include <spring.hpp>
 #include <extractor.hpp>
+#include <relay.hpp>
+#include <store.hpp>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 using ::testing::EmptyTestEventListener;
 using ::testing::InitGoogleTest;
@@ -19,6 +33,29 @@ namespace {
 
 using namespace std::literals;
 
+/**
+ * Unlinks the segments of the channels the tests read, all named
+ * chanx, before and after each test, so that a run does not read
+ * what an earlier one left queued.
+ */
+class SegmentJanitor : public EmptyTestEventListener {
+    void OnTestStart(TestInfo const&) override { Unlink(); }
+    void OnTestEnd(TestInfo const&) override { Unlink(); }
+
+    static void Unlink() {
+        DIR* d = opendir("/dev/shm");
+        if (!d)
+            return;
+        while (dirent* de = readdir(d))
+            if (strncmp(de->d_name, "SEG4xRING_", 10) == 0 && strstr(de->d_name, "_chanx"))
+                shm_unlink(de->d_name);
+        closedir(d);
+    }
+};
+
+/* gtest_main runs the tests; the listener goes in before it does */
+bool const kJanitor = (UnitTest::GetInstance()->listeners().Append(new SegmentJanitor), true);
+
 TEST(Extractor, SpringPushExtractorPop) {
     std::size_t id = 987;
     std::string msg = "[XYZ] cool message";
@@ -31,6 +68,388 @@ TEST(Extractor, SpringPushExtractorPop) {
     ASSERT_STREQ(static_cast<char*>(e->data), msg.c_str());
 }
 
+TEST(Extractor, StatsCountLoss) {
+    Spring sp{"Lossy", "chanx", 128, sizeof(elem)};
+    Extractor ex{"Lossy", "chanx"};
+    for (std::size_t i = 0; i < RING_CAPACITY + 10; i++)
+        sp.Push("x", i);
+    std::size_t popped = 0;
+    while (elem* e = ex.Pop()) {
+        free(e);
+        popped++;
+    }
+    ASSERT_EQ(popped, RING_CAPACITY);
+    ASSERT_EQ(ex.Stats().lost, 0u);
+
+    sp.Push("after", 0);
+    elem* e = ex.Pop();
+    ASSERT_NE(e, nullptr);
+    free(e);
+    auto st = ex.Stats();
+    ASSERT_EQ(st.records, RING_CAPACITY + 1);
+    ASSERT_EQ(st.lost, 10u);
+    ASSERT_EQ(st.gaps, 1u);
+    ASSERT_EQ(st.reordered, 0u);
+}
+
+TEST(Extractor, ReclaimWhileSpringAlive) {
+    Spring sp{"Reclaimer", "chanx", 128, sizeof(elem)};
+    Extractor ex{"Reclaimer", "chanx"};
+    ASSERT_EQ(ex.Pop(), nullptr);
+    ASSERT_FALSE(ex.Reclaim());
+}
+
+TEST(Extractor, PerThreadPopOrdered) {
+    ring_attr attr {0, 2};
+    Spring sp{"Lanes", "chanx", 128, sizeof(elem), attr};
+    for (std::size_t t = 0; t < 2; t++)
+        std::thread{[&sp, t]{
+            for (std::size_t i = 0; i < 10; i++)
+                sp.Push("[XYZ] lane message", t * 10 + i);
+        }}.join();
+
+    Extractor ex{"Lanes", "chanx"};
+    for (std::size_t id = 0; id < 20; id++) {
+        elem* e = ex.PopOrdered();
+        ASSERT_NE(e, nullptr);
+        ASSERT_EQ(e->id, id);
+        free(e);
+    }
+    ASSERT_EQ(ex.PopOrdered(), nullptr);
+}
+
+TEST(Extractor, BroadcastFanOut) {
+    ring_attr attr {RING_F_BROADCAST};
+    Spring sp{"Fanout", "chanx", 128, sizeof(elem), attr};
+    Extractor tail{"Fanout", "chanx"};
+    Extractor archiver{"Fanout", "chanx"};
+    for (std::size_t i = 0; i < 10; i++)
+        sp.Push("[XYZ] broadcast message", i);
+
+    for (auto ex : {&tail, &archiver}) {
+        for (std::size_t id = 0; id < 10; id++) {
+            elem* e = ex->Pop();
+            ASSERT_NE(e, nullptr);
+            ASSERT_EQ(e->id, id);
+            free(e);
+        }
+        ASSERT_EQ(ex->Pop(), nullptr);
+        ASSERT_EQ(ex->Stats().gaps, 0u);
+    }
+}
+
+TEST(Extractor, ConsumerGroup) {
+    ring_attr attr {RING_F_BROADCAST};
+    Spring sp{"Grouped", "chanx", 1024, sizeof(elem), attr};
+    Extractor a{"Grouped", "chanx", ConsumerGroup{"archive"}};
+    Extractor b{"Grouped", "chanx", ConsumerGroup{"archive"}};
+    Extractor tail{"Grouped", "chanx"};
+    for (std::size_t i = 0; i < 300; i++)
+        sp.Push("[XYZ] grouped message", i);
+
+    std::vector<int> seen(300);
+    for (bool more = true; more; ) {
+        more = false;
+        for (auto ex : {&a, &b})
+            if (elem* e = ex->Pop()) {
+                seen[e->id]++;
+                free(e);
+                more = true;
+            }
+    }
+    ASSERT_EQ(std::count(seen.begin(), seen.end(), 1), 300);
+    ASSERT_GT(a.Stats().records, 0u);
+    ASSERT_GT(b.Stats().records, 0u);
+
+    std::size_t n = 0;
+    while (elem* e = tail.Pop()) {
+        free(e);
+        n++;
+    }
+    ASSERT_EQ(n, 300u);
+}
+
+TEST(RecordFilter, MatchesLikeFind) {
+    std::string text;
+    for (std::size_t i = 0; i < 300; i++)
+        text += static_cast<char>('a' + i * 7 % 26);
+    for (std::size_t n : {1u, 2u, 3u, 17u, 33u, 64u})
+        for (std::size_t at = 0; at + n <= text.size(); at += 13) {
+            auto f = RecordFilter::Substring(text.substr(at, n));
+            for (std::size_t len : {at + n - 1, at + n, text.size()})
+                ASSERT_EQ(f.Match(text.data(), len),
+                          text.substr(0, len).find(text.substr(at, n)) != std::string::npos);
+        }
+    ASSERT_FALSE(RecordFilter::Substring("zz").Match(text.data(), text.size()));
+    ASSERT_TRUE(RecordFilter{}.Match("", 0));
+}
+
+TEST(Extractor, FilterDropsInPlace) {
+    Spring sp{"Filtered", "chanx", 128, sizeof(elem)};
+    Extractor ex{"Filtered", "chanx"};
+    ex.SetFilter(RecordFilter::Substring("ERROR").Or(RecordFilter::Prefix("[alert]")));
+    for (std::size_t i = 0; i < 30; i++)
+        sp.Push(i % 3 == 0 ? "disk ERROR on sda" : i % 3 == 1 ? "[alert] hot" : "fine", i);
+    sp.Log(sp.Format("ERROR %d"), 30, 1);
+    sp.Log(sp.Format("ok %d"), 31, 2);
+
+    std::vector<std::size_t> ids;
+    while (elem* e = ex.Pop()) {
+        ids.push_back(e->id);
+        free(e);
+    }
+    ASSERT_EQ(ids.size(), 21u);
+    ASSERT_EQ(ids.back(), 30u);
+    auto st = ex.Stats();
+    ASSERT_EQ(st.filtered, 11u);
+    ASSERT_EQ(st.lost, 0u);
+    ASSERT_EQ(st.gaps, 0u);
+}
+
+TEST(Extractor, FilterLanes) {
+    ring_attr attr {0, 2};
+    Spring sp{"FilteredLanes", "chanx", 128, sizeof(elem), attr};
+    for (std::size_t t = 0; t < 2; t++)
+        std::thread{[&sp, t]{
+            for (std::size_t i = 0; i < 10; i++)
+                sp.Push(i % 2 ? "[XYZ] keep" : "[XYZ] drop", t * 10 + i);
+        }}.join();
+
+    Extractor ex{"FilteredLanes", "chanx"};
+    ex.SetFilter(RecordFilter::AnyOf({"keep", "never"}));
+    for (std::size_t id = 1; id < 20; id += 2) {
+        elem* e = ex.PopOrdered();
+        ASSERT_NE(e, nullptr);
+        ASSERT_EQ(e->id, id);
+        free(e);
+    }
+    ASSERT_EQ(ex.PopOrdered(), nullptr);
+    ASSERT_EQ(ex.Stats().filtered, 10u);
+}
+
+TEST(Extractor, PopWaits) {
+    Spring sp{"Waiter", "chanx", 128, sizeof(elem)};
+    Extractor ex{"Waiter", "chanx"};
+    ex.SetWaitStrategy(ring_wait{RING_WAIT_ADAPTIVE, 100, 5000000});
+    std::thread producer{[&sp]{
+        std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        sp.Push("[XYZ] late message", 5);
+    }};
+    elem* e = ex.Pop();
+    producer.join();
+    ASSERT_NE(e, nullptr);
+    ASSERT_EQ(e->id, 5);
+    free(e);
+
+    ex.SetWaitStrategy(ring_wait{RING_WAIT_PARK, 10, 1000});
+    ASSERT_EQ(ex.Pop(), nullptr);
+}
+
+TEST(Extractor, StructuredRender) {
+    Spring sp{"Structured", "chanx", 128, sizeof(elem)};
+    auto fmt = sp.Format("user %s logged in %d times from %#x, load %.2f%%");
+    ASSERT_NE(fmt, 0u);
+    ASSERT_EQ(sp.Format("user %s logged in %d times from %#x, load %.2f%%"), fmt);
+    ASSERT_NE(sp.Format("another %s"), fmt);
+    sp.Log(fmt, 42, "alice", -3, 0xbeefu, 12.345);
+    sp.Push("plain text", 43);
+
+    Extractor ex{"Structured", "chanx"};
+    elem* e = ex.Pop();
+    ASSERT_NE(e, nullptr);
+    ASSERT_EQ(e->id, 42);
+    ASSERT_EQ(ex.Render(e),
+              "user alice logged in -3 times from 0xbeef, load 12.35%");
+    free(e);
+    e = ex.Pop();
+    ASSERT_NE(e, nullptr);
+    ASSERT_EQ(ex.Render(e), "plain text");
+    free(e);
+}
+
+TEST(Extractor, LogStaticRender) {
+    Spring sp{"LogStatic", "chanx", 128, sizeof(elem)};
+    std::string path = "/index.html";
+    for (int i = 0; i < 2; i++)
+        SPRING_LOG(sp, i, "GET %s -> %d in %.1fus", path, 200 + i, 2.5);
+
+    Extractor ex{"LogStatic", "chanx"};
+    for (int i = 0; i < 2; i++) {
+        elem* e = ex.Pop();
+        ASSERT_NE(e, nullptr);
+        ASSERT_EQ(ex.Render(e),
+                  "GET /index.html -> " + std::to_string(200 + i) + " in 2.5us");
+        free(e);
+    }
+}
+
+TEST(Extractor, RemotePop) {
+    relay::RelayServer rs{"127.0.0.1", 0};
+    rs.Start();
+    setenv("MPL_RELAY", ("127.0.0.1:" + std::to_string(rs.Port())).c_str(), 1);
+    Spring sp{"Remote", "chanx", 128, sizeof(elem)};
+    unsetenv("MPL_RELAY");
+    sp.Push("over the wire", 11);
+    sp.Log(sp.Format("remote %d"), 12, 42);
+
+    Extractor ex{"Remote", "chanx"};
+    std::vector<std::string> got;
+    for (int i = 0; i < 1000 && got.size() < 2; i++) {
+        if (elem* e = ex.Pop()) {
+            got.push_back(ex.Render(e));
+            free(e);
+        } else {
+            std::this_thread::sleep_for(1ms);
+        }
+    }
+    ASSERT_EQ(got, (std::vector<std::string>{"over the wire", "remote 42"}));
+    ASSERT_FALSE(ex.Reclaim());
+}
+
+TEST(Extractor, RemoteRelayStops) {
+    relay::RelayServer rs{"127.0.0.1", 0};
+    rs.Start();
+    setenv("MPL_RELAY", ("127.0.0.1:" + std::to_string(rs.Port())).c_str(), 1);
+    Spring sp{"RemoteStop", "chanx", 128, sizeof(elem)};
+    unsetenv("MPL_RELAY");
+    sp.Push("before the stop", 11);
+
+    Extractor ex{"RemoteStop", "chanx"};
+    elem* e = nullptr;
+    for (int i = 0; i < 1000 && !(e = ex.Pop()); i++)
+        std::this_thread::sleep_for(1ms);
+    ASSERT_NE(e, nullptr);
+    free(e);
+    ASSERT_FALSE(ex.Stats().disconnected);
+
+    /* Losing the relay is no error, just the end of the records */
+    rs.Stop();
+    for (int i = 0; i < 1000 && !ex.Stats().disconnected; i++) {
+        ASSERT_EQ(ex.Pop(), nullptr);
+        std::this_thread::sleep_for(1ms);
+    }
+    ASSERT_TRUE(ex.Stats().disconnected);
+    ASSERT_EQ(ex.PopOrdered(), nullptr);
+}
+
+std::string
+make_tmpdir()
+{
+    char tmpl[] = "/tmp/file_sink.XXXXXX";
+    return mkdtemp(tmpl);
+}
+
+std::string
+slurp(std::string const& path)
+{
+    std::ifstream in{path};
+    return std::string{std::istreambuf_iterator<char>{in}, {}};
+}
+
+void
+check_sink(SinkOptions opts)
+{
+    auto dir = make_tmpdir();
+    std::string expected;
+    {
+        FileSink sink{dir, "sink", opts};
+        if (!opts.use_io_uring) {
+            ASSERT_FALSE(sink.UsingIoUring());
+        }
+        for (int i = 0; i < 2000; i++) {
+            auto rec = "record " + std::to_string(i);
+            sink.Append(rec);
+            expected += rec + "\n";
+        }
+    }
+    std::string got;
+    for (int i = 0; ; i++) {
+        auto path = dir + "/sink." + std::to_string(i) + ".log";
+        if (access(path.c_str(), F_OK) != 0)
+            break;
+        auto part = slurp(path);
+        ASSERT_LE(part.size(), opts.max_file_size);
+        got += part;
+        unlink(path.c_str());
+    }
+    rmdir(dir.c_str());
+    ASSERT_EQ(got, expected);
+}
+
+TEST(FileSink, RotateBySize) {
+    SinkOptions opts;
+    opts.buf_size = 4096;
+    opts.max_file_size = 10000;
+    check_sink(opts);
+}
+
+TEST(FileSink, PwriteFallback) {
+    SinkOptions opts;
+    opts.buf_size = 4096;
+    opts.max_file_size = 10000;
+    opts.use_io_uring = false;
+    check_sink(opts);
+}
+
+TEST(FileSink, NeverOverwrites) {
+    auto dir = make_tmpdir();
+    std::string first, second;
+    {
+        FileSink sink{dir, "sink"};
+        sink.Append("first");
+        first = sink.Path();
+    }
+    {
+        FileSink sink{dir, "sink"};
+        sink.Append("second");
+        second = sink.Path();
+    }
+    ASSERT_NE(first, second);
+    ASSERT_EQ(slurp(first), "first\n");
+    ASSERT_EQ(slurp(second), "second\n");
+    unlink(first.c_str());
+    unlink(second.c_str());
+    rmdir(dir.c_str());
+}
+
+TEST(Extractor, DrainToFileSink) {
+    Spring sp{"Drainer", "chanx", 128, sizeof(elem)};
+    sp.Push("one", 1);
+    sp.Log(sp.Format("two %d"), 2, 2);
+
+    auto dir = make_tmpdir();
+    std::string path;
+    {
+        Extractor ex{"Drainer", "chanx"};
+        FileSink sink{dir, "drain"};
+        ASSERT_EQ(ex.DrainTo(sink), 2u);
+        sink.Flush();
+        path = sink.Path();
+        ASSERT_EQ(slurp(path), "one\ntwo 2\n");
+    }
+    unlink(path.c_str());
+    rmdir(dir.c_str());
+}
+
+TEST(Extractor, DrainToLogStore) {
+    Spring sp{"Storer", "chanx", 128, sizeof(elem)};
+    sp.Push("one", 1);
+    sp.Log(sp.Format("two %d"), 2, 2);
+
+    auto dir = make_tmpdir();
+    {
+        Extractor ex{"Storer", "chanx"};
+        store::LogStore ls{dir};
+        ASSERT_EQ(ex.DrainTo(ls), 2u);
+        std::vector<std::string> got;
+        ls.QueryId("Storer", "chanx", 2, 2, [&](store::Record const& r) {
+            got.emplace_back(r.text);
+        });
+        ASSERT_EQ(got, std::vector<std::string>{"two 2"});
+    }
+    ASSERT_EQ(system(("rm -rf " + dir).c_str()), 0);
+}
+
 void helper1() { Extractor ext{"ExtractingFromNonExistentChannel","chany"}; }
 
 TEST(Extractor, ExtractingFromNonExistentChannel) {
@@ -2,6 +2,7 @@
 
 #include <variant>
 #include <string>
+#include <cstdlib>
 #include <cassert>
 #include <exception>
 
@@ -22,6 +23,52 @@ using NetAddr = std::variant<std::monostate,
                              sockaddr_in,
                              sockaddr_in6>;
 
+/**
+ * @brief Render a NetAddr as "ip:port", or "[ip]:port" for IPv6.
+ * std::monostate renders as an empty string. As with
+ * RegistryLocation, ports are kept in host byte order.
+ */
+inline std::string
+netaddr_to_string(NetAddr const& a)
+{
+    char ipstr[INET6_ADDRSTRLEN];
+    if (auto sin = std::get_if<sockaddr_in>(&a)) {
+        inet_ntop(AF_INET, &sin->sin_addr, ipstr, sizeof(ipstr));
+        return std::string{ipstr} + ":" + std::to_string(sin->sin_port);
+    } else if (auto sin6 = std::get_if<sockaddr_in6>(&a)) {
+        inet_ntop(AF_INET6, &sin6->sin6_addr, ipstr, sizeof(ipstr));
+        return "[" + std::string{ipstr} + "]:" + std::to_string(sin6->sin6_port);
+    }
+    return std::string{};
+}
+
+/**
+ * @brief Parse the output of netaddr_to_string(). Returns
+ * std::monostate if s is not a valid address.
+ */
+inline NetAddr
+netaddr_from_string(std::string const& s)
+{
+    auto colon = s.rfind(':');
+    if (colon == std::string::npos)
+        return NetAddr{};
+    auto host = s.substr(0, colon);
+    auto port = static_cast<in_port_t>(strtoul(s.c_str() + colon + 1, nullptr, 10));
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        sockaddr_in6 sin6 = {};
+        sin6.sin6_family = AF_INET6;
+        sin6.sin6_port = port;
+        if (inet_pton(AF_INET6, host.substr(1, host.size() - 2).c_str(),
+                      &sin6.sin6_addr) == 1)
+            return NetAddr{sin6};
+        return NetAddr{};
+    }
+    sockaddr_in sin = {AF_INET, port, 0};
+    if (inet_pton(AF_INET, host.c_str(), &sin.sin_addr) == 1)
+        return NetAddr{sin};
+    return NetAddr{};
+}
+
 struct BufferLocation
 {
     using NameType = std::string;
@@ -106,7 +153,7 @@ class RegItem {
         }
         template <typename T>
         explicit RegItem(T const& rgitm)
-            : RegItem{rgitm.name(), rgitm.location()} {}
+            : RegItem{rgitm.name(), LocationOf(rgitm)} {}
         RegItem(RegItem const& ri) = default;
         RegItem(RegItem&& ri) = default;
         RegItem& operator=(RegItem const& other) {
@@ -127,6 +174,18 @@ class RegItem {
         operator==(RegItem const&, RegItem const&);
 
     private:
+        /**
+         * Build the BufferLocation of a serialized RegItem; a
+         * non-empty relay address makes it a kFar location.
+         */
+        template <typename T>
+        static BufferLocation LocationOf(T const& rgitm) {
+            if (rgitm.addr().empty())
+                return BufferLocation{rgitm.location()};
+            return BufferLocation{rgitm.location(),
+                                  netaddr_from_string(rgitm.addr())};
+        }
+
         /**
          * This should generally describe the process that is
          * using the Spring. It is the same for all Springs
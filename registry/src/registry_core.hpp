@@ -337,6 +337,7 @@ private:
     int CheckCallbacks(RegItem const& ri);
     void InitDb();
     bool CheckDb();
+    static RegItem ItemFromRow(sqlite3_stmt* sql_stmt);
     bool SqlSelectInDb(std::string criteria, std::vector<RegItem>& matches);
 };
 
@@ -361,6 +362,7 @@ RegistryImplSQLite::InitDb()
                 "CREATE TABLE " + kItemsTableName + " ("                \
                 "NAME   TEXT                              NOT NULL,"    \
                 "LOCA   TEXT                              NOT NULL,"    \
+                "ADDR   TEXT                  DEFAULT ''  NOT NULL,"    \
                 "PRIMARY KEY('NAME', 'LOCA'));";
         int rc = sqlite3_exec(db_, query.c_str(), NULL, 0, &zErrMsg);
         if (SQLITE_OK != rc) {
@@ -369,9 +371,28 @@ RegistryImplSQLite::InitDb()
         } else {
             LOG(INFO) << "Table ITEMS created successfully";
         }
+    } else {
+        /* Databases created before kFar locations were stored
+         * lack the ADDR column; this fails harmlessly otherwise. */
+        std::string query = "ALTER TABLE " + kItemsTableName +
+                            " ADD COLUMN ADDR TEXT DEFAULT '' NOT NULL;";
+        sqlite3_exec(db_, query.c_str(), NULL, NULL, NULL);
     }
 }
 
+RegItem
+RegistryImplSQLite::ItemFromRow(sqlite3_stmt* sql_stmt)
+{
+    char const* name = (char const*)sqlite3_column_text(sql_stmt, 0);
+    char const* loca = (char const*)sqlite3_column_text(sql_stmt, 1);
+    char const* addr = (char const*)sqlite3_column_text(sql_stmt, 2);
+    if (!addr || !*addr)
+        return RegItem{std::string{name}, BufferLocation{std::string{loca}}};
+    return RegItem{std::string{name},
+                   BufferLocation{std::string{loca},
+                                  netaddr_from_string(addr)}};
+}
+
 inline
 RegistryImplSQLite::RegistryImplSQLite(std::string db_path = "registry.sqlite")
 {
@@ -400,8 +421,8 @@ RegistryImplSQLite::Register(RegItem ri)
     sqlite3_stmt* sql_stmt;
     char const* pzTail;
 
-    std::string query = "INSERT OR IGNORE INTO " + kItemsTableName + "  (NAME, LOCA) "    \
-                        "VALUES (?,?);"; 
+    std::string query = "INSERT OR IGNORE INTO " + kItemsTableName + "  (NAME, LOCA, ADDR) "    \
+                        "VALUES (?,?,?);"; 
     rc = sqlite3_prepare(db_, query.c_str(), 1024, &sql_stmt, &pzTail);
     rc = sqlite3_bind_text(sql_stmt,
                            1,
@@ -421,6 +442,18 @@ RegistryImplSQLite::Register(RegItem ri)
         LOG(ERROR) << "Can't insert into table " << kItemsTableName << ": " << sqlite3_errmsg(db_);
         throw SQLite3InsertionFailed{};
     }
+    std::string addr = ri.GetLocation().region == BufferLocation::kFar
+                       ? netaddr_to_string(ri.GetLocation().addr)
+                       : std::string{};
+    rc = sqlite3_bind_text(sql_stmt,
+                           3,
+                           addr.c_str(),
+                           addr.size(),
+                           SQLITE_TRANSIENT);
+    if (rc != SQLITE_OK) {
+        LOG(ERROR) << "Can't insert into table " << kItemsTableName << ": " << sqlite3_errmsg(db_);
+        throw SQLite3InsertionFailed{};
+    }
     rc = sqlite3_step(sql_stmt);
     if (rc != SQLITE_DONE) {
         LOG(ERROR) << "Can't insert into table " << kItemsTableName << ": " << sqlite3_errmsg(db_);
@@ -509,13 +542,8 @@ RegistryImplSQLite::SqlSelectInDb(std::string criteria, std::vector<RegItem>& ma
         throw SQLite3InsertionFailed{};
     }
 
-    while ((rc = sqlite3_step(sql_stmt)) == SQLITE_ROW) {
-        char const* name = (char const*)sqlite3_column_text(sql_stmt, 0);
-        char const* loca = (char const*)sqlite3_column_text(sql_stmt, 1);
-        matches.push_back(
-            RegItem{std::string{name},
-                    BufferLocation{std::string{loca}}});
-    }
+    while ((rc = sqlite3_step(sql_stmt)) == SQLITE_ROW)
+        matches.push_back(ItemFromRow(sql_stmt));
     if (rc != SQLITE_DONE) {
         LOG(ERROR) << "Can't search filter in table "
                    << kItemsTableName << ": " << sqlite3_errmsg(db_);
@@ -598,14 +626,8 @@ RegistryImplSQLite::CheckFilters(Filter const flt)
         throw SQLite3InsertionFailed{};
     }
 
-    while ((rc = sqlite3_step(sql_stmt)) == SQLITE_ROW) {
-        char const* name = (char const*)sqlite3_column_text(sql_stmt, 0);
-        char const* loca = (char const*)sqlite3_column_text(sql_stmt, 1);
-        matches.push_back(
-            RegItem{
-                std::string{name},
-                BufferLocation{std::string{loca}}});
-    }
+    while ((rc = sqlite3_step(sql_stmt)) == SQLITE_ROW)
+        matches.push_back(ItemFromRow(sql_stmt));
     if (rc != SQLITE_DONE) {
         LOG(ERROR) << "Can't search filter in table ITEMS: " << sqlite3_errmsg(db_);
         throw SQLite3InsertionFailed{};
@@ -766,6 +788,8 @@ private:
                                     "Could allocate memory for gRPC message."};
             x->set_name(itm.GetName());
             x->set_location(itm.GetLocation().name);
+            if (itm.GetLocation().region == BufferLocation::kFar)
+                x->set_addr(netaddr_to_string(itm.GetLocation().addr));
         }
         rslt->set_code(std::size(items));
         rslt->set_error_message("Success");
@@ -881,7 +905,7 @@ class ClientComChannel {
                 throw LookupFailed{};
             for (int i = 0; i < result.reg_item_size(); i++) {
                 auto r = result.reg_item(i);
-                RegItem rgitem{r.name(), r.location()};
+                RegItem rgitem{r};
                 items.push_back(rgitem);
             }
             return items;
@@ -893,6 +917,8 @@ class ClientComChannel {
             auto rgitm = msg.add_reg_item();
             rgitm->set_name(reg_item.GetName());
             rgitm->set_location(reg_item.GetLocation().name);
+            if (reg_item.GetLocation().region == BufferLocation::kFar)
+                rgitm->set_addr(netaddr_to_string(reg_item.GetLocation().addr));
             ClientContext context;
             grpc::Status status = stub_->Register(&context, msg, &result);
             if (!status.ok())
@@ -905,6 +931,8 @@ class ClientComChannel {
             auto rgitm = msg.add_reg_item();
             rgitm->set_name(reg_item.GetName());
             rgitm->set_location(reg_item.GetLocation().name);
+            if (reg_item.GetLocation().region == BufferLocation::kFar)
+                rgitm->set_addr(netaddr_to_string(reg_item.GetLocation().addr));
             ClientContext context;
             grpc::Status status = stub_->Unregister(&context, msg, &result);
             if (!status.ok())
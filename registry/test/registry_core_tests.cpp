@@ -268,4 +268,30 @@ TEST(RegistryCore, DBRegisterUnregisterRegisterThenAddCallback) {
     ASSERT_EQ(recv, 0);
 }
 
+TEST(RegistryCore, NetAddrRoundTrip) {
+    auto a = registry::netaddr_from_string("10.1.2.3:40050");
+    ASSERT_TRUE(std::holds_alternative<sockaddr_in>(a));
+    ASSERT_EQ(std::get<sockaddr_in>(a).sin_port, 40050);
+    ASSERT_EQ(registry::netaddr_to_string(a), "10.1.2.3:40050");
+    auto a6 = registry::netaddr_from_string("[::1]:40050");
+    ASSERT_TRUE(std::holds_alternative<sockaddr_in6>(a6));
+    ASSERT_EQ(registry::netaddr_to_string(a6), "[::1]:40050");
+    ASSERT_TRUE(std::holds_alternative<std::monostate>(
+                    registry::netaddr_from_string("not an address")));
+}
+
+TEST(RegistryCore, DBRegisterFarLocation) {
+    registry::RegistryDB<FakeChan> reg;
+    auto proc_name = "host_process_far"s;
+    auto relay = registry::netaddr_from_string("10.1.2.3:40050");
+    reg.Register(registry::RegItem{proc_name,
+                                   registry::BufferLocation{"chan_far"s, relay}});
+    auto result = reg.Lookup(proc_name);
+    ASSERT_EQ(std::size(result), 1);
+    auto const& loc = result[0].GetLocation();
+    ASSERT_EQ(loc.region, registry::BufferLocation::kFar);
+    ASSERT_EQ(registry::netaddr_to_string(loc.addr), "10.1.2.3:40050");
+    reg.Unregister(result[0]);
+}
+
 }
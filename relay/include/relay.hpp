@@ -0,0 +1,7 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "relay_common.hpp"
+
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include <ring.h>
+#include <registry_common.hpp>
+
+namespace relay
+{
+
+/// The port a relay listens on unless told otherwise.
+constexpr in_port_t kDefaultPort = 40050;
+
+/// Records a RemoteRing lets the relay send ahead of Pop().
+constexpr uint32_t kDefaultWindow = 8192;
+
+struct RelayError: public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief Serves the rings of this host to Extractors on other
+ * hosts.
+ *
+ * Each connection attaches to one ring by name. From then on the
+ * relay drains that ring and streams its records, along with the
+ * format strings they refer to, over the connection. Records are
+ * removed from the ring as they are sent, so a ring should be
+ * read either through its relay or locally, not both.
+ */
+class RelayServer {
+public:
+    /**
+     * @param addr The IPv4 address to listen on.
+     * @param port The port to listen on; 0 picks a free one (see
+     * Port()).
+     */
+    RelayServer(std::string addr = "0.0.0.0", in_port_t port = kDefaultPort);
+    RelayServer(RelayServer const&) = delete;
+    RelayServer(RelayServer&&) = delete;
+    RelayServer& operator=(RelayServer const&) = delete;
+    RelayServer& operator=(RelayServer&&) = delete;
+    ~RelayServer();
+
+    /**
+     * Start accepting connections in the background.
+     *
+     * @throw RelayError if the listening socket cannot be set up.
+     */
+    void Start();
+
+    /**
+     * Stop accepting, close all connections and join their
+     * threads.
+     */
+    void Stop();
+
+    /**
+     * Block until Stop() is called from another thread.
+     */
+    void Wait();
+
+    /// The port the relay is listening on, in host byte order.
+    in_port_t Port() const { return port_; }
+
+private:
+    void Accept();
+    void Reap();
+    void Serve(int fd);
+
+    std::string addr_;
+    in_port_t port_;
+    int lfd_ = -1;
+    std::atomic<bool> stop_{false};
+    std::thread acceptor_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::vector<std::thread> conns_;
+    /// Connection threads that are done, for Accept() to join.
+    std::vector<std::thread::id> done_;
+    std::vector<int> fds_;
+};
+
+/**
+ * @brief The client end of a relay connection: a ring that lives
+ * on another host.
+ */
+class RemoteRing {
+public:
+    /**
+     * Connect to the relay at addr and attach to ring_name.
+     *
+     * @param window How many records the relay may send before
+     * they are popped. Whatever does not fit stays in the ring.
+     * @throw RelayError if the relay cannot be reached or has no
+     * such ring.
+     */
+    RemoteRing(registry::NetAddr const& addr, std::string const& ring_name,
+               uint32_t window = kDefaultWindow);
+    RemoteRing(RemoteRing const&) = delete;
+    RemoteRing(RemoteRing&&) = delete;
+    RemoteRing& operator=(RemoteRing const&) = delete;
+    RemoteRing& operator=(RemoteRing&&) = delete;
+    ~RemoteRing();
+
+    /**
+     * The next record received from the relay, or nullptr if none
+     * has arrived yet or none will (see Closed()). Like
+     * ring_dequeue(), the element is malloc'd and owned by the
+     * caller.
+     */
+    elem* Pop();
+
+    /**
+     * Whether the connection is gone: the relay hung up or stopped,
+     * or sent frames that cannot be read. Records received before
+     * are still popped; no more arrive.
+     */
+    bool Closed() const { return closed_; }
+
+    /**
+     * The format string the relay published under id, or nullptr
+     * if there is none.
+     */
+    char const* Format(uint32_t id) const;
+
+private:
+    bool Receive();
+    bool ParseFrame();
+
+    int fd_ = -1;
+    bool closed_ = false;
+    uint32_t window_;
+    /// Records popped since credit was last handed back.
+    uint32_t consumed_ = 0;
+    uint32_t features_ = 0;
+    std::vector<char> buf_;
+    std::deque<elem> recs_;
+    std::unordered_map<uint32_t, std::string> fmts_;
+};
+
+}
@@ -0,0 +1,41 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "relay_lcl.hpp"
+
+using namespace google;
+
+namespace {
+
+static bool port_validator(char const* flag, uint32 port)
+{
+    return (((port << 16) >> 16) == port);
+}
+
+DEFINE_string(ip, "0.0.0.0", "Bind address for the relay");
+DEFINE_uint32(port, relay::kDefaultPort, "Bind port for the relay");
+DEFINE_validator(port, &port_validator);
+
+}
+
+int main(int argc, char* argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_alsologtostderr = true;
+    gflags::SetVersionString("1.0.0");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+    relay::RelayServer rs{FLAGS_ip, static_cast<in_port_t>(FLAGS_port)};
+    try {
+        rs.Start();
+    } catch (relay::RelayError const& e) {
+        LOG(ERROR) << e.what();
+        return EXIT_FAILURE;
+    }
+    LOG(INFO) << "relaying rings on " << FLAGS_ip << ":" << rs.Port();
+    rs.Wait();
+
+    google::ShutdownGoogleLogging();
+
+    return 0;
+}
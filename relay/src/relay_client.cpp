@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "relay_lcl.hpp"
+
+namespace relay
+{
+
+namespace {
+
+int
+connect_to(registry::NetAddr const& addr)
+{
+    sockaddr_storage ss = {};
+    socklen_t len = 0;
+    if (auto sin = std::get_if<sockaddr_in>(&addr)) {
+        auto p = reinterpret_cast<sockaddr_in*>(&ss);
+        *p = *sin;
+        p->sin_port = htons(sin->sin_port);
+        len = sizeof(*p);
+    } else if (auto sin6 = std::get_if<sockaddr_in6>(&addr)) {
+        auto p = reinterpret_cast<sockaddr_in6*>(&ss);
+        *p = *sin6;
+        p->sin6_port = htons(sin6->sin6_port);
+        len = sizeof(*p);
+    } else {
+        throw RelayError{"no relay address"};
+    }
+
+    int fd = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw RelayError{std::string{"socket: "} + strerror(errno)};
+    if (connect(fd, reinterpret_cast<sockaddr*>(&ss), len) < 0) {
+        std::string err = strerror(errno);
+        close(fd);
+        throw RelayError{"cannot reach relay " +
+                         registry::netaddr_to_string(addr) + ": " + err};
+    }
+    return fd;
+}
+
+}
+
+RemoteRing::RemoteRing(registry::NetAddr const& addr, std::string const& ring_name,
+                       uint32_t window)
+    : fd_{connect_to(addr)},
+      window_{std::max(window, 1u)}
+{
+    AttachReq ar = {htobe32(kRelayVersion), htobe32(kLocalFeatures), htobe32(window_)};
+    std::string req{reinterpret_cast<char*>(&ar), sizeof(ar)};
+    req += ring_name;
+
+    FrameType t = kAttach;
+    std::string reply;
+    if (!send_frame(fd_, kAttach, req.data(), req.size()) ||
+        !recv_frame(fd_, t, reply) || t != kAttach || reply.size() < sizeof(uint32_t)) {
+        close(fd_);
+        throw RelayError{t == kError ? reply : "relay hung up"};
+    }
+    features_ = get_u32(reply.data());
+}
+
+RemoteRing::~RemoteRing()
+{
+    close(fd_);
+}
+
+elem*
+RemoteRing::Pop()
+{
+    if (recs_.empty())
+        while (Receive() && recs_.empty())
+            ;
+    if (recs_.empty())
+        return nullptr;
+    auto e = static_cast<elem*>(malloc(sizeof(elem)));
+    *e = recs_.front();
+    recs_.pop_front();
+    /* Hand credit back in chunks of half a window so that the
+     * relay can keep a round in flight while we drain this one. */
+    if (++consumed_ >= (window_ + 1) / 2 && !closed_ &&
+        send_u32_frame(fd_, kCredit, consumed_))
+        consumed_ = 0;
+    return e;
+}
+
+char const*
+RemoteRing::Format(uint32_t id) const
+{
+    auto it = fmts_.find(id);
+    return it == fmts_.end() ? nullptr : it->second.c_str();
+}
+
+/**
+ * Read whatever the relay has sent so far without blocking and
+ * parse the complete frames in it. A connection that is gone, or
+ * that carries a frame that cannot be parsed, is closed.
+ *
+ * @return false if nothing new was read.
+ */
+bool
+RemoteRing::Receive()
+{
+    if (closed_)
+        return false;
+    char chunk[64 * 1024];
+    ssize_t n = recv(fd_, chunk, sizeof(chunk), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        closed_ = true;
+    if (n <= 0)
+        return false;
+    buf_.insert(buf_.end(), chunk, chunk + n);
+    try {
+        while (ParseFrame())
+            ;
+    } catch (RelayError const&) {
+        /* Nothing after it can be framed either */
+        closed_ = true;
+        buf_.clear();
+    }
+    return true;
+}
+
+bool
+RemoteRing::ParseFrame()
+{
+    FrameHdr h;
+    if (buf_.size() < sizeof(h))
+        return false;
+    memcpy(&h, buf_.data(), sizeof(h));
+    auto len = be32toh(h.len);
+    if (be32toh(h.magic) != kRelayMagic || len > kMaxFrameLen)
+        throw RelayError{"malformed frame from relay"};
+    if (buf_.size() < sizeof(h) + len)
+        return false;
+
+    char const* p = buf_.data() + sizeof(h);
+    switch (be16toh(h.type)) {
+    case kRecords: {
+        auto count = be32toh(h.count);
+        std::size_t raw = std::size_t{count} * sizeof(WireElem);
+        std::vector<char> unz;
+        if (raw > kMaxFrameLen)
+            throw RelayError{"malformed frame from relay"};
+        if (be16toh(h.flags) & kFrameLz4) {
+#ifdef RELAY_WITH_LZ4
+            unz.resize(raw);
+            if (LZ4_decompress_safe(p, unz.data(), len, raw) != static_cast<int>(raw))
+                throw RelayError{"corrupt frame from relay"};
+            p = unz.data();
+#else
+            throw RelayError{"relay sent a compressed frame"};
+#endif
+        } else if (raw > len) {
+            throw RelayError{"malformed frame from relay"};
+        }
+        for (std::size_t off = 0; off < raw; off += sizeof(WireElem)) {
+            WireElem w;
+            memcpy(&w, p + off, sizeof(w));
+            recs_.push_back(from_wire(w));
+        }
+        break;
+    }
+    case kFormat:
+        if (len > sizeof(uint32_t))
+            fmts_[get_u32(p)] = std::string{p + sizeof(uint32_t), len - sizeof(uint32_t)};
+        break;
+    default:
+        break;
+    }
+    buf_.erase(buf_.begin(), buf_.begin() + sizeof(h) + len);
+    return true;
+}
+
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <endian.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#ifdef RELAY_WITH_LZ4
+#include <lz4.h>
+#endif
+
+#include "relay_common.hpp"
+
+namespace relay
+{
+
+/*
+ * Wire format. Every frame starts with a FrameHdr; all integers
+ * are big endian.
+ *
+ *   kAttach   client -> relay: AttachReq followed by the ring name.
+ *             relay -> client: be32 features the relay will use.
+ *   kError    relay -> client: a message; the relay hangs up.
+ *   kFormat   relay -> client: be32 id followed by the string.
+ *   kRecords  relay -> client: FrameHdr::count WireElems, LZ4
+ *             compressed as a whole if kFrameLz4 is set.
+ *   kCredit   client -> relay: be32 number of further records the
+ *             client is ready to take.
+ *
+ * The relay never sends more records than the client has granted
+ * credit for. Records it has no credit for stay in the ring, so a
+ * slow reader fills the ring just as a slow local reader would.
+ */
+constexpr uint32_t kRelayMagic = 0x4d504c52;    // "MPLR"
+constexpr uint32_t kRelayVersion = 3;
+
+enum FrameType: uint16_t {
+    kAttach = 1,
+    kError,
+    kFormat,
+    kRecords,
+    kCredit,
+};
+
+/// FrameHdr::flags
+constexpr uint16_t kFrameLz4 = 0x1;
+
+/// AttachReq::features
+constexpr uint32_t kFeatureLz4 = 0x1;
+
+struct FrameHdr {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t flags;
+    uint32_t len;
+    uint32_t count;
+};
+
+struct AttachReq {
+    uint32_t version;
+    uint32_t features;
+    uint32_t credit;
+};
+
+struct WireElem {
+    uint64_t id;
+    uint64_t ts;
+    uint32_t fmt;
+    uint32_t seq;
+    char     data[kElemDataSz];
+} __attribute__((packed));
+
+/// Upper bound on a frame payload; anything larger is garbage.
+constexpr uint32_t kMaxFrameLen = 1u << 20;
+
+/// Records sent per kRecords frame at most.
+constexpr std::size_t kRelayBatch = 256;
+
+/// kRecords frames handed to the kernel per sendmsg() at most.
+constexpr std::size_t kRelayPipeline = 8;
+
+/// The features this build can use.
+#ifdef RELAY_WITH_LZ4
+constexpr uint32_t kLocalFeatures = kFeatureLz4;
+#else
+constexpr uint32_t kLocalFeatures = 0;
+#endif
+
+inline FrameHdr
+frame_hdr(FrameType t, std::size_t len, uint32_t count = 0, uint16_t flags = 0)
+{
+    return FrameHdr{htobe32(kRelayMagic), htobe16(t), htobe16(flags),
+                    htobe32(static_cast<uint32_t>(len)), htobe32(count)};
+}
+
+/**
+ * The number of leading bytes of e.data that carry the record: the
+ * NUL terminated text, or the encoded arguments up to RING_ARG_END.
+ */
+inline std::size_t
+used_len(elem const& e)
+{
+    if (e.fmt == 0)
+        return strnlen(e.data, sizeof(e.data));
+    std::size_t off = 0;
+    while (off < sizeof(e.data) && e.data[off] != RING_ARG_END) {
+        if (e.data[off] == RING_ARG_STR) {
+            uint16_t n = 0;
+            if (off + 1 + sizeof(n) <= sizeof(e.data))
+                memcpy(&n, e.data + off + 1, sizeof(n));
+            off += 1 + sizeof(n) + n;
+        } else {
+            off += 1 + 8;
+        }
+    }
+    return std::min(off, sizeof(e.data));
+}
+
+/**
+ * Convert e to its wire form. Bytes past the end of the record are
+ * zeroed so that they compress away and leak nothing.
+ */
+inline void
+to_wire(elem const& e, WireElem& w)
+{
+    auto n = used_len(e);
+    w.id = htobe64(e.id);
+    w.ts = htobe64(e.ts);
+    w.fmt = htobe32(e.fmt);
+    w.seq = htobe32(e.seq);
+    memcpy(w.data, e.data, n);
+    memset(w.data + n, 0, sizeof(w.data) - n);
+}
+
+inline elem
+from_wire(WireElem const& w)
+{
+    elem e;
+    e.id = be64toh(w.id);
+    e.ts = be64toh(w.ts);
+    e.fmt = be32toh(w.fmt);
+    e.seq = be32toh(w.seq);
+    memcpy(e.data, w.data, sizeof(e.data));
+    return e;
+}
+
+/**
+ * Write all of iov, retrying on short writes. A peer that went
+ * away is reported rather than raising SIGPIPE.
+ *
+ * @return false if the peer went away.
+ */
+inline bool
+write_all(int fd, iovec* iov, std::size_t cnt)
+{
+    while (cnt > 0) {
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        while (cnt > 0 && static_cast<std::size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+inline bool
+send_frame(int fd, FrameType t, void const* p, std::size_t len)
+{
+    FrameHdr h = frame_hdr(t, len);
+    iovec iov[2] = {{&h, sizeof(h)}, {const_cast<void*>(p), len}};
+    return write_all(fd, iov, len ? 2 : 1);
+}
+
+inline bool
+send_u32_frame(int fd, FrameType t, uint32_t v)
+{
+    v = htobe32(v);
+    return send_frame(fd, t, &v, sizeof(v));
+}
+
+inline bool
+read_all(int fd, void* p, std::size_t len)
+{
+    auto c = static_cast<char*>(p);
+    while (len > 0) {
+        ssize_t n = read(fd, c, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        c += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * Read one whole frame. Returns false on a closed connection or a
+ * malformed header.
+ */
+inline bool
+recv_frame(int fd, FrameType& t, std::string& payload)
+{
+    FrameHdr h;
+    if (!read_all(fd, &h, sizeof(h)) || be32toh(h.magic) != kRelayMagic)
+        return false;
+    auto len = be32toh(h.len);
+    if (len > kMaxFrameLen)
+        return false;
+    t = static_cast<FrameType>(be16toh(h.type));
+    payload.resize(len);
+    return read_all(fd, payload.data(), len);
+}
+
+inline uint32_t
+get_u32(char const* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return be32toh(v);
+}
+
+}
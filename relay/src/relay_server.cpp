@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <memory>
+#include <unordered_set>
+
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <glog/logging.h>
+
+#include "relay_lcl.hpp"
+
+namespace relay
+{
+
+namespace {
+
+/// How long an idle connection sleeps before polling its ring again.
+constexpr int kIdlePollMs = 1;
+
+/// How long a new connection has to name its ring.
+constexpr timeval kAttachTimeout = {5, 0};
+
+/**
+ * Collect pending kCredit frames from the client, waiting up to
+ * timeout_ms for the first one.
+ *
+ * @return false if the client went away.
+ */
+bool
+take_credit(int fd, uint32_t& credit, int timeout_ms)
+{
+    pollfd pfd = {fd, POLLIN, 0};
+    while (poll(&pfd, 1, timeout_ms) > 0) {
+        FrameType t;
+        std::string payload;
+        if (!recv_frame(fd, t, payload))
+            return false;
+        if (t == kCredit && payload.size() >= sizeof(uint32_t))
+            credit += get_u32(payload.data());
+        timeout_ms = 0;
+    }
+    return true;
+}
+
+/**
+ * The frames of one round, handed to the kernel with a single
+ * sendmsg() straight from the buffers they were built in.
+ */
+class Pipeline {
+public:
+    explicit Pipeline(bool lz4)
+        : lz4_{lz4} {}
+
+    bool Empty() const { return pieces_.empty(); }
+    bool Full() const { return frames_ == kRelayPipeline; }
+
+    void AddFormat(uint32_t id, char const* fmt) {
+        ids_[nids_] = htobe32(id);
+        std::size_t len = strlen(fmt);
+        pieces_.push_back({frame_hdr(kFormat, sizeof(uint32_t) + len),
+                           &ids_[nids_++], fmt, len});
+    }
+
+    /**
+     * Add a kRecords frame holding n records. Room for them is
+     * taken from Records().
+     */
+    void AddRecords(std::size_t n) {
+        char const* p = reinterpret_cast<char*>(Records());
+        std::size_t len = n * sizeof(WireElem);
+        uint16_t flags = 0;
+#ifdef RELAY_WITH_LZ4
+        if (lz4_) {
+            auto& z = lz4buf_[frames_];
+            z.resize(LZ4_compressBound(len));
+            int zlen = LZ4_compress_default(p, z.data(), len, z.size());
+            if (zlen > 0 && static_cast<std::size_t>(zlen) < len) {
+                p = z.data();
+                len = zlen;
+                flags = kFrameLz4;
+            }
+        }
+#endif
+        pieces_.push_back({frame_hdr(kRecords, len, n, flags), nullptr, p, len});
+        frames_++;
+    }
+
+    /// Where the records of the next kRecords frame go.
+    WireElem* Records() { return wire_ + frames_ * kRelayBatch; }
+
+    bool Flush(int fd) {
+        std::vector<iovec> iov;
+        iov.reserve(pieces_.size() * 3);
+        for (auto& pc : pieces_) {
+            iov.push_back({&pc.hdr, sizeof(pc.hdr)});
+            if (pc.id)
+                iov.push_back({pc.id, sizeof(*pc.id)});
+            iov.push_back({const_cast<char*>(pc.p), pc.len});
+        }
+        pieces_.clear();
+        frames_ = 0;
+        nids_ = 0;
+        return write_all(fd, iov.data(), iov.size());
+    }
+
+private:
+    struct Piece {
+        FrameHdr    hdr;
+        uint32_t*   id;
+        char const* p;
+        std::size_t len;
+    };
+
+    bool lz4_;
+    std::vector<Piece> pieces_;
+    std::size_t frames_ = 0;
+    WireElem wire_[kRelayBatch * kRelayPipeline];
+    uint32_t ids_[kRelayBatch * kRelayPipeline];
+    std::size_t nids_ = 0;
+#ifdef RELAY_WITH_LZ4
+    std::vector<char> lz4buf_[kRelayPipeline];
+#endif
+};
+
+}
+
+RelayServer::RelayServer(std::string addr, in_port_t port)
+    : addr_{addr},
+      port_{port}
+{}
+
+RelayServer::~RelayServer()
+{
+    Stop();
+}
+
+void
+RelayServer::Start()
+{
+    sockaddr_in sin = {};
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port_);
+    if (inet_pton(AF_INET, addr_.c_str(), &sin.sin_addr) != 1)
+        throw RelayError{"invalid relay address " + addr_};
+
+    lfd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd_ < 0)
+        throw RelayError{std::string{"socket: "} + strerror(errno)};
+    int one = 1;
+    setsockopt(lfd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    socklen_t slen = sizeof(sin);
+    if (bind(lfd_, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)) < 0 ||
+        listen(lfd_, SOMAXCONN) < 0 ||
+        getsockname(lfd_, reinterpret_cast<sockaddr*>(&sin), &slen) < 0) {
+        std::string err = strerror(errno);
+        close(lfd_);
+        lfd_ = -1;
+        throw RelayError{"cannot listen on " + addr_ + ": " + err};
+    }
+    port_ = ntohs(sin.sin_port);
+    stop_ = false;
+    acceptor_ = std::thread{&RelayServer::Accept, this};
+}
+
+void
+RelayServer::Stop()
+{
+    if (lfd_ < 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lk{mtx_};
+        stop_ = true;
+        for (int fd : fds_)
+            shutdown(fd, SHUT_RDWR);
+    }
+    cv_.notify_all();
+    shutdown(lfd_, SHUT_RDWR);
+    acceptor_.join();
+    close(lfd_);
+    lfd_ = -1;
+
+    std::vector<std::thread> conns;
+    {
+        std::lock_guard<std::mutex> lk{mtx_};
+        conns.swap(conns_);
+    }
+    for (auto& t : conns)
+        t.join();
+    std::lock_guard<std::mutex> lk{mtx_};
+    done_.clear();
+}
+
+void
+RelayServer::Wait()
+{
+    std::unique_lock<std::mutex> lk{mtx_};
+    cv_.wait(lk, [this]{ return stop_.load(); });
+}
+
+void
+RelayServer::Accept()
+{
+    while (!stop_) {
+        int fd = accept4(lfd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (!stop_)
+                PLOG(ERROR) << "accept";
+            break;
+        }
+        std::lock_guard<std::mutex> lk{mtx_};
+        if (stop_) {
+            close(fd);
+            break;
+        }
+        Reap();
+        fds_.push_back(fd);
+        conns_.emplace_back(&RelayServer::Serve, this, fd);
+    }
+}
+
+/**
+ * Join the connection threads that are done, so that a long-running
+ * relay does not keep one for every connection it ever served. Called
+ * with mtx_ held, which they take for the last time on their way out.
+ */
+void
+RelayServer::Reap()
+{
+    for (auto id : done_) {
+        auto it = std::find_if(begin(conns_), end(conns_),
+                               [id](std::thread const& t) { return t.get_id() == id; });
+        it->join();
+        conns_.erase(it);
+    }
+    done_.clear();
+}
+
+void
+RelayServer::Serve(int fd)
+{
+    FrameType t;
+    std::string req;
+    ring* r = nullptr;
+    AttachReq ar = {};
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &kAttachTimeout, sizeof(kAttachTimeout));
+    if (recv_frame(fd, t, req) && t == kAttach && req.size() > sizeof(ar)) {
+        memcpy(&ar, req.data(), sizeof(ar));
+        auto name = req.substr(sizeof(ar));
+        if (be32toh(ar.version) != kRelayVersion) {
+            std::string msg = "unsupported relay protocol version";
+            send_frame(fd, kError, msg.data(), msg.size());
+        } else if (!(r = ring_lookup(name.c_str()))) {
+            std::string msg = "no such ring: " + name;
+            send_frame(fd, kError, msg.data(), msg.size());
+        } else if (!send_u32_frame(fd, kAttach, be32toh(ar.features) & kLocalFeatures)) {
+            ring_free(r);
+            r = nullptr;
+        }
+    }
+    /* Drain each ring from the NUMA node it lives on, so that the
+     * connections of a node share its CPUs */
+    if (r && ring_node(r) >= 0)
+        ring_run_on_node(ring_node(r));
+
+    /* Formats are sent once per connection, ahead of the first
+     * record that refers to them. */
+    std::unordered_set<uint32_t> sent;
+    uint32_t credit = be32toh(ar.credit);
+    auto pl = std::make_unique<Pipeline>(be32toh(ar.features) & kLocalFeatures & kFeatureLz4);
+    elem batch[kRelayBatch];
+    bool idle = false;
+    while (r && !stop_) {
+        if (!take_credit(fd, credit, (idle || !credit) ? kIdlePollMs : 0))
+            break;
+        while (credit > 0 && !pl->Full()) {
+            auto n = ring_dequeue_bulk(r, batch, std::min<std::size_t>(kRelayBatch, credit));
+            if (n == 0)
+                break;
+            credit -= n;
+            auto w = pl->Records();
+            for (std::size_t i = 0; i < n; i++) {
+                auto id = batch[i].fmt;
+                if (id && sent.insert(id).second)
+                    if (auto fmt = ring_fmt_lookup(r, id))
+                        pl->AddFormat(id, fmt);
+                to_wire(batch[i], w[i]);
+            }
+            pl->AddRecords(n);
+        }
+        idle = pl->Empty();
+        /* Records already dequeued are lost if the peer went away
+         * mid round. */
+        if (!idle && !pl->Flush(fd))
+            break;
+    }
+
+    ring_free(r);
+    std::lock_guard<std::mutex> lk{mtx_};
+    fds_.erase(std::find(begin(fds_), end(fds_), fd));
+    close(fd);
+    done_.push_back(std::this_thread::get_id());
+}
+
+}
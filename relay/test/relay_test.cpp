@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/mman.h>
+
+#include <gtest/gtest.h>
+
+#include <ring.h>
+#include <relay.hpp>
+
+using ::testing::EmptyTestEventListener;
+using ::testing::InitGoogleTest;
+using ::testing::Test;
+using ::testing::TestEventListeners;
+using ::testing::TestInfo;
+using ::testing::TestPartResult;
+using ::testing::UnitTest;
+
+namespace {
+
+using namespace std::literals;
+
+/**
+ * Unlinks the segments of the rings a test makes, named after it as
+ * Relay.<test>, before and after the test, so that a run does not
+ * read what an earlier one left queued.
+ */
+class SegmentJanitor : public EmptyTestEventListener {
+    void OnTestStart(TestInfo const& t) override { Unlink(t); }
+    void OnTestEnd(TestInfo const& t) override { Unlink(t); }
+
+    static void Unlink(TestInfo const& t) {
+        std::string prefix = "SEG4xRING_"s + t.test_suite_name() + "." + t.name();
+        DIR* d = opendir("/dev/shm");
+        if (!d)
+            return;
+        while (dirent* de = readdir(d)) {
+            char next = de->d_name[std::min(prefix.size(), strlen(de->d_name))];
+            if (strncmp(de->d_name, prefix.c_str(), prefix.size()) == 0 &&
+                (next == '\0' || next == '.' || next == '_'))
+                shm_unlink(de->d_name);
+        }
+        closedir(d);
+    }
+};
+
+/* gtest_main runs the tests; the listener goes in before it does */
+bool const kJanitor = (UnitTest::GetInstance()->listeners().Append(new SegmentJanitor), true);
+
+registry::NetAddr
+loopback(in_port_t port)
+{
+    return registry::netaddr_from_string("127.0.0.1:" + std::to_string(port));
+}
+
+/**
+ * Pop from rr, giving the relay up to a second to deliver.
+ */
+elem*
+pop_wait(relay::RemoteRing& rr)
+{
+    for (int i = 0; i < 1000; i++) {
+        if (elem* e = rr.Pop())
+            return e;
+        std::this_thread::sleep_for(1ms);
+    }
+    return nullptr;
+}
+
+TEST(Relay, AttachMissingRing) {
+    relay::RelayServer rs{"127.0.0.1", 0};
+    rs.Start();
+    ASSERT_NE(rs.Port(), 0);
+    EXPECT_THROW((relay::RemoteRing{loopback(rs.Port()), "Relay.NoSuchRing"}),
+                 relay::RelayError);
+}
+
+TEST(Relay, NoRelay) {
+    relay::RelayServer rs{"127.0.0.1", 0};
+    rs.Start();
+    auto port = rs.Port();
+    rs.Stop();
+    EXPECT_THROW((relay::RemoteRing{loopback(port), "Relay.NoRelay"}),
+                 relay::RelayError);
+}
+
+TEST(Relay, StreamRecords) {
+    constexpr std::size_t kCount = 500;
+    auto r = ring_init("Relay.StreamRecords", 1024, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    relay::RelayServer rs{"127.0.0.1", 0};
+    rs.Start();
+    relay::RemoteRing rr{loopback(rs.Port()), "Relay.StreamRecords"};
+
+    for (std::size_t i = 0; i < kCount; i++) {
+        elem e = {};
+        e.id = i;
+        snprintf(e.data, sizeof(e.data), "record %zu", i);
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    }
+    for (std::size_t i = 0; i < kCount; i++) {
+        elem* e = pop_wait(rr);
+        ASSERT_NE(e, nullptr);
+        ASSERT_EQ(e->id, i);
+        ASSERT_EQ(e->seq, i);
+        ASSERT_STREQ(e->data, ("record " + std::to_string(i)).c_str());
+        free(e);
+    }
+    ASSERT_EQ(rr.Pop(), nullptr);
+    rs.Stop();
+    ring_free(r);
+}
+
+TEST(Relay, CreditWindow) {
+    constexpr std::size_t kCount = 500;
+    auto r = ring_init("Relay.CreditWindow", 1024, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    relay::RelayServer rs{"127.0.0.1", 0};
+    rs.Start();
+    relay::RemoteRing rr{loopback(rs.Port()), "Relay.CreditWindow", 16};
+
+    for (std::size_t i = 0; i < kCount; i++) {
+        elem e = {};
+        e.id = i;
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    }
+    for (std::size_t i = 0; i < kCount; i++) {
+        elem* e = pop_wait(rr);
+        ASSERT_NE(e, nullptr);
+        ASSERT_EQ(e->id, i);
+        free(e);
+    }
+    rs.Stop();
+    ring_free(r);
+}
+
+TEST(Relay, ServerStopsMidStream) {
+    constexpr std::size_t kCount = 500;
+    auto r = ring_init("Relay.ServerStopsMidStream", 1024, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    relay::RelayServer rs{"127.0.0.1", 0};
+    rs.Start();
+    relay::RemoteRing rr{loopback(rs.Port()), "Relay.ServerStopsMidStream", 16};
+
+    for (std::size_t i = 0; i < kCount; i++) {
+        elem e = {};
+        e.id = i;
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    }
+    std::size_t next = 0;
+    for (; next < 5; next++) {
+        elem* e = pop_wait(rr);
+        ASSERT_NE(e, nullptr);
+        ASSERT_EQ(e->id, next);
+        free(e);
+    }
+    rs.Stop();
+
+    /* What was sent before it stopped still comes out, in order */
+    for (int i = 0; i < 1000 && !rr.Closed(); i++) {
+        elem* e = rr.Pop();
+        if (!e) {
+            std::this_thread::sleep_for(1ms);
+            continue;
+        }
+        ASSERT_EQ(e->id, next++);
+        free(e);
+    }
+    ASSERT_TRUE(rr.Closed());
+    while (elem* e = rr.Pop()) {
+        ASSERT_EQ(e->id, next++);
+        free(e);
+    }
+    ASSERT_LT(next, kCount);
+    ASSERT_EQ(rr.Pop(), nullptr);
+    ring_free(r);
+}
+
+TEST(Relay, UncreditedRecordsStayInRing) {
+    auto r = ring_init("Relay.UncreditedRecordsStayInRing", 128, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    relay::RelayServer rs{"127.0.0.1", 0};
+    rs.Start();
+    relay::RemoteRing rr{loopback(rs.Port()), "Relay.UncreditedRecordsStayInRing", 10};
+
+    elem e = {};
+    for (std::size_t i = 0; i < 100; i++)
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    std::this_thread::sleep_for(50ms);
+    rs.Stop();
+
+    elem out[100];
+    ASSERT_EQ(ring_dequeue_bulk(r, out, 100), 90u);
+    ring_free(r);
+}
+
+TEST(Relay, Formats) {
+    auto r = ring_init("Relay.Formats", 64, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    auto id = ring_fmt_register(r, "value %d");
+    ASSERT_NE(id, 0u);
+    relay::RelayServer rs{"127.0.0.1", 0};
+    rs.Start();
+    relay::RemoteRing rr{loopback(rs.Port()), "Relay.Formats"};
+    ASSERT_EQ(rr.Format(id), nullptr);
+
+    elem e = {};
+    e.fmt = id;
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    elem* got = pop_wait(rr);
+    ASSERT_NE(got, nullptr);
+    ASSERT_EQ(got->fmt, id);
+    ASSERT_STREQ(rr.Format(id), "value %d");
+    free(got);
+    ring_free(r);
+}
+
+TEST(Relay, ClientHangsUp) {
+    auto r = ring_init("Relay.ClientHangsUp", 64, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    relay::RelayServer rs{"127.0.0.1", 0};
+    rs.Start();
+    {
+        relay::RemoteRing rr{loopback(rs.Port()), "Relay.ClientHangsUp"};
+    }
+    relay::RemoteRing rr{loopback(rs.Port()), "Relay.ClientHangsUp"};
+    elem e = {};
+    e.id = 7;
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    elem* got = pop_wait(rr);
+    ASSERT_NE(got, nullptr);
+    ASSERT_EQ(got->id, 7u);
+    free(got);
+    ring_free(r);
+}
+
+}
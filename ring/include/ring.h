@@ -9,7 +9,8 @@ extern "C" {
 #endif
 
 /**
- * @brief Initialize a Boost MPMC queue in shared memory segment
+ * @brief Create a ring, a bounded MPMC queue in a shared memory
+ * segment, or attach to the existing one of that name.
  * 
  * @param name The name of the queue.
  * @param n The capacity of the queue.
@@ -19,17 +20,100 @@ extern "C" {
 struct ring* ring_init(char const* name, size_t n, size_t elemsz);
 
 /**
- * @brief Attach a ring to a predefined Boost MPMC queue in
- * a shared memory segment.
+ * @brief Create a ring in a shared memory segment, or attach to
+ * the existing one, with optional creation parameters.
+ *
+ * The shared queue is the node based Boost lock-free queue. With
+ * RING_F_TICKET it is a ring_ticket_queue instead, which is faster
+ * but stalls if a process dies in the middle of an operation; see
+ * RING_F_TICKET. A ring that exists already is attached to with
+ * whichever of the two it holds.
+ *
+ * With RING_F_HUGEPAGES the segment is created on a hugetlbfs
+ * mount (MPL_HUGETLBFS, or the first 2MB hugetlbfs in /proc/mounts)
+ * and falls back to a normal /dev/shm segment advised for
+ * transparent huge pages. The flags that took effect are reported
+ * in ring::flags.
+ *
+ * With RING_F_MLOCK the pages of the segment are faulted in and
+ * locked by the creating handle, and those of a segment it attaches
+ * to as well. Failing that, no ring is created and errno tells why
+ * (ENOMEM past RLIMIT_MEMLOCK, for one).
+ *
+ * With RING_F_BROADCAST the ring holds n records rounded up to a
+ * power of two and every consumer reads all of them (see
+ * ring_lookup()). The creating handle takes a cursor of its own the
+ * first time it dequeues. Broadcast rings have no lanes.
+ *
+ * If the host has a shared memory budget (the file named by
+ * MPL_SHM_BUDGET, or /etc/mpl/shm_budget), a new segment must fit in
+ * its limit and in the quota of the ring's owner, ring_attr::owner
+ * or else name. Past its shrink mark, rings are created
+ * with fewer lanes, broadcast slots and RING_F_VARLEN bytes than
+ * they ask for.
+ *
+ * @param name The name of the queue.
+ * @param n The capacity of the queue.
+ * @param elemsz The size of individual items written to the queue.
+ * @param attr Creation parameters, or NULL for the defaults.
+ * A ring of that name that exists already is attached to if it was
+ * created with the same lanes, broadcast slots and RING_F_VARLEN
+ * size.
+ *
+ * @return struct ring*, or NULL with errno set: EINVAL if attr
+ * asks for something the ring cannot be, EEXIST if a ring of that
+ * name has another geometry, ENOSPC if the segment does not fit in
+ * the budget of the host, or why it cannot be created, mapped or
+ * locked.
+ */
+struct ring* ring_init_attr(char const* name, size_t n, size_t elemsz,
+                            struct ring_attr const* attr);
+
+/**
+ * @brief Attach to an existing ring in a shared memory segment,
+ * whichever shared queue it holds.
+ *
+ * Attaching maps the segment and validates its header (magic,
+ * layout version and geometry).
+ *
+ * On a RING_F_BROADCAST ring the handle also takes a cursor of its
+ * own, positioned at the oldest record still in the ring, and
+ * every dequeue through the handle reads from that cursor on. The
+ * producers cannot overwrite a record that a live cursor has yet to
+ * read, so the slowest consumer holds them back; ring_free() gives
+ * the cursor up.
  * 
  * @param name The name of the queue.
- * @return struct ring* 
+ * @return struct ring* or NULL if there is no valid ring
+ * with this name, or a broadcast ring has no cursor or consumer
+ * entry left (see RING_MAX_CURSORS and RING_MAX_CONSUMERS).
  */
 struct ring* ring_lookup(char const* name);
 
 /**
- * @brief Destroy a predefined Boost MPMC queue in a shared memory
- * segment.
+ * @brief Attach to a ring as a member of a consumer group.
+ *
+ * On a RING_F_BROADCAST ring all handles of the same group share
+ * one cursor and split the records between them: each dequeue
+ * claims a range of up to 64 records at a time and hands them out
+ * from there. Claimed ranges are recorded in the segment; a range
+ * left unread by a member that exited goes to the next member of
+ * its group that runs out of records. A member that calls
+ * ring_free() drops the rest of its range.
+ *
+ * Other rings are always shared by all their consumers, and group
+ * makes no difference.
+ *
+ * @param name The name of the queue.
+ * @param group The name of the group (at most RING_GROUPNAMESIZE - 1
+ * characters), or NULL for a cursor of its own like ring_lookup().
+ * @return struct ring* or NULL like ring_lookup().
+ */
+struct ring* ring_lookup_group(char const* name, char const* group);
+
+/**
+ * @brief Unmap the ring of handle r and free the handle. The
+ * segment stays for the other handles of the ring.
  * 
  * @param name The name of the queue.
  * @return struct ring* 
@@ -37,12 +121,295 @@ struct ring* ring_lookup(char const* name);
 int
 ring_free(struct ring* r);
 
+/**
+ * @brief Check whether the producer that owns the ring is still
+ * running.
+ *
+ * @return 1 if the owner is alive, 0 if it has exited.
+ */
+int
+ring_owner_alive(struct ring* r);
+
+/**
+ * @brief Remove the segment of a ring whose producers have all
+ * exited, once it has been drained. The segments of later
+ * RING_F_VARLEN generations go with it. The mapping stays usable
+ * until ring_free().
+ *
+ * @return 0 if the segment was removed, -1 if a producer (the
+ * owner, another handle of ring_init() or the holder of a lane) is
+ * alive or records are still queued.
+ */
+int
+ring_reclaim(struct ring* r);
+
+/**
+ * @brief Remove orphaned ring segments on this host.
+ *
+ * A segment is orphaned when its producers have all exited, as for
+ * ring_reclaim(), and it is either empty or was first found
+ * orphaned at least grace seconds ago by an earlier sweep.
+ *
+ * @param grace Seconds to leave an undrained orphan to consumers.
+ * @return The number of rings removed.
+ */
+int
+ring_sweep(unsigned grace);
+
+/**
+ * @brief Keep n spare segments in the pool of this host, creating
+ * the missing ones and removing the rest.
+ *
+ * A spare is a pre-faulted, empty ring as ring_init() creates it.
+ * ring_init(), and ring_init_attr() without lanes, broadcast slots,
+ * huge pages or RING_F_VARLEN, claim one if the ring does not exist
+ * yet and rename it to the name of the ring instead of setting up a
+ * segment. Spares count against the budget of the host.
+ *
+ * @return The number of spares left in the pool, less than n if
+ * segments cannot be created or do not fit in the budget.
+ */
+int
+ring_pool_keep(unsigned n);
+
+/**
+ * @brief Enqueue a copy of e, stamping e->seq first. A
+ * RING_F_VARLEN ring carries it as a record of sizeof(*e) bytes.
+ *
+ * @return 0, or -1 if the ring is full, or for a broadcast ring
+ * if the slowest consumer has not read the record that would be
+ * overwritten. The sequence number of a
+ * record that was not enqueued is skipped, so consumers see the
+ * loss as a gap.
+ */
 int
 ring_enqueue(struct ring* r, struct elem* e);
 
+/**
+ * @brief Like ring_enqueue(), but wait for room as w says when the
+ * ring is full. e->seq is stamped once; it is skipped only if w
+ * gives up.
+ */
+int
+ring_enqueue_wait(struct ring* r, struct elem* e, struct ring_wait* w);
+
+/**
+ * @brief Dequeue an element from the shared queue or else a lane.
+ *
+ * Lanes have room for one consumer at a time. Consumers of the same
+ * ring take turns at them, and one that finds another consumer at
+ * them looks at the shared queue only.
+ */
 int
 ring_dequeue(struct ring* r, struct elem** e);
 
+/**
+ * @brief Dequeue up to n elements into a caller supplied array,
+ * visiting the shared queue and the lanes like ring_dequeue().
+ *
+ * @return The number of elements copied into out.
+ */
+size_t
+ring_dequeue_bulk(struct ring* r, struct elem* out, size_t n);
+
+/**
+ * @brief Publish a format string in the ring's format table so
+ * that consumers can render structured records that refer to it.
+ * Registering a string that is already published returns its
+ * existing id.
+ *
+ * @return The id of the format string, or 0 if the table is full.
+ */
+uint32_t
+ring_fmt_register(struct ring* r, char const* fmt);
+
+/**
+ * @brief The format string published under id, or NULL if there
+ * is none.
+ */
+char const*
+ring_fmt_lookup(struct ring* r, uint32_t id);
+
+/**
+ * @brief Dequeue the element with the smallest timestamp among
+ * the heads of the shared queue and all lanes.
+ *
+ * Ordering is best effort: an element stamped earlier but
+ * enqueued after a later one was dequeued comes out late. Returns
+ * -1 while another consumer is at the lanes.
+ */
+int
+ring_dequeue_ordered(struct ring* r, struct elem** e);
+
+/**
+ * @brief Claim a free single-producer lane for the calling
+ * thread. Lanes held by processes that have exited, by pid and
+ * start time, are taken over.
+ *
+ * @return The lane index, or -1 if all lanes are taken.
+ */
+int
+ring_lane_claim(struct ring* r);
+
+/**
+ * @brief Hand back a lane claimed with ring_lane_claim(). Records
+ * still queued in it remain visible to consumers.
+ */
+void
+ring_lane_release(struct ring* r, int lane);
+
+/**
+ * @brief Hand back every lane held by threads of this process.
+ */
+void
+ring_lane_release_all(struct ring* r);
+
+/**
+ * @brief Enqueue onto a lane claimed by the calling thread. Only
+ * the thread that holds the lane may call this. Stamps e->seq
+ * like ring_enqueue().
+ */
+int
+ring_lane_enqueue(struct ring* r, int lane, struct elem* e);
+
+/**
+ * @brief Like ring_lane_enqueue(), but wait for room as w says
+ * when the lane is full.
+ */
+int
+ring_lane_enqueue_wait(struct ring* r, int lane, struct elem* e,
+                       struct ring_wait* w);
+
+/**
+ * @brief Reserve room for a record of len bytes in a RING_F_VARLEN
+ * ring, to be written in place and published with ring_commit().
+ * Any number of producers may reserve at the same time.
+ *
+ * @return Where to write the record, contiguous even where the ring
+ * wraps, or NULL if there is not enough room or r is not a
+ * RING_F_VARLEN ring.
+ */
+void*
+ring_reserve(struct ring* r, size_t len);
+
+/**
+ * @brief Publish the record reserved at p. Records are read in the
+ * order they were reserved, so one that is reserved but never
+ * committed holds back the ones after it.
+ */
+void
+ring_commit(struct ring* r, void* p);
+
+/**
+ * @brief The oldest record of a RING_F_VARLEN ring, read in place.
+ * It stays valid until ring_release(). One consumer at a time.
+ *
+ * @param len Set to the length of the record.
+ * @return The record, or NULL if there is none.
+ */
+void const*
+ring_peek(struct ring* r, size_t* len);
+
+/**
+ * @brief Drop the record returned by the last ring_peek().
+ */
+void
+ring_release(struct ring* r);
+
+/**
+ * @brief Move a RING_F_VARLEN ring to a new segment of n bytes,
+ * larger or smaller, while producers and consumers keep running.
+ *
+ * The new segment is linked from the current one. Every producer
+ * handle moves on to it at its next enqueue. Consumers first read
+ * what is left in the current segment and switch once it is empty
+ * and no producer is still writing to it, so no record is lost or
+ * read out of order. Producers that are idle do not hold them back.
+ * A ring holds at most RING_MAX_WRITERS producer handles.
+ *
+ * @return 0, or -1 if r is not a RING_F_VARLEN ring, another resize
+ * of it is under way, or the segment cannot be created.
+ */
+int
+ring_resize(struct ring* r, size_t n);
+
+/**
+ * @brief Place the segment of r on NUMA node node, moving the pages
+ * it already has there, and record node in the segment for
+ * ring_node() to report. Generations a RING_F_VARLEN ring is
+ * resized to later start out on node as well.
+ *
+ * Pages are preferred, not restricted, to node: they go elsewhere
+ * once it is out of memory. Pages that another process has mapped
+ * too are only moved with CAP_SYS_NICE.
+ *
+ * @return 0, or -1 if node is not a node of this host or the kernel
+ * has no NUMA support.
+ */
+int
+ring_bind(struct ring* r, int node);
+
+/**
+ * @brief Like ring_bind(), but leave the pages r has already where
+ * they are: only pages faulted in from now on go to node. Needs no
+ * privileges, and costs no more than a system call.
+ */
+int
+ring_prefer(struct ring* r, int node);
+
+/**
+ * @brief The NUMA node the segment of r was last placed on with
+ * RING_F_NUMA or ring_bind(), by any process, or -1.
+ */
+int
+ring_node(struct ring* r);
+
+/**
+ * @brief The NUMA node of the CPU the calling thread runs on, or -1
+ * if it cannot be told.
+ */
+int
+ring_cpu_node(void);
+
+/**
+ * @brief Let the calling thread run only on the CPUs of NUMA node
+ * node.
+ *
+ * @return 0, or -1 if node has no CPUs this thread may run on.
+ */
+int
+ring_run_on_node(int node);
+
+/**
+ * @brief Copy n bytes from src to dst with non-temporal stores,
+ * picked for the CPU at run time (AVX2 or SSE2), so that dst is not
+ * pulled into the caller's caches. Where the CPU has none it is a
+ * plain copy. All stores are complete on return, so a record
+ * written into ring_reserve() room this way can be committed right
+ * after.
+ */
+void
+ring_copy_stream(void* dst, void const* src, size_t n);
+
+/**
+ * @brief Call op(arg) until it returns non-zero, waiting between
+ * failed attempts as w says.
+ *
+ * ring_enqueue(), ring_lane_enqueue() and the dequeue functions
+ * wake callers parked on RING_EV_DATA or RING_EV_SPACE of the same
+ * ring, in any process. op is called once more after the caller
+ * announced itself as parked, so a wakeup is never missed.
+ * Producers should use ring_enqueue_wait() instead, since every
+ * ring_enqueue() call stamps a new sequence number.
+ *
+ * @param ev RING_EV_DATA if op dequeues, RING_EV_SPACE if it
+ * enqueues.
+ * @return 1 if op succeeded, 0 if w gave up first.
+ */
+int
+ring_wait_for(struct ring* r, struct ring_wait* w, unsigned ev,
+              int (*op)(void* arg), void* arg);
+
 #ifdef __cplusplus
 }
 #endif
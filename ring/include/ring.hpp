@@ -0,0 +1,373 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <boost/lockfree/queue.hpp>
+#include <boost/lockfree/policies.hpp>
+
+#include "ring.h"
+#include "ring_queue.hpp"
+
+/**
+ * A futex word that consumers (RING_EV_DATA) or producers
+ * (RING_EV_SPACE) park on, and how many of them do.
+ */
+struct alignas(128) ring_event {
+    std::atomic<uint32_t>   epoch;
+    std::atomic<uint32_t>   waiters;
+};
+
+/**
+ * @brief Wake everyone parked on e.
+ */
+void
+ring_wake(ring_event& e);
+
+/**
+ * @brief Wake the callers of ring_wait_for() parked on e, if there
+ * are any. Call it after the enqueue or dequeue that they wait for.
+ */
+inline void
+ring_notify(ring_event& e)
+{
+    /* Orders the operation before the load of waiters, like a
+     * parking caller orders its increment before its last attempt */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (e.waiters.load(std::memory_order_relaxed) != 0)
+        ring_wake(e);
+}
+
+/**
+ * The shape of the shared queue of a ring, which a segment records
+ * so that only handles of the same queue type attach to it.
+ */
+struct ring_queue_desc {
+    /// The queue policy, see mpl::ticket_policy.
+    uint16_t    kind;
+    size_t      elemsz;
+    /// sizeof the queue object.
+    size_t      qsz;
+};
+
+/**
+ * @brief Create a ring whose shared queue is described by d, or
+ * attach to an existing one of the same shape. construct builds an
+ * empty queue at the given address of a new segment. Only the
+ * RING_F_HUGEPAGES, RING_F_PREFAULT, RING_F_MLOCK, RING_F_NUMA and
+ * RING_F_STREAM flags of attr apply.
+ *
+ * @return The ring, or NULL.
+ */
+struct ring*
+ring_init_queue(char const* name, struct ring_attr const* attr,
+                ring_queue_desc const& d, void (*construct)(void* at));
+
+/**
+ * @brief Attach to an existing ring whose shared queue has shape d.
+ *
+ * @return The ring, or NULL if there is none or it has another
+ * shape.
+ */
+struct ring*
+ring_lookup_queue(char const* name, ring_queue_desc const& d);
+
+/**
+ * @brief The shared queue of r if it has shape d and r has neither
+ * lanes nor RING_F_BROADCAST, so that every record goes through it.
+ *
+ * @return The queue, or NULL.
+ */
+void*
+ring_queue_of(struct ring const* r, ring_queue_desc const& d);
+
+/**
+ * @brief The smallest record that producers of r copy into it with
+ * ring_copy_stream(), or 0 if they do not; see RING_F_STREAM.
+ */
+size_t
+ring_stream_of(struct ring const* r);
+
+/**
+ * @brief The events of r, indexed by RING_EV_*.
+ */
+ring_event*
+ring_events_of(struct ring const* r);
+
+/**
+ * @brief The counter that elem::seq is stamped from.
+ */
+std::atomic<uint32_t>*
+ring_seq_of(struct ring const* r);
+
+namespace mpl
+{
+
+/// Shared queue with a sequence number per slot (ring_ticket_queue).
+struct ticket_policy {
+    static constexpr uint16_t kind = 2;
+    template <typename T, std::size_t Capacity>
+    using queue = ring_ticket_queue<T, Capacity, 64>;
+};
+
+/// Node based Boost lock-free queue.
+struct boost_policy {
+    static constexpr uint16_t kind = 1;
+    template <typename T, std::size_t Capacity>
+    using queue = boost::lockfree::queue<T,
+                                         boost::lockfree::capacity<Capacity>,
+                                         boost::lockfree::fixed_sized<true>>;
+};
+
+/// The policy of the C API, unless a ring is created with
+/// RING_F_TICKET.
+using default_policy = boost_policy;
+
+/**
+ * @brief A ring of records of type T in a shared memory segment.
+ *
+ * Creating and attaching go through the library; push and pop work
+ * on the queue in the segment directly and inline into the caller.
+ * T is copied between processes as bytes, so it must be trivially
+ * copyable and must not hold pointers. The C API is ring<elem> with
+ * the default arguments.
+ */
+template <typename T,
+          std::size_t Capacity = RING_CAPACITY,
+          typename Policy = default_policy>
+class ring {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "records are copied between processes as bytes");
+
+public:
+    using queue_type = typename Policy::template queue<T, Capacity>;
+
+    /**
+     * Create the segment named name, or attach to an existing one
+     * that holds the same queue type. Check the result with
+     * operator bool.
+     */
+    static ring
+    create(char const* name, ring_attr const* attr = nullptr)
+    {
+        return ring{ring_init_queue(name, attr, desc(), construct), true};
+    }
+
+    /// Attach to the segment named name; see create().
+    static ring
+    lookup(char const* name)
+    {
+        return ring{ring_lookup_queue(name, desc()), true};
+    }
+
+    ring() = default;
+
+    /**
+     * A typed view of a C handle, which stays the caller's to free.
+     * It is invalid unless every record of r goes through a shared
+     * queue of queue_type; see ring_queue_of().
+     */
+    explicit ring(::ring* r)
+        : ring{r, false}
+    {}
+
+    ring(ring&& o) noexcept
+    {
+        *this = std::move(o);
+    }
+
+    ring&
+    operator=(ring&& o) noexcept
+    {
+        std::swap(r_, o.r_);
+        std::swap(q_, o.q_);
+        std::swap(ev_, o.ev_);
+        std::swap(seq_, o.seq_);
+        std::swap(stream_, o.stream_);
+        std::swap(owned_, o.owned_);
+        return *this;
+    }
+
+    ~ring()
+    {
+        if (owned_)
+            ring_free(r_);
+    }
+
+    explicit operator bool() const { return q_ != nullptr; }
+    ::ring* handle() const { return r_; }
+
+    /// Copy v into the ring, or return false if it is full.
+    bool
+    push(T const& v)
+    {
+        bool pushed;
+        if constexpr (Policy::kind == ticket_policy::kind)
+            pushed = stream_ ? q_->push(v, stream_copy) : q_->push(v);
+        else
+            pushed = q_->push(v);
+        if (!pushed)
+            return false;
+        ring_notify(ev_[RING_EV_DATA]);
+        return true;
+    }
+
+    /// Copy the oldest record into v, or return false if there is none.
+    bool
+    pop(T& v)
+    {
+        if (!q_->pop(v))
+            return false;
+        ring_notify(ev_[RING_EV_SPACE]);
+        return true;
+    }
+
+    /// Like push(v), but wait for room as w says.
+    bool
+    push(T const& v, ring_wait& w)
+    {
+        /* The adaptive policy times every success itself */
+        if (w.policy != RING_WAIT_ADAPTIVE && push(v))
+            return true;
+        if (w.policy == RING_WAIT_NONE)
+            return false;
+        op o{this, const_cast<T*>(&v)};
+        return ring_wait_for(r_, &w, RING_EV_SPACE, push_op, &o) != 0;
+    }
+
+    /// Like pop(v), but wait for a record as w says.
+    bool
+    pop(T& v, ring_wait& w)
+    {
+        if (w.policy != RING_WAIT_ADAPTIVE && pop(v))
+            return true;
+        if (w.policy == RING_WAIT_NONE)
+            return false;
+        op o{this, &v};
+        return ring_wait_for(r_, &w, RING_EV_DATA, pop_op, &o) != 0;
+    }
+
+    /**
+     * Pop records until match(record) holds for one, and copy that
+     * one into v. Records that do not match are dropped; the ticket
+     * queue looks at them where they are, without copying them.
+     *
+     * @return false once the ring is empty.
+     */
+    template <typename Match>
+    bool
+    pop_if(T& v, Match&& match)
+    {
+        for (;;) {
+            int got;
+            if constexpr (Policy::kind == ticket_policy::kind)
+                got = q_->pop_if(v, match);
+            else
+                got = q_->pop(v) ? match(std::as_const(v)) : -1;
+            if (got < 0)
+                return false;
+            ring_notify(ev_[RING_EV_SPACE]);
+            if (got)
+                return true;
+        }
+    }
+
+    /// Like pop_if(v, match), but wait for a match as w says.
+    template <typename Match>
+    bool
+    pop_if(T& v, Match&& match, ring_wait& w)
+    {
+        if (w.policy != RING_WAIT_ADAPTIVE && pop_if(v, match))
+            return true;
+        if (w.policy == RING_WAIT_NONE)
+            return false;
+        match_op<Match> o{this, &v, &match};
+        return ring_wait_for(r_, &w, RING_EV_DATA, pop_if_op<Match>, &o) != 0;
+    }
+
+    /// The next elem::seq of this ring, for records that carry one.
+    uint32_t
+    next_seq()
+    {
+        return seq_->fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    struct op {
+        ring*   self;
+        T*      v;
+    };
+
+    template <typename Match>
+    struct match_op {
+        ring*   self;
+        T*      v;
+        std::remove_reference_t<Match>* match;
+    };
+
+    ring(::ring* r, bool owned)
+        : r_{r},
+          owned_{owned}
+    {
+        if (!r)
+            return;
+        q_ = static_cast<queue_type*>(ring_queue_of(r, desc()));
+        ev_ = ring_events_of(r);
+        seq_ = ring_seq_of(r);
+        size_t min = ring_stream_of(r);
+        stream_ = min && sizeof(T) >= min;
+    }
+
+    static ring_queue_desc
+    desc()
+    {
+        return {Policy::kind, sizeof(T), sizeof(queue_type)};
+    }
+
+    static void
+    construct(void* at)
+    {
+        new (at) queue_type;
+    }
+
+    static void
+    stream_copy(void* dst, void const* src)
+    {
+        ring_copy_stream(dst, src, sizeof(T));
+    }
+
+    static int
+    push_op(void* arg)
+    {
+        auto o = static_cast<op*>(arg);
+        return o->self->push(*o->v);
+    }
+
+    static int
+    pop_op(void* arg)
+    {
+        auto o = static_cast<op*>(arg);
+        return o->self->pop(*o->v);
+    }
+
+    template <typename Match>
+    static int
+    pop_if_op(void* arg)
+    {
+        auto o = static_cast<match_op<Match>*>(arg);
+        return o->self->pop_if(*o->v, *o->match);
+    }
+
+    ::ring*                 r_ = nullptr;
+    queue_type*             q_ = nullptr;
+    ring_event*             ev_ = nullptr;
+    std::atomic<uint32_t>*  seq_ = nullptr;
+    /// Whether pushes copy with ring_copy_stream().
+    bool                    stream_ = false;
+    bool                    owned_ = false;
+};
+
+}
@@ -6,11 +6,130 @@
 #define SEGM_NAMESIZE       64
 #define RING_NAMESIZE       64
 #define RING_CAPACITY       (8 * 1024)
+#define RING_LANE_CAPACITY  (1024)
+#define RING_MAX_LANES      64
+#define RING_FMT_TABLESZ    (64 * 1024)
+#define RING_MAX_CURSORS    16
+#define RING_MAX_CONSUMERS  64
+#define RING_GROUPNAMESIZE  32
+#define RING_MAX_WRITERS    64
+/// The directory that spare segments wait in; see ring_pool_keep().
+#define RING_POOL_DIR       "/dev/shm/.mpl_pool"
+
+/// Back the ring segment with 2MB huge pages when the host has
+/// a hugetlbfs mount, or advise transparent huge pages otherwise.
+#define RING_F_HUGEPAGES    0x1u
+/// Fault in every page of the segment when it is mapped so that
+/// the first enqueues do not page-fault.
+#define RING_F_PREFAULT     0x2u
+/// Deliver every record to every consumer. Each ring_lookup()
+/// handle reads the ring through a cursor of its own instead of
+/// taking records away from the other consumers; see
+/// ring_lookup(). Cannot be combined with lanes.
+#define RING_F_BROADCAST    0x4u
+/// Carry records of any length instead of elems; see
+/// ring_reserve(). The ring holds n bytes, rounded up to a power of
+/// two pages, mapped twice back to back so that records are
+/// contiguous where the ring wraps. Such a ring can be resized
+/// with ring_resize(). Cannot be combined with lanes,
+/// RING_F_BROADCAST or RING_F_HUGEPAGES.
+#define RING_F_VARLEN       0x8u
+/// Place the pages of a new segment on NUMA node ring_attr::node
+/// rather than wherever they are first touched; see ring_bind().
+#define RING_F_NUMA         0x10u
+/// Fault in every page of the segment like RING_F_PREFAULT and lock
+/// them in memory (mlock), so that they are never reclaimed and no
+/// enqueue page-faults. Creating the ring fails if they cannot be
+/// locked, e.g. past RLIMIT_MEMLOCK.
+#define RING_F_MLOCK        0x20u
+/// Producers of the handle copy records of ring_attr::stream_min
+/// bytes or more into the ring with non-temporal stores, which leave
+/// their own caches alone; see ring_copy_stream(). Lanes, broadcast
+/// rings and the Boost queue (without RING_F_TICKET) keep regular
+/// stores. Reported in ring::flags only where the CPU has such stores
+/// and the ring can use them.
+#define RING_F_STREAM       0x40u
+/// Make the shared queue a ring_ticket_queue, which copies records
+/// straight into their slots after one CAS, instead of the node based
+/// Boost queue. It is not lock-free: a process that dies between
+/// taking a ticket and finishing its copy stalls every consumer at
+/// that slot, and the ring never drains; ring_sweep() removes it
+/// only once its grace period is over. The segment records which
+/// queue it holds, so the flag only matters to the creator. Ignored
+/// with RING_F_BROADCAST or RING_F_VARLEN.
+#define RING_F_TICKET       0x80u
+
+/// What ring_wait_for() does when its operation fails: give up
+/// at once,
+#define RING_WAIT_NONE      0u
+/// busy poll with a pause between attempts,
+#define RING_WAIT_SPIN      1u
+/// busy poll ring_wait::spins times, then yield the CPU between
+/// attempts,
+#define RING_WAIT_YIELD     2u
+/// busy poll ring_wait::spins times, then sleep on a futex in the
+/// segment until the other side makes progress,
+#define RING_WAIT_PARK      3u
+/// or like RING_WAIT_PARK, with the number of polls tuned to the
+/// observed time between successful attempts.
+#define RING_WAIT_ADAPTIVE  4u
+
+/// ring_wait_for() waits for a record to dequeue,
+#define RING_EV_DATA        0u
+/// or for room to enqueue.
+#define RING_EV_SPACE       1u
+
+/**
+ * A wait strategy for ring_wait_for(). Zero-initialized it gives
+ * up at once. One ring_wait may be shared between threads; the
+ * adaptive statistics are updated with relaxed atomics.
+ */
+struct ring_wait {
+    /// One of RING_WAIT_*.
+    unsigned    policy;
+    /// Attempts to busy poll before yielding or parking. The
+    /// adaptive policy starts from this until it has measured.
+    unsigned    spins;
+    /// Give up after this many microseconds; 0 waits until the
+    /// operation succeeds.
+    unsigned    timeout_us;
+    /// Adaptive policy: moving average of the nanoseconds between
+    /// successful operations, and when the last one happened.
+    uint64_t    gap_ns;
+    uint64_t    last_ns;
+};
+
+/**
+ * Optional creation parameters for ring_init_attr().
+ */
+struct ring_attr {
+    /// A combination of RING_F_* flags.
+    unsigned    flags;
+    /// Number of single-producer lanes to create next to the
+    /// shared queue (at most RING_MAX_LANES). Producer threads
+    /// claim a lane each with ring_lane_claim().
+    unsigned    nlanes;
+    /// Broadcast rings: bytes per slot, a multiple of 64 that holds
+    /// a record. 0 picks the smallest; 256 keeps the adjacent-line
+    /// prefetcher of one slot off the next.
+    unsigned    slotsz;
+    /// RING_F_NUMA: the node to place the segment on.
+    int         node;
+    /// RING_F_STREAM: the smallest record to stream, 0 for two cache
+    /// lines.
+    unsigned    stream_min;
+    /// The owner whose quota in the shared memory budget of the host
+    /// the ring's segments are charged to, or NULL for the ring's own
+    /// name. A Spring passes its owner name.
+    char const* owner;
+};
 
 struct ring {
-    char    name[RING_NAMESIZE];
-    void*   seg;
-    void*   queue;
+    char        name[RING_NAMESIZE];
+    void*       seg;
+    void*       queue;
+    /// RING_F_* flags that actually took effect for this mapping.
+    unsigned    flags;
 };
 
 size_t const kElemDataSz = 128;
@@ -18,5 +137,28 @@ size_t const kElemDataSz = 128;
 struct elem {
     size_t      id;
     char      data[kElemDataSz];
+    /// Producer timestamp (CLOCK_MONOTONIC, ns) used to merge
+    /// lanes in order, or 0 if the producer does not stamp.
+    uint64_t    ts;
+    /// 0 if data holds text. Otherwise the id of a format string
+    /// (see ring_fmt_register()) and data holds its arguments,
+    /// each encoded as a ring_arg_type tag followed by its value.
+    uint32_t    fmt;
+    /// Per ring sequence number, stamped on enqueue. Records that
+    /// could not be enqueued leave a gap. Wraps around.
+    uint32_t    seq;
 };
 
+/**
+ * Tags of the binary arguments of a structured record. Numbers
+ * are stored in host byte order as 8 bytes; strings as a 16 bit
+ * length followed by the characters.
+ */
+enum ring_arg_type {
+    RING_ARG_END    = 0,
+    RING_ARG_I64    = 1,
+    RING_ARG_U64    = 2,
+    RING_ARG_F64    = 3,
+    RING_ARG_STR    = 4,
+    RING_ARG_PTR    = 5,
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A bounded multi-producer multi-consumer queue that lives in shared
+ * memory. Every cell carries a sequence number that says whose turn
+ * it is: pos when the producer holding ticket pos may fill it, pos + 1
+ * once it holds the record for the consumer holding ticket pos, and
+ * pos + Capacity once that consumer is done with it. Taking a ticket
+ * is the only CAS; the record is then copied in or out in place.
+ *
+ * Unlike a node based queue it is not lock-free: a process that dies
+ * between taking a ticket and finishing its copy stalls the other
+ * side once it reaches that cell.
+ */
+template <typename T, std::size_t Capacity, std::size_t Align>
+class ring_ticket_queue {
+    static_assert(Capacity && (Capacity & (Capacity - 1)) == 0,
+                  "capacity must be a power of two");
+
+public:
+    ring_ticket_queue()
+    {
+        for (std::size_t i = 0; i < Capacity; i++)
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+    }
+
+    ring_ticket_queue(ring_ticket_queue const&) = delete;
+    ring_ticket_queue& operator=(ring_ticket_queue const&) = delete;
+
+    /// Copy v into the queue, or return false if it is full.
+    bool
+    push(T const& v)
+    {
+        return push(v, [](void* dst, void const* src) {
+            *static_cast<T*>(dst) = *static_cast<T const*>(src);
+        });
+    }
+
+    /**
+     * Like push(v), but copy v into its cell with copy(dst, src),
+     * whose stores must be complete when it returns.
+     */
+    template <typename Copy>
+    bool
+    push(T const& v, Copy copy)
+    {
+        uint64_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& c = cells_[pos & (Capacity - 1)];
+            auto diff = static_cast<int64_t>(c.seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    copy(&c.data, &v);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;   /* a lap behind: the consumer still has it */
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// Copy the oldest record into v, or return false if there is none.
+    bool
+    pop(T& v)
+    {
+        return pop_if(v, [](T const&) { return true; }) >= 0;
+    }
+
+    /**
+     * Take the oldest record, but only copy it into v if match holds
+     * for it, looking at it in its cell. The cell is handed back
+     * either way.
+     *
+     * @return 1 if the record was copied, 0 if it was dropped, -1 if
+     * there is none.
+     */
+    template <typename Match>
+    int
+    pop_if(T& v, Match match)
+    {
+        uint64_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& c = cells_[pos & (Capacity - 1)];
+            auto diff = static_cast<int64_t>(c.seq.load(std::memory_order_acquire) - (pos + 1));
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    bool keep = match(c.data);
+                    if (keep)
+                        v = c.data;
+                    c.seq.store(pos + Capacity, std::memory_order_release);
+                    return keep;
+                }
+            } else if (diff < 0) {
+                return -1;      /* not published yet */
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// Whether the next record to pop is not published yet.
+    bool
+    empty() const
+    {
+        uint64_t pos = tail_.load(std::memory_order_acquire);
+        return cells_[pos & (Capacity - 1)].seq.load(std::memory_order_acquire) != pos + 1;
+    }
+
+private:
+    struct alignas(Align) cell {
+        std::atomic<uint64_t>   seq;
+        T                       data;
+    };
+
+    /// Next ticket for producers and for consumers, each on a line
+    /// pair of its own.
+    alignas(2 * Align) std::atomic<uint64_t>    head_;
+    alignas(2 * Align) std::atomic<uint64_t>    tail_;
+    alignas(2 * Align) cell                     cells_[Capacity];
+};
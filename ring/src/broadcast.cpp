@@ -0,0 +1,348 @@
+#include "ring_lcl.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <sched.h>
+#include <unistd.h>
+
+namespace {
+
+/// Whether process pid, that m was taken by, still runs.
+bool
+member_alive(ring_member const& m, int32_t pid)
+{
+    return proc_alive(pid, m.start.load(std::memory_order_relaxed));
+}
+
+/**
+ * Free member entry m of a process that exited, dropping its
+ * reference to its cursor.
+ *
+ * @return Whether this call freed it.
+ */
+bool
+member_reap(ring_bcast* b, ring_member& m, int32_t pid)
+{
+    if (m.pid.load(std::memory_order_acquire) != pid)
+        return false;
+    int32_t cursor = m.cursor.load(std::memory_order_relaxed);
+    m.pos.store(kNoRange, std::memory_order_relaxed);
+    m.end.store(kNoRange, std::memory_order_relaxed);
+    if (!m.pid.compare_exchange_strong(pid, 0, std::memory_order_acq_rel))
+        return false;
+    b->cursors[cursor].refs.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+}
+
+/**
+ * Free the members of cursor ci if none of them is running any
+ * more, which in turn frees the cursor.
+ *
+ * @return Whether the cursor has no live member.
+ */
+bool
+cursor_abandoned(ring_bcast* b, int ci)
+{
+    for (auto& m : b->members) {
+        int32_t pid = m.pid.load(std::memory_order_acquire);
+        if (pid != 0 && m.cursor.load(std::memory_order_relaxed) == ci &&
+            member_alive(m, pid))
+            return false;
+    }
+    for (auto& m : b->members) {
+        int32_t pid = m.pid.load(std::memory_order_acquire);
+        if (pid != 0 && m.cursor.load(std::memory_order_relaxed) == ci)
+            member_reap(b, m, pid);
+    }
+    return true;
+}
+
+/**
+ * Take a reference to the live cursor of group.
+ *
+ * @return Its index, or -1 if there is none.
+ */
+int
+cursor_join(ring_bcast* b, char const* group, int below)
+{
+    for (int i = 0; i < below; i++) {
+        auto& c = b->cursors[i];
+        uint32_t refs = c.refs.load(std::memory_order_acquire);
+        for (;;) {
+            /* Wait out a cursor being set up; it may be for group */
+            if (refs == kCursorInit) {
+                sched_yield();
+                refs = c.refs.load(std::memory_order_acquire);
+            } else if (refs == 0 ||
+                       c.refs.compare_exchange_weak(refs, refs + 1, std::memory_order_acq_rel)) {
+                break;
+            }
+        }
+        if (refs == 0)
+            continue;
+        if (strncmp(c.group, group, sizeof(c.group)) == 0)
+            return i;
+        c.refs.fetch_sub(1, std::memory_order_acq_rel);
+    }
+    return -1;
+}
+
+/**
+ * Set up a new cursor for group at the oldest record still in the
+ * ring. If another process set one up for the same group at the
+ * same time, the one with the lower index wins.
+ */
+int
+cursor_create(ring_hdr* h, char const* group)
+{
+    auto b = ring_bcast_of(h);
+    for (int i = 0; i < RING_MAX_CURSORS; i++) {
+        auto& c = b->cursors[i];
+        uint32_t refs = c.refs.load(std::memory_order_acquire);
+        if (refs != 0 && (refs == kCursorInit || !cursor_abandoned(b, i)))
+            continue;
+        refs = 0;
+        if (!c.refs.compare_exchange_strong(refs, kCursorInit, std::memory_order_acquire))
+            continue;
+        snprintf(c.group, sizeof(c.group), "%s", group);
+        uint64_t claim = b->claim.load(std::memory_order_acquire);
+        uint64_t start = claim > h->nslots ? claim - h->nslots : 0;
+        c.claim.store(start, std::memory_order_relaxed);
+        c.refs.store(1, std::memory_order_release);
+        if (*group) {
+            int other = cursor_join(b, group, i);
+            if (other >= 0) {
+                c.refs.store(0, std::memory_order_release);
+                return other;
+            }
+        }
+        /* Hold producers back before they reach the slots of records
+         * this cursor has yet to hand out */
+        uint64_t limit = b->limit.load(std::memory_order_relaxed);
+        while (limit > start + h->nslots &&
+               !b->limit.compare_exchange_weak(limit, start + h->nslots))
+            ;
+        return i;
+    }
+    return -1;
+}
+
+/**
+ * Recompute how far producers may claim from the cursors and the
+ * ranges members have claimed. Consumers that exited while holding
+ * the ring back are freed unless their group has live members left
+ * to take over; without any consumer the producers overwrite the
+ * oldest records.
+ */
+uint64_t
+bcast_gate(ring_hdr* h, uint64_t claim)
+{
+    auto b = ring_bcast_of(h);
+    uint64_t limit = UINT64_MAX;
+    /* Cursors first: a member publishes its range before it moves
+     * the claim of its cursor past it */
+    for (int i = 0; i < RING_MAX_CURSORS; i++) {
+        auto& c = b->cursors[i];
+        uint32_t refs = c.refs.load(std::memory_order_acquire);
+        if (refs == 0 || refs == kCursorInit)
+            continue;
+        uint64_t low = c.claim.load(std::memory_order_seq_cst);
+        if (low + h->nslots <= claim && cursor_abandoned(b, i))
+            continue;
+        limit = std::min(limit, low + h->nslots);
+    }
+    for (auto& m : b->members) {
+        if (m.pid.load(std::memory_order_acquire) == 0)
+            continue;
+        uint64_t pos = m.pos.load(std::memory_order_seq_cst);
+        if (pos == kNoRange)
+            continue;
+        if (pos + h->nslots <= claim &&
+            cursor_abandoned(b, m.cursor.load(std::memory_order_relaxed)))
+            continue;
+        limit = std::min(limit, pos + h->nslots);
+    }
+    b->limit.store(limit, std::memory_order_release);
+    return limit;
+}
+
+/**
+ * Give member m a new range: up to kClaimBatch records past the
+ * claim of its cursor or, when there are none, what a member of
+ * its group that exited left unread. The range is published in m
+ * before it is taken, so that producers never overwrite it.
+ *
+ * @return false, with pos and end set to kNoRange, if there is
+ * nothing to claim.
+ */
+bool
+member_claim(ring_hdr* h, ring_member& m, uint64_t& pos, uint64_t& end)
+{
+    auto b = ring_bcast_of(h);
+    int32_t ci = m.cursor.load(std::memory_order_relaxed);
+    auto& c = b->cursors[ci];
+    uint64_t avail = b->claim.load(std::memory_order_acquire);
+    uint64_t oldest = avail > h->nslots ? avail - h->nslots : 0;
+    uint64_t claim = c.claim.load(std::memory_order_acquire);
+    while (claim < avail) {
+        /* Records producers already overwrote are skipped */
+        pos = std::max(claim, oldest);
+        end = std::min(pos + kClaimBatch, avail);
+        m.pos.store(pos, std::memory_order_seq_cst);
+        m.end.store(end, std::memory_order_seq_cst);
+        if (c.claim.compare_exchange_strong(claim, end, std::memory_order_seq_cst))
+            return true;
+    }
+
+    for (auto& d : b->members) {
+        int32_t pid = d.pid.load(std::memory_order_acquire);
+        if (&d == &m || pid == 0 || d.cursor.load(std::memory_order_relaxed) != ci)
+            continue;
+        uint64_t dpos = d.pos.load(std::memory_order_acquire);
+        uint64_t dend = d.end.load(std::memory_order_acquire);
+        if (dpos >= dend || member_alive(d, pid))
+            continue;
+        m.pos.store(dpos, std::memory_order_seq_cst);
+        m.end.store(dend, std::memory_order_seq_cst);
+        if (member_reap(b, d, pid)) {
+            pos = dpos;
+            end = dend;
+            return true;
+        }
+    }
+    pos = end = kNoRange;
+    m.pos.store(kNoRange, std::memory_order_release);
+    m.end.store(kNoRange, std::memory_order_release);
+    return false;
+}
+
+}
+
+int
+bcast_attach(ring_hdr* h, char const* group)
+{
+    auto b = ring_bcast_of(h);
+    if (!group)
+        group = "";
+    int ci = *group ? cursor_join(b, group, RING_MAX_CURSORS) : -1;
+    if (ci < 0 && (ci = cursor_create(h, group)) < 0)
+        return -1;
+
+    int32_t self = getpid();
+    uint64_t start = proc_starttime(self);
+    for (int i = 0; i < RING_MAX_CONSUMERS; i++) {
+        auto& m = b->members[i];
+        int32_t cur = m.pid.load(std::memory_order_relaxed);
+        /* A range an exited member left unread stays with its group */
+        if (cur != 0 &&
+            (member_alive(m, cur) ||
+             m.pos.load(std::memory_order_relaxed) < m.end.load(std::memory_order_relaxed) ||
+             !member_reap(b, m, cur)))
+            continue;
+        cur = 0;
+        /* Until our start time is in, the entry reads as ours by
+         * pid alone */
+        m.start.store(0, std::memory_order_relaxed);
+        if (!m.pid.compare_exchange_strong(cur, self, std::memory_order_seq_cst))
+            continue;
+        m.start.store(start, std::memory_order_relaxed);
+        m.cursor.store(ci, std::memory_order_release);
+        return i;
+    }
+    b->cursors[ci].refs.fetch_sub(1, std::memory_order_acq_rel);
+    return -1;
+}
+
+void
+bcast_detach(ring_hdr* h, int member)
+{
+    auto b = ring_bcast_of(h);
+    auto& m = b->members[member];
+    int32_t ci = m.cursor.load(std::memory_order_relaxed);
+    m.pos.store(kNoRange, std::memory_order_relaxed);
+    m.end.store(kNoRange, std::memory_order_relaxed);
+    m.start.store(0, std::memory_order_relaxed);
+    m.pid.store(0, std::memory_order_release);
+    b->cursors[ci].refs.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+int
+bcast_enqueue(ring_hdr* h, elem const& e)
+{
+    auto b = ring_bcast_of(h);
+    uint64_t s = b->claim.load(std::memory_order_relaxed);
+    do {
+        if (s >= b->limit.load(std::memory_order_acquire) && s >= bcast_gate(h, s))
+            return -1;
+    } while (!b->claim.compare_exchange_weak(s, s + 1, std::memory_order_relaxed));
+
+    /* Mark the slot busy so that a consumer copying the record it
+     * held notices the overwrite. Only a producer a whole lap behind
+     * can still be writing it. */
+    auto slot = ring_slot_of(h, s);
+    uint64_t const prev = s >= h->nslots ? s - h->nslots + 1 : 0;
+    uint64_t cur = prev;
+    while (!slot->seq.compare_exchange_weak(cur, kSlotBusy,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+        cur = prev;
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->e = e;
+    slot->seq.store(s + 1, std::memory_order_release);
+    return 0;
+}
+
+size_t
+bcast_read(ring_hdr* h, int member, elem* out, size_t n)
+{
+    auto b = ring_bcast_of(h);
+    auto& m = b->members[member];
+    uint64_t pos = m.pos.load(std::memory_order_relaxed);
+    uint64_t end = m.end.load(std::memory_order_relaxed);
+    size_t cnt = 0;
+    while (cnt < n) {
+        if (pos >= end && !member_claim(h, m, pos, end))
+            break;
+        auto slot = ring_slot_of(h, pos);
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        if (seq == pos + 1) {
+            out[cnt] = slot->e;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->seq.load(std::memory_order_relaxed) == seq) {
+                cnt++;
+                pos++;
+                continue;
+            }
+        } else if (seq != kSlotBusy && seq <= pos) {
+            break;      /* not published yet */
+        }
+        /* Either the record is still being written, or producers
+         * lapped this member and overwrote it */
+        uint64_t claim = b->claim.load(std::memory_order_acquire);
+        if (claim <= pos + h->nslots)
+            break;
+        pos = claim - h->nslots;
+    }
+    m.pos.store(pos, std::memory_order_release);
+    return cnt;
+}
+
+bool
+bcast_drained(ring_hdr* h)
+{
+    auto b = ring_bcast_of(h);
+    uint64_t claim = b->claim.load(std::memory_order_acquire);
+    for (auto& m : b->members) {
+        int32_t pid = m.pid.load(std::memory_order_acquire);
+        if (pid == 0)
+            continue;
+        auto& c = b->cursors[m.cursor.load(std::memory_order_relaxed)];
+        bool behind = c.claim.load(std::memory_order_acquire) < claim ||
+                      m.pos.load(std::memory_order_acquire) < m.end.load(std::memory_order_acquire);
+        if (behind && member_alive(m, pid))
+            return false;
+    }
+    return true;
+}
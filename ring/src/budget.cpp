@@ -0,0 +1,157 @@
+#include "ring_lcl.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+namespace {
+
+char const* const kBudgetFile = "/etc/mpl/shm_budget";
+/// Serializes creators of segments on the host while a budget is in
+/// force, so that two of them do not both take the last room.
+char const* const kBudgetLock = "/dev/shm/.mpl_budget.lock";
+/// However close the host is to its limit, a new ring gets at least
+/// this much of the size it asks for.
+double const kMinScale = 1.0 / 16;
+
+/**
+ * A size with an optional K, M or G suffix, or 0 if s is not one.
+ */
+size_t
+parse_bytes(char const* s)
+{
+    char* end;
+    unsigned long long v = strtoull(s, &end, 10);
+    switch (toupper(*end)) {
+    case 'G':
+        v <<= 10;
+        [[fallthrough]];
+    case 'M':
+        v <<= 10;
+        [[fallthrough]];
+    case 'K':
+        v <<= 10;
+        break;
+    case '\0':
+        break;
+    default:
+        return 0;
+    }
+    return v;
+}
+
+/**
+ * Whether segment segname is charged to owner, as its header says.
+ * Segments being set up, or of another layout, belong to nobody.
+ */
+bool
+seg_owned_by(char const* segname, std::string const& owner)
+{
+    ring_seg s;
+    if (seg_open(segname, 0, &s) != 0)
+        return false;
+    ring_hdr const* h = hdr_validate(&s, 0);
+    bool owned = h && strncmp(h->owner_name, owner.c_str(), sizeof(h->owner_name)) == 0;
+    seg_close(&s);
+    return owned;
+}
+
+}
+
+/*
+ * The budget file holds one setting per line; '#' starts a comment.
+ *
+ *   limit 8G            ring segments on the host in all
+ *   quota * 1G          segments of each owner
+ *   quota process_34 2G segments of one owner, instead of quota *
+ *   shrink 75           past 75% of limit, new rings get smaller
+ */
+budget_guard::budget_guard(char const* owner)
+    : owner_{owner, strnlen(owner, RING_NAMESIZE - 1)}
+{
+    char const* path = getenv("MPL_SHM_BUDGET");
+    FILE* f = fopen(path ? path : kBudgetFile, "r");
+    if (!f)
+        return;
+    char line[256];
+    bool own_quota = false;
+    while (fgets(line, sizeof(line), f)) {
+        char key[16], a[RING_NAMESIZE], b[32];
+        int n = sscanf(line, "%15s %63s %31s", key, a, b);
+        if (n < 2 || key[0] == '#')
+            continue;
+        if (strcmp(key, "limit") == 0) {
+            limit_ = parse_bytes(a);
+        } else if (strcmp(key, "shrink") == 0) {
+            shrink_ = std::min(atoi(a), 100);
+        } else if (strcmp(key, "quota") == 0 && n == 3) {
+            if (owner_ == a) {
+                quota_ = parse_bytes(b);
+                own_quota = true;
+            } else if (!own_quota && strcmp(a, "*") == 0) {
+                quota_ = parse_bytes(b);
+            }
+        }
+    }
+    fclose(f);
+    if (!limit_ && !quota_)
+        return;
+    fd_ = open(kBudgetLock, O_RDONLY | O_CREAT | O_CLOEXEC, 0666);
+    if (fd_ >= 0)
+        flock(fd_, LOCK_EX);
+    measure();
+}
+
+budget_guard::~budget_guard()
+{
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+double
+budget_guard::scale() const
+{
+    if (!limit_ || shrink_ >= 100)
+        return 1;
+    size_t mark = limit_ / 100 * shrink_;
+    if (host_ <= mark)
+        return 1;
+    if (host_ >= limit_)
+        return kMinScale;
+    return std::max(kMinScale, double(limit_ - host_) / (limit_ - mark));
+}
+
+bool
+budget_guard::fits(char const* segname)
+{
+    if (!limit_ && !quota_)
+        return true;
+    measure(segname);
+    return (!limit_ || host_ <= limit_) && (!quota_ || owned_ <= quota_);
+}
+
+void
+budget_guard::measure(char const* created)
+{
+    host_ = owned_ = 0;
+    seg_foreach([&](char const* segname) {
+        size_t sz = seg_bytes(segname);
+        host_ += sz;
+        if (quota_ && ((created && strcmp(segname, created) == 0) ||
+                       seg_owned_by(segname, owner_)))
+            owned_ += sz;
+    });
+    /* Spares belong to whoever claims them */
+    spare_foreach([&](char const* path, bool) {
+        struct stat st;
+        if (stat(path, &st) == 0)
+            host_ += st.st_size;
+    });
+}
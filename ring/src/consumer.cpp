@@ -1,15 +1,203 @@
 #include "ring_lcl.hpp"
 
+namespace {
+
+/// Dequeues in a row that find the lanes held by a live process
+/// before it is checked for a successor that reused its pid.
+unsigned const kDrainerCheck = 1024;
+
+/**
+ * The lanes of a ring for as long as it is held, if it has any and
+ * no other consumer is draining them. A drainer that died is taken
+ * over.
+ */
+class lanes_lock {
+public:
+    explicit lanes_lock(ring* r)
+        : h_{ring_hdr_of(r)}
+    {
+        auto s = ring_seg_of(r);
+        if (h_->nlanes == 0)
+            return;
+        uint64_t cur = h_->drainer.load(std::memory_order_relaxed);
+        if (cur != 0) {
+            /* Reading procfs on every dequeue would cost more than
+             * the dequeue, so only now and then */
+            bool full = ++s->skipped % kDrainerCheck == 0;
+            if (token_alive(cur, full))
+                return;
+        }
+        held_ = h_->drainer.compare_exchange_strong(cur, s->token, std::memory_order_acquire);
+        if (held_)
+            s->skipped = 0;
+    }
+
+    ~lanes_lock()
+    {
+        if (held_)
+            h_->drainer.store(0, std::memory_order_release);
+    }
+
+    lanes_lock(lanes_lock const&) = delete;
+    lanes_lock& operator=(lanes_lock const&) = delete;
+
+    explicit operator bool() const { return held_; }
+
+private:
+    ring_hdr*   h_;
+    bool        held_ = false;
+};
+
+bool
+shared_queue_pop(ring* r, elem& e)
+{
+    if (r->flags & RING_F_TICKET)
+        return static_cast<ring_ticket_buffer*>(r->queue)->pop(e);
+    return static_cast<ring_buffer*>(r->queue)->pop(e);
+}
+
+/**
+ * Pop from the shared queue, handing out the lookahead element
+ * of an ordered merge first. The caller holds the lanes.
+ */
+bool
+shared_pop(ring* r, elem& e)
+{
+    auto h = ring_hdr_of(r);
+    if (h->has_pending) {
+        e = h->pending;
+        h->has_pending = false;
+        return true;
+    }
+    return shared_queue_pop(r, e);
+}
+
+/**
+ * Read up to n records of a broadcast ring as the member of r. The
+ * handle that created the ring takes a private cursor on first use.
+ */
+size_t
+bcast_pop(ring* r, elem* out, size_t n)
+{
+    auto s = ring_seg_of(r);
+    if (s->member < 0 && (s->member = bcast_attach(ring_hdr_of(r), nullptr)) < 0)
+        return 0;
+    return bcast_read(ring_hdr_of(r), s->member, out, n);
+}
+
+/**
+ * Pop from the shared queue, or else from the first lane after the
+ * one popped from last that has a record. While another consumer
+ * drains the lanes, only the shared queue is looked at.
+ */
+bool
+pop_any(ring* r, elem& e)
+{
+    auto s = ring_seg_of(r);
+    auto nlanes = ring_hdr_of(r)->nlanes;
+    if (r->flags & RING_F_BROADCAST)
+        return bcast_pop(r, &e, 1) == 1;
+    if (r->flags & RING_F_VARLEN)
+        return varlen_dequeue(r, &e, 1) == 1;
+    lanes_lock lanes{r};
+    if (!lanes)
+        return shared_queue_pop(r, e);
+    if (shared_pop(r, e))
+        return true;
+    for (unsigned i = 0; i < nlanes; i++) {
+        unsigned lane = (s->next_lane + i) % nlanes;
+        if (ring_lane_of(r, lane)->queue.pop(e)) {
+            s->next_lane = lane + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
 extern "C"
 int
 ring_dequeue(ring* r, elem** e)
 {
-    auto q = static_cast<ring_buffer*>(r->queue);
     *e = (elem*)malloc(sizeof(**e));
-    if(q->pop(**e)) {
-        return 0;
-    } else {
+    if (!pop_any(r, **e)) {
         free(*e);
         return -1;
     }
+    ring_notify(ring_hdr_of(r), RING_EV_SPACE);
+    return 0;
+}
+
+extern "C"
+size_t
+ring_dequeue_bulk(ring* r, elem* out, size_t n)
+{
+    auto s = ring_seg_of(r);
+    auto nlanes = ring_hdr_of(r)->nlanes;
+    size_t cnt = 0;
+    if (r->flags & RING_F_BROADCAST) {
+        cnt = bcast_pop(r, out, n);
+    } else if (r->flags & RING_F_VARLEN) {
+        cnt = varlen_dequeue(r, out, n);
+    } else if (lanes_lock lanes{r}; lanes) {
+        while (cnt < n && shared_pop(r, out[cnt]))
+            cnt++;
+        for (unsigned i = 0; i < nlanes && cnt < n; i++) {
+            unsigned lane = (s->next_lane + i) % nlanes;
+            cnt += ring_lane_of(r, lane)->queue.pop(out + cnt, n - cnt);
+            s->next_lane = lane + 1;
+        }
+    } else {
+        while (cnt < n && shared_queue_pop(r, out[cnt]))
+            cnt++;
+    }
+    if (cnt)
+        ring_notify(ring_hdr_of(r), RING_EV_SPACE);
+    return cnt;
+}
+
+extern "C"
+int
+ring_dequeue_ordered(ring* r, elem** e)
+{
+    auto h = ring_hdr_of(r);
+    auto nlanes = h->nlanes;
+    /* Broadcast and variable-length rings have no lanes; their
+     * records are in the order they were claimed, and so are those
+     * of the shared queue alone */
+    if ((r->flags & (RING_F_BROADCAST | RING_F_VARLEN)) || nlanes == 0)
+        return ring_dequeue(r, e);
+    /* While another consumer merges the lanes, there is nothing to
+     * hand out in order */
+    lanes_lock lanes{r};
+    if (!lanes)
+        return -1;
+    if (!h->has_pending)
+        h->has_pending = shared_queue_pop(r, h->pending);
+
+    ring_lane_buffer* oldest = nullptr;
+    bool found = h->has_pending;
+    uint64_t oldest_ts = h->pending.ts;
+    for (unsigned i = 0; i < nlanes; i++) {
+        auto& q = ring_lane_of(r, i)->queue;
+        if (!q.read_available())
+            continue;
+        uint64_t ts = q.front().ts;
+        if (!found || ts < oldest_ts) {
+            oldest = &q;
+            oldest_ts = ts;
+            found = true;
+        }
+    }
+    if (!found)
+        return -1;
+
+    *e = (elem*)malloc(sizeof(**e));
+    if (oldest)
+        oldest->pop(**e);
+    else
+        shared_pop(r, **e);
+    ring_notify(h, RING_EV_SPACE);
+    return 0;
 }
@@ -0,0 +1,123 @@
+#include "ring_lcl.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+size_t const kFmtAlign = alignof(ring_fmt);
+
+inline ring_fmt*
+fmt_at(ring_hdr* h, uint64_t off)
+{
+    return reinterpret_cast<ring_fmt*>(
+        reinterpret_cast<char*>(h) + h->foff + off);
+}
+
+inline char*
+fmt_str(ring_fmt* f)
+{
+    return reinterpret_cast<char*>(f + 1);
+}
+
+inline uint64_t
+fmt_entrysz(uint32_t len)
+{
+    return (sizeof(ring_fmt) + len + 1 + kFmtAlign - 1) & ~(kFmtAlign - 1);
+}
+
+/**
+ * The size of the entry at off, or 0 where the table ends. An entry
+ * that claims to run past the table ends it too.
+ */
+uint32_t
+fmt_size(ring_hdr* h, uint64_t off)
+{
+    if (off + sizeof(ring_fmt) > h->fsz)
+        return 0;
+    uint32_t sz = fmt_at(h, off)->size.load(std::memory_order_acquire);
+    if (sz < sizeof(ring_fmt) || sz % kFmtAlign || off + sz > h->fsz)
+        return 0;
+    return sz;
+}
+
+/**
+ * Whether an entry of the format table of r starts at off. The handle
+ * walks the table as far as it has to, and remembers the entries it
+ * passed.
+ */
+bool
+fmt_starts_at(ring* r, uint64_t off)
+{
+    auto s = ring_seg_of(r);
+    auto h = ring_hdr_of(r);
+    if (off % kFmtAlign || off >= h->fsz)
+        return false;
+    if (off >= s->fmt_walked.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(s->fmt_walk);
+        size_t const words = (h->fsz / kFmtAlign + 63) / 64;
+        if (!s->fmt_starts)
+            s->fmt_starts.reset(new std::atomic<uint64_t>[words]{});
+        uint64_t at = s->fmt_walked.load(std::memory_order_relaxed);
+        for (uint32_t sz; at <= off && (sz = fmt_size(h, at)); at += sz) {
+            uint64_t bit = at / kFmtAlign;
+            s->fmt_starts[bit / 64].fetch_or(1ull << bit % 64, std::memory_order_relaxed);
+        }
+        s->fmt_walked.store(at, std::memory_order_release);
+        if (off >= at)
+            return false;
+    }
+    uint64_t bit = off / kFmtAlign;
+    return s->fmt_starts[bit / 64].load(std::memory_order_relaxed) >> bit % 64 & 1;
+}
+
+}
+
+extern "C"
+uint32_t
+ring_fmt_register(struct ring* r, char const* fmt)
+{
+    auto h = ring_hdr_of(r);
+    uint32_t len = strlen(fmt);
+    if (len == 0)
+        return 0;
+    uint64_t sz = fmt_entrysz(len);
+    uint64_t off = 0;
+    for (;;) {
+        if (uint32_t fsz = fmt_size(h, off)) {
+            /* Entries still being written are passed over; a
+             * duplicate of one of them is harmless */
+            auto f = fmt_at(h, off);
+            uint32_t flen = f->len.load(std::memory_order_acquire);
+            if (flen == len && memcmp(fmt_str(f), fmt, len) == 0)
+                return off + 1;
+            off += fsz;
+            continue;
+        }
+        /* The end of the table: claim room there, if there is any */
+        if (off + sz > h->fsz)
+            return 0;
+        uint32_t none = 0;
+        auto f = fmt_at(h, off);
+        if (f->size.compare_exchange_strong(none, sz, std::memory_order_acq_rel)) {
+            memcpy(fmt_str(f), fmt, len + 1);
+            f->len.store(len, std::memory_order_release);
+            return off + 1;
+        }
+    }
+}
+
+extern "C"
+char const*
+ring_fmt_lookup(struct ring* r, uint32_t id)
+{
+    auto h = ring_hdr_of(r);
+    if (id == 0 || !fmt_starts_at(r, id - 1))
+        return nullptr;
+    auto f = fmt_at(h, id - 1);
+    uint32_t len = f->len.load(std::memory_order_acquire);
+    if (len == 0 || sizeof(ring_fmt) + len >= f->size.load(std::memory_order_relaxed) ||
+        fmt_str(f)[len] != '\0')
+        return nullptr;
+    return fmt_str(f);
+}
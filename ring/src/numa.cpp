@@ -0,0 +1,128 @@
+#include "ring_lcl.hpp"
+
+#include <cerrno>
+#include <cstdio>
+
+#include <sched.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+
+namespace {
+
+/// Nodes a node mask has room for.
+int const kMaxNodes = 1024;
+unsigned const kMaskBits = 8 * sizeof(unsigned long);
+
+/* The system calls themselves, so as not to depend on libnuma */
+long
+sys_mbind(void* addr, size_t size, int mode, unsigned long const* mask,
+          unsigned long maxnode, unsigned flags)
+{
+    return syscall(SYS_mbind, addr, size, mode, mask, maxnode, flags);
+}
+
+}
+
+int
+seg_bind(void* addr, size_t size, int node, bool move)
+{
+    if (node < 0 || node >= kMaxNodes)
+        return -1;
+    unsigned long mask[kMaxNodes / kMaskBits] = {};
+    mask[node / kMaskBits] = 1ul << (node % kMaskBits);
+    /* The kernel reads one bit less than maxnode */
+    unsigned long const maxnode = kMaxNodes + 1;
+    /* Preferred rather than bound, so that a node that is out of
+     * memory does not kill whoever faults in the next page */
+    if (!move)
+        return sys_mbind(addr, size, MPOL_PREFERRED, mask, maxnode, 0) == 0 ? 0 : -1;
+    if (sys_mbind(addr, size, MPOL_PREFERRED, mask, maxnode, MPOL_MF_MOVE_ALL) == 0)
+        return 0;
+    /* Without CAP_SYS_NICE only pages no other process maps move */
+    if (errno == EPERM &&
+        sys_mbind(addr, size, MPOL_PREFERRED, mask, maxnode, MPOL_MF_MOVE) == 0)
+        return 0;
+    return -1;
+}
+
+namespace {
+
+int
+node_bind(struct ring* r, int node, bool move)
+{
+    int rc = 0;
+    for (auto s = ring_seg_of(r); s; s = s->next.load(std::memory_order_acquire)) {
+        /* The mirror maps the same pages as the end of the segment */
+        if (seg_bind(s->addr, s->size, node, move) != 0) {
+            rc = -1;
+            continue;
+        }
+        s->flags |= RING_F_NUMA;
+        seg_hdr(s)->node.store(node, std::memory_order_relaxed);
+    }
+    if (rc == 0)
+        r->flags |= RING_F_NUMA;
+    return rc;
+}
+
+}
+
+extern "C"
+int
+ring_bind(struct ring* r, int node)
+{
+    return node_bind(r, node, true);
+}
+
+extern "C"
+int
+ring_prefer(struct ring* r, int node)
+{
+    return node_bind(r, node, false);
+}
+
+extern "C"
+int
+ring_node(struct ring* r)
+{
+    return ring_hdr_of(r)->node.load(std::memory_order_relaxed);
+}
+
+extern "C"
+int
+ring_cpu_node(void)
+{
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+        return -1;
+    return node;
+}
+
+extern "C"
+int
+ring_run_on_node(int node)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* f = node >= 0 ? fopen(path, "r") : nullptr;
+    if (!f)
+        return -1;
+    /* A list of ranges such as 0-7,16-23 */
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    unsigned lo, hi;
+    int n;
+    while ((n = fscanf(f, "%u-%u", &lo, &hi)) >= 1) {
+        if (n == 1)
+            hi = lo;
+        for (unsigned c = lo; c <= hi && c < CPU_SETSIZE; c++)
+            CPU_SET(c, &cpus);
+        if (fgetc(f) != ',')
+            break;
+    }
+    fclose(f);
+    if (CPU_COUNT(&cpus) == 0)
+        return -1;
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0 ? 0 : -1;
+}
@@ -0,0 +1,60 @@
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include <ring.h>
+
+namespace {
+
+volatile sig_atomic_t stop;
+
+void
+on_signal(int)
+{
+    stop = 1;
+}
+
+}
+
+/**
+ * Keeps a pool of spare ring segments on this host, so that a new
+ * channel takes one over instead of setting up a segment.
+ *
+ * Usage: ring_pooler [spares] [interval_sec]
+ *
+ * Tops the pool up to spares (default 8) segments as soon as one
+ * is claimed, and at least every interval_sec (default 5) in case
+ * the budget of the host held it back. The pool is emptied on
+ * SIGINT and SIGTERM.
+ */
+int main(int argc, char* argv[])
+{
+    unsigned spares = argc > 1 ? strtoul(argv[1], nullptr, 10) : 8;
+    unsigned interval = argc > 2 ? strtoul(argv[2], nullptr, 10) : 5;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    int in = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    while (!stop) {
+        int have = ring_pool_keep(spares);
+        if (have < static_cast<int>(spares))
+            fprintf(stderr, "Pool holds %d of %u spare segments\n", have, spares);
+        /* Claims move spares out of the directory */
+        if (in < 0 || inotify_add_watch(in, RING_POOL_DIR, IN_MOVED_FROM | IN_DELETE) < 0) {
+            sleep(interval);
+            continue;
+        }
+        pollfd pfd = {in, POLLIN, 0};
+        if (poll(&pfd, 1, interval * 1000) > 0) {
+            char buf[4096];
+            while (read(in, buf, sizeof(buf)) > 0)
+                ;
+        }
+    }
+    ring_pool_keep(0);
+    return 0;
+}
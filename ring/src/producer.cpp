@@ -1,12 +1,120 @@
 #include "ring_lcl.hpp"
+#include "ring.h"
+
+#include <cerrno>
+
+#include <signal.h>
+#include <unistd.h>
+
+namespace {
+
+/// An enqueue that ring_wait_for() retries with the same seq.
+struct push_op {
+    ring*   r;
+    int     lane;
+    elem*   e;
+};
+
+void
+copy_stream(void* dst, void const* src)
+{
+    ring_copy_stream(dst, src, sizeof(elem));
+}
+
+/**
+ * Push op->e, already stamped, onto its lane or else the shared
+ * queue.
+ */
+int
+push(void* arg)
+{
+    auto op = static_cast<push_op*>(arg);
+    auto h = ring_hdr_of(op->r);
+    bool pushed;
+    if (op->lane >= 0)
+        pushed = ring_lane_of(op->r, op->lane)->queue.push(*op->e);
+    else if (op->r->flags & RING_F_BROADCAST)
+        pushed = bcast_enqueue(h, *op->e) == 0;
+    else if (op->r->flags & RING_F_VARLEN)
+        pushed = varlen_enqueue(op->r, *op->e) == 0;
+    else if (!(op->r->flags & RING_F_TICKET))
+        pushed = static_cast<ring_buffer*>(op->r->queue)->push(*op->e);
+    else if (ring_streams(op->r, sizeof(elem)))
+        pushed = static_cast<ring_ticket_buffer*>(op->r->queue)->push(*op->e, copy_stream);
+    else
+        pushed = static_cast<ring_ticket_buffer*>(op->r->queue)->push(*op->e);
+    if (!pushed)
+        return 0;
+    ring_notify(h, RING_EV_DATA);
+    return 1;
+}
+
+int
+enqueue(ring* r, int lane, elem* e, ring_wait* w)
+{
+    e->seq = ring_hdr_of(r)->next_seq.fetch_add(1, std::memory_order_relaxed);
+    push_op op{r, lane, e};
+    if (!w)
+        return push(&op) ? 0 : -1;
+    return ring_wait_for(r, w, RING_EV_SPACE, push, &op) ? 0 : -1;
+}
+
+}
 
 extern "C"
 int
 ring_enqueue(ring* r, elem* e)
 {
-    auto q = static_cast<ring_buffer*>(r->queue);
-    if (q->push(*e))
-        return 0;
-    else
-        return -1;
+    return enqueue(r, -1, e, nullptr);
+}
+
+extern "C"
+int
+ring_enqueue_wait(ring* r, elem* e, ring_wait* w)
+{
+    return enqueue(r, -1, e, w);
+}
+
+extern "C"
+int
+ring_lane_claim(ring* r)
+{
+    auto h = ring_hdr_of(r);
+    for (unsigned i = 0; i < h->nlanes; i++)
+        if (writer_claim(ring_lane_of(r, i)->owner))
+            return i;
+    return -1;
+}
+
+extern "C"
+void
+ring_lane_release(ring* r, int lane)
+{
+    writer_release(ring_lane_of(r, lane)->owner);
+}
+
+extern "C"
+void
+ring_lane_release_all(ring* r)
+{
+    int32_t self = getpid();
+    for (unsigned i = 0; i < ring_hdr_of(r)->nlanes; i++) {
+        auto& owner = ring_lane_of(r, i)->owner;
+        if (owner.pid.load(std::memory_order_relaxed) == self)
+            writer_release(owner);
+    }
+}
+
+extern "C"
+int
+ring_lane_enqueue(ring* r, int lane, elem* e)
+{
+    return enqueue(r, lane, e, nullptr);
+}
+
+extern "C"
+int
+ring_lane_enqueue_wait(ring* r, int lane, elem* e, ring_wait* w)
+{
+    return enqueue(r, lane, e, w);
 }
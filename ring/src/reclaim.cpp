@@ -0,0 +1,253 @@
+#include "ring_lcl.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include <signal.h>
+#include <unistd.h>
+
+uint64_t
+proc_starttime(pid_t pid)
+{
+    char path[64];
+    char buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return 0;
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+
+    /* comm may contain spaces and parens; fields resume after
+     * the last ')'. starttime is the 20th field from there. */
+    char* p = strrchr(buf, ')');
+    if (!p)
+        return 0;
+    for (int field = 0; field < 20; field++) {
+        p = strchr(p + 1, ' ');
+        if (!p)
+            return 0;
+    }
+    return strtoull(p + 1, nullptr, 10);
+}
+
+bool
+proc_alive(int32_t pid, uint64_t start)
+{
+    if (pid <= 0)
+        return false;
+    if (kill(pid, 0) != 0 && errno != EPERM)
+        return false;
+    uint64_t now = proc_starttime(pid);
+    /* Without procfs we cannot tell pid reuse apart; assume alive */
+    return now == 0 || start == 0 || now == start;
+}
+
+bool
+hdr_owner_alive(ring_hdr const* h)
+{
+    return proc_alive(h->owner_pid, h->owner_start);
+}
+
+uint64_t
+proc_token()
+{
+    pid_t self = getpid();
+    return proc_starttime(self) << 32 | static_cast<uint32_t>(self);
+}
+
+bool
+token_alive(uint64_t token, bool full)
+{
+    auto pid = static_cast<int32_t>(token);
+    if (!full)
+        return proc_alive(pid, 0);
+    uint64_t start = proc_starttime(pid);
+    return proc_alive(pid, 0) && (start == 0 || (start << 32) == (token & ~0xffffffffull));
+}
+
+bool
+writer_claim(ring_writer& w)
+{
+    int32_t self = getpid();
+    int32_t cur = w.pid.load(std::memory_order_relaxed);
+    if (cur != 0) {
+        if (proc_alive(cur, w.start.load(std::memory_order_relaxed)))
+            return false;
+        /* Until our start time is in, the entry reads as ours by
+         * pid alone */
+        w.start.store(0, std::memory_order_relaxed);
+    }
+    if (!w.pid.compare_exchange_strong(cur, self, std::memory_order_seq_cst))
+        return false;
+    /* Whatever a dead writer left in flight never lands */
+    w.inflight.store(0, std::memory_order_relaxed);
+    w.start.store(proc_starttime(self), std::memory_order_relaxed);
+    return true;
+}
+
+void
+writer_release(ring_writer& w)
+{
+    w.start.store(0, std::memory_order_relaxed);
+    w.pid.store(0, std::memory_order_release);
+}
+
+int
+hdr_writer_add(ring_hdr* h)
+{
+    for (int i = 0; i < RING_MAX_WRITERS; i++)
+        if (writer_claim(h->writers[i]))
+            return i;
+    return -1;
+}
+
+namespace {
+
+/**
+ * Whether a producer is attached to the segment of h: its owner, a
+ * writer or the holder of one of its lanes.
+ */
+bool
+hdr_in_use(ring_hdr* h)
+{
+    if (hdr_owner_alive(h))
+        return true;
+    for (auto& w : h->writers)
+        if (proc_alive(w.pid.load(std::memory_order_acquire),
+                       w.start.load(std::memory_order_relaxed)))
+            return true;
+    auto base = reinterpret_cast<char*>(h);
+    for (unsigned i = 0; i < h->nlanes; i++) {
+        auto l = reinterpret_cast<ring_lane*>(base + h->loff + i * h->lanesz);
+        if (proc_alive(l->owner.pid.load(std::memory_order_acquire),
+                       l->owner.start.load(std::memory_order_relaxed)))
+            return true;
+    }
+    return false;
+}
+
+bool
+hdr_queue_empty(ring_hdr* h)
+{
+    if (h->flags & RING_F_BROADCAST)
+        return bcast_drained(h);
+    if (h->flags & RING_F_VARLEN)
+        return varlen_empty(h);
+    /* Queues of other types cannot be looked into from here; their
+     * segments go once the grace period is over */
+    if (!hdr_elem_queue(h))
+        return false;
+    auto base = reinterpret_cast<char*>(h);
+    if (h->queue == mpl::ticket_policy::kind
+            ? !reinterpret_cast<ring_ticket_buffer*>(base + h->qoff)->empty()
+            : !reinterpret_cast<ring_buffer*>(base + h->qoff)->empty())
+        return false;
+    for (unsigned i = 0; i < h->nlanes; i++) {
+        auto l = reinterpret_cast<ring_lane*>(base + h->loff + i * h->lanesz);
+        if (l->queue.read_available())
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Decide whether the segment of ring name with header h, and the
+ * generations after it of a variable-length ring, can be removed. A
+ * producer attached to any of them keeps them; otherwise they go
+ * once they are drained or, unless grace is negative, once they
+ * have stayed orphaned for grace seconds.
+ */
+bool
+hdr_reclaimable(char const* name, ring_hdr* h, long grace)
+{
+    if (hdr_in_use(h))
+        return false;
+    bool empty = hdr_queue_empty(h);
+    if ((h->flags & RING_F_VARLEN) &&
+        !varlen_gens(name, h, [&](ring_hdr* gen) {
+            empty = empty && hdr_queue_empty(gen);
+            return !hdr_in_use(gen);
+        }))
+        return false;
+    if (empty)
+        return true;
+    if (grace < 0)
+        return false;
+    uint64_t now = time(nullptr);
+    uint64_t since = 0;
+    if (h->orphaned_at.compare_exchange_strong(since, now))
+        since = now;
+    return now - since >= static_cast<uint64_t>(grace);
+}
+
+/**
+ * Remove the segment of ring name with header h, the generations
+ * after it first.
+ */
+void
+hdr_unlink(char const* name, ring_hdr* h)
+{
+    char segname[SEGM_NAMESIZE];
+    if (h->flags & RING_F_VARLEN)
+        varlen_gens(name, h, [&](ring_hdr* gen) {
+            if (seg_name(segname, name, gen->gen))
+                seg_unlink(segname);
+            return true;
+        });
+    if (seg_name(segname, name, (h->flags & RING_F_VARLEN) ? h->gen : 0))
+        seg_unlink(segname);
+}
+
+}
+
+extern "C"
+int
+ring_owner_alive(struct ring* r)
+{
+    return hdr_owner_alive(ring_hdr_of(r)) ? 1 : 0;
+}
+
+extern "C"
+int
+ring_reclaim(struct ring* r)
+{
+    auto h = ring_hdr_of(r);
+    if (!hdr_reclaimable(r->name, h, -1))
+        return -1;
+    hdr_unlink(r->name, h);
+    return 0;
+}
+
+extern "C"
+int
+ring_sweep(unsigned grace)
+{
+    int reclaimed = 0;
+    seg_foreach([&](char const* segname) {
+        ring_seg s;
+        if (seg_open(segname, 0, &s) != 0)
+            return;
+        /* Segments still being created are skipped, not waited for */
+        ring_hdr* h = hdr_validate(&s, 0);
+        uint32_t gen = h && (h->flags & RING_F_VARLEN) ? h->gen : 0;
+        /* Later generations of a variable-length ring go with the
+         * first one, and on their own once it is gone */
+        std::string name = segname + strlen(SEGM_PREFIX);
+        char first[SEGM_NAMESIZE];
+        if (gen) {
+            name.resize(name.size() - std::to_string(gen).size() - 1);
+            seg_name(first, name.c_str(), 0);
+        }
+        if (h && (!gen || !seg_bytes(first)) && hdr_reclaimable(name.c_str(), h, grace)) {
+            hdr_unlink(name.c_str(), h);
+            reclaimed++;
+        }
+        seg_close(&s);
+    });
+    return reclaimed;
+}
@@ -1,53 +1,820 @@
 #include "ring_lcl.hpp"
 
-namespace bip = boost::interprocess;                                            
+#include <algorithm>
+#include <cerrno>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <sched.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t
+roundup(size_t sz, size_t to)
+{
+    return to * ((sz + to - 1) / to);
+}
+
+/// Regions of the segment start on a pair of cache lines, so that
+/// the last control word of one does not share a prefetched pair
+/// with the first of the next.
+size_t const kHdrSz = roundup(sizeof(ring_hdr), kLinePairSz);
+size_t const kLaneSz = roundup(sizeof(ring_lane), kLinePairSz);
+size_t const kBcastSz = roundup(sizeof(ring_bcast), kLinePairSz);
+/// Largest broadcast slot ring_attr::slotsz may ask for.
+size_t const kMaxSlotSz = 4096;
+size_t const kFmtSz = RING_FMT_TABLESZ;
+/// How many 100us naps an attacher waits for a concurrent
+/// creator to publish the segment header.
+int const kAttachRetries = 1000;
+
+/// The shared queue of the C API, and that of RING_F_TICKET rings.
+ring_queue_desc const kElemQueue = {mpl::default_policy::kind, sizeof(elem),
+                                    sizeof(ring_buffer)};
+ring_queue_desc const kTicketQueue = {mpl::ticket_policy::kind, sizeof(elem),
+                                      sizeof(ring_ticket_buffer)};
+/// Variable-length rings have no queue.
+ring_queue_desc const kVarlenDesc = {kVarlenQueue, 0, 0};
+
+/// What a segment holds besides the header and the format table.
+struct seg_geom {
+    ring_queue_desc q;
+    unsigned        nlanes;
+    /// 0 unless it is a broadcast ring.
+    size_t          nslots;
+    size_t          slotsz;
+    /// Record bytes of a variable-length ring, or 0.
+    size_t          dsz;
+};
+
+size_t
+page_size()
+{
+    static size_t const sz = sysconf(_SC_PAGESIZE);
+    return sz;
+}
+
+/// Record bytes of a variable-length ring of n bytes: n rounded up
+/// to a power of two pages.
+size_t
+varlen_size(size_t n)
+{
+    size_t dsz;
+    for (dsz = page_size(); dsz < n; dsz <<= 1)
+        ;
+    return dsz;
+}
+
+void
+hdr_take_ownership(ring_hdr* h)
+{
+    h->owner_pid = getpid();
+    h->owner_start = proc_starttime(h->owner_pid);
+    h->orphaned_at.store(0, std::memory_order_relaxed);
+}
+
+/// Offset of the lanes, right after the shared queue.
+size_t
+lane_off(seg_geom const& g)
+{
+    return kHdrSz + roundup(g.q.qsz, kLinePairSz);
+}
+
+/// Offset of the broadcast control block, right after the lanes.
+size_t
+bcast_off(seg_geom const& g)
+{
+    return lane_off(g) + g.nlanes * kLaneSz;
+}
+
+/// Offset of the format table, right after the broadcast slots.
+size_t
+fmt_off(seg_geom const& g)
+{
+    return bcast_off(g) + (g.nslots ? kBcastSz + g.nslots * g.slotsz : 0);
+}
+
+/// Offset of the records of a variable-length ring. They come last
+/// and start on a page, so that they can be mapped a second time.
+size_t
+data_off(seg_geom const& g)
+{
+    return roundup(fmt_off(g) + kFmtSz, page_size());
+}
+
+size_t
+seg_size(seg_geom const& g)
+{
+    return g.dsz ? data_off(g) + g.dsz : fmt_off(g) + kFmtSz;
+}
+
+/// Record in h that it was made for a request for want.
+void
+hdr_want(ring_hdr* h, seg_geom const& want)
+{
+    h->want_lanes = want.nlanes;
+    h->want_slots = want.nslots;
+    h->want_dsz = want.dsz;
+}
+
+/// Whether d is a shared queue of the C API, of either kind.
+bool
+elem_queue(ring_queue_desc const& d)
+{
+    for (auto const& q : {kElemQueue, kTicketQueue})
+        if (d.kind == q.kind && d.elemsz == q.elemsz && d.qsz == q.qsz)
+            return true;
+    return false;
+}
+
+/**
+ * Whether a request for queue q attaches to the shared queue of h:
+ * one of the same shape or, for the C API, either of its queues.
+ */
+bool
+hdr_queue_fits(ring_hdr const* h, ring_queue_desc const& q)
+{
+    return hdr_queue_matches(h, q) || (hdr_elem_queue(h) && elem_queue(q));
+}
+
+/// Record in h the owner that budget charges the segment to.
+void
+hdr_charge(ring_hdr* h, budget_guard const& budget)
+{
+    snprintf(h->owner_name, sizeof(h->owner_name), "%s", budget.owner());
+}
+
+/**
+ * Whether the segment of h is what a request for want makes: the
+ * same queue and slot size, and what was asked for of the rest.
+ */
+bool
+hdr_geom_matches(ring_hdr const* h, seg_geom const& want)
+{
+    return hdr_queue_fits(h, want.q) && h->want_lanes == want.nlanes &&
+           h->want_slots == want.nslots && h->want_dsz == want.dsz &&
+           h->slotsz == (want.nslots ? want.slotsz : 0);
+}
+
+ring_hdr*
+hdr_init(ring_seg* s, size_t n, seg_geom const& g, unsigned flags,
+         void (*construct)(void* at), uint32_t gen = 0, int node = -1)
+{
+    auto h = new (s->addr) ring_hdr;
+    h->version = kRingVersion;
+    h->queue = g.q.kind;
+    h->flags = s->flags | (flags & (RING_F_BROADCAST | RING_F_VARLEN));
+    h->capacity = n;
+    h->elemsz = g.q.elemsz;
+    h->segsz = s->size;
+    h->qoff = kHdrSz;
+    h->qsz = g.q.qsz;
+    h->nlanes = g.nlanes;
+    h->lanesz = kLaneSz;
+    h->loff = lane_off(g);
+    h->boff = g.nslots ? bcast_off(g) : 0;
+    h->soff = g.nslots ? bcast_off(g) + kBcastSz : 0;
+    h->nslots = g.nslots;
+    h->slotsz = g.nslots ? g.slotsz : 0;
+    h->foff = fmt_off(g);
+    h->fsz = kFmtSz;
+    h->doff = g.dsz ? data_off(g) : 0;
+    h->dsz = g.dsz;
+    hdr_want(h, g);
+    h->gen = gen;
+    h->next_gen.store(0, std::memory_order_relaxed);
+    writer_release(h->resizer);
+    h->node.store((s->flags & RING_F_NUMA) ? node : -1, std::memory_order_relaxed);
+    h->next_seq.store(0, std::memory_order_relaxed);
+    h->vhead.store(0, std::memory_order_relaxed);
+    h->vtail.store(0, std::memory_order_relaxed);
+    h->drainer.store(0, std::memory_order_relaxed);
+    h->has_pending = false;
+    for (auto& e : h->events) {
+        e.epoch.store(0, std::memory_order_relaxed);
+        e.waiters.store(0, std::memory_order_relaxed);
+    }
+    hdr_take_ownership(h);
+    construct(static_cast<char*>(s->addr) + h->qoff);
+    for (unsigned i = 0; i < g.nlanes; i++)
+        new (static_cast<char*>(s->addr) + h->loff + i * h->lanesz) ring_lane{};
+    if (g.nslots) {
+        auto b = new (ring_bcast_of(h)) ring_bcast{};
+        b->limit.store(UINT64_MAX, std::memory_order_relaxed);
+        for (auto& m : b->members) {
+            m.pos.store(kNoRange, std::memory_order_relaxed);
+            m.end.store(kNoRange, std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < g.nslots; i++)
+            new (ring_slot_of(h, i)) ring_slot{};
+    }
+    h->magic.store(kRingMagic, std::memory_order_release);
+    return h;
+}
+
+/**
+ * Whether a ring of shape g can be made from a spare of the pool,
+ * which holds rings as ring_init() creates them.
+ */
+bool
+spare_shape(seg_geom const& g)
+{
+    return g.q.kind == kElemQueue.kind && g.q.elemsz == kElemQueue.elemsz &&
+           g.q.qsz == kElemQueue.qsz && !g.nlanes && !g.nslots && !g.dsz;
+}
+
+/// What the budget charges the pool with while it creates spares.
+char const* const kPoolOwner = "pool";
+
+/// No ring, with errno set to err.
+ring*
+fail(int err)
+{
+    errno = err;
+    return nullptr;
+}
+
+ring*
+ring_make(char const* name, ring_seg* s, ring_hdr* h)
+{
+    ring* r = (ring*) malloc(sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->seg = static_cast<void*>(s);
+    r->flags = s->flags | (h->flags & (RING_F_BROADCAST | RING_F_VARLEN));
+    if (h->node.load(std::memory_order_relaxed) >= 0)
+        r->flags |= RING_F_NUMA;
+    if (h->queue == mpl::ticket_policy::kind)
+        r->flags |= RING_F_TICKET;
+    r->queue = static_cast<char*>(s->addr) + (h->dsz ? h->doff : h->qoff);
+    if (h->nlanes)
+        s->token = proc_token();
+    return r;
+}
+
+void
+construct_elem_queue(void* at)
+{
+    new (at) ring_buffer;
+}
+
+void
+construct_ticket_queue(void* at)
+{
+    new (at) ring_ticket_buffer;
+}
+
+void
+construct_nothing(void*)
+{}
+
+/**
+ * Map the records of a variable-length ring a second time right
+ * after the segment, which moves the mapping.
+ *
+ * @return The header at its new address, or nullptr.
+ */
+ring_hdr*
+hdr_mirror(char const* segname, ring_seg* s, ring_hdr* h)
+{
+    if (!h->dsz || s->mirror)
+        return h;
+    if (seg_mirror(segname, s, h->dsz) != 0)
+        return nullptr;
+    return static_cast<ring_hdr*>(s->addr);
+}
+
+/**
+ * Create the segment of ring name with geometry g, or attach to an
+ * existing one that was created for the same request want; g is
+ * want as far as the budget lets it be. A stale segment of another
+ * layout is replaced, and one of another geometry fails the call
+ * with EEXIST. A new segment that does not fit in budget is removed
+ * again; one that is created is placed on NUMA node node, unless it
+ * is -1.
+ */
+ring*
+ring_create(char const* name, size_t n, seg_geom const& g, seg_geom const& want,
+            unsigned flags, void (*construct)(void* at), budget_guard& budget,
+            int node = -1)
+{
+    char segname[SEGM_NAMESIZE];
+    /* A name cut short could be that of another ring */
+    if (!seg_name(segname, name, 0))
+        return fail(ENAMETOOLONG);
+    auto s = new ring_seg{};
+    ring_hdr* h = nullptr;
+    /* A spare from the pool is set up already */
+    bool claimed = !(flags & RING_F_HUGEPAGES) && spare_shape(g) &&
+                   spare_claim(segname) == 0;
+    for (int attempt = 0; !h && attempt < 3; attempt++) {
+        bool created;
+        if (seg_create(segname, seg_size(g), flags, s, &created, node) != 0)
+            break;
+        char const* made = created ? s->staged.c_str() : segname;
+        if ((created || claimed) && !budget.fits(made)) {
+            /* Over the limit of the host or the quota of the owner */
+            seg_close(s);
+            seg_unlink(made);
+            errno = ENOSPC;
+            break;
+        }
+        if (created) {
+            h = hdr_init(s, n, g, flags, construct, 0, node);
+            hdr_want(h, want);
+            hdr_charge(h, budget);
+            if (seg_publish(segname, s) != 0) {
+                /* Another creator came first; attach to its ring */
+                h = nullptr;
+                seg_close(s);
+                if (errno != EEXIST)
+                    break;
+            }
+        } else if (!(h = hdr_validate(s, kAttachRetries)) ||
+                   !hdr_queue_fits(h, g.q)) {
+            /* A stale segment of another layout holds this name */
+            h = nullptr;
+            claimed = false;
+            seg_close(s);
+            seg_unlink(segname);
+        } else if (claimed) {
+            hdr_take_ownership(h);
+            hdr_want(h, want);
+            hdr_charge(h, budget);
+            h->capacity = n;
+            if (node >= 0 && seg_bind(s->addr, s->size, node, true) == 0) {
+                s->flags |= RING_F_NUMA;
+                h->node.store(node, std::memory_order_relaxed);
+            }
+        } else if (!hdr_geom_matches(h, want)) {
+            /* Lanes, slots or records this call did not ask for */
+            seg_close(s);
+            errno = EEXIST;
+            h = nullptr;
+            break;
+        } else if (!hdr_owner_alive(h)) {
+            /* Restarted producer: pick up the ring of our
+             * predecessor together with whatever it left queued */
+            hdr_take_ownership(h);
+        }
+    }
+    if (h && !(h = hdr_mirror(segname, s, h)))
+        seg_close(s);
+    if (!h) {
+        delete s;
+        return nullptr;
+    }
+    /* Sweeps leave the ring alone while a producer is attached */
+    s->writer = hdr_writer_add(h);
+    return ring_make(name, s, h);
+}
+
+/**
+ * Attach to ring name if its shared queue is d, or with d NULL to
+ * any ring the C API reads. Every consumer
+ * handle of a broadcast ring is a member of the group it reads for.
+ */
+ring*
+ring_attach(char const* name, char const* group, ring_queue_desc const* d)
+{
+    char segname[SEGM_NAMESIZE];
+    if (!seg_name(segname, name, 0))
+        return nullptr;
+    auto s = new ring_seg{};
+    if (seg_open(segname, 0, s) != 0) {
+        delete s;
+        return nullptr;
+    }
+    ring_hdr* h = hdr_validate(s, kAttachRetries);
+    if (h && !(d ? hdr_queue_matches(h, *d) : hdr_elem_queue(h) || h->queue == kVarlenQueue))
+        h = nullptr;
+    if (h)
+        h = hdr_mirror(segname, s, h);
+    if (h && (h->flags & RING_F_BROADCAST))
+        s->member = bcast_attach(h, group);
+    if (!h || ((h->flags & RING_F_BROADCAST) && s->member < 0)) {
+        seg_close(s);
+        delete s;
+        return nullptr;
+    }
+    return ring_make(name, s, h);
+}
+
+/**
+ * Map generation gen of variable-length ring name.
+ */
+ring_seg*
+gen_open(char const* name, uint32_t gen)
+{
+    char segname[SEGM_NAMESIZE];
+    if (!seg_name(segname, name, gen))
+        return nullptr;
+    auto s = new ring_seg{};
+    if (seg_open(segname, 0, s) != 0) {
+        delete s;
+        return nullptr;
+    }
+    ring_hdr* h = hdr_validate(s, kAttachRetries);
+    if (h && (!(h->flags & RING_F_VARLEN) || h->gen != gen))
+        h = nullptr;
+    if (h)
+        h = hdr_mirror(segname, s, h);
+    if (!h) {
+        seg_close(s);
+        delete s;
+        return nullptr;
+    }
+    return s;
+}
+
+/**
+ * Create generation gen of variable-length ring name on NUMA node
+ * node, or wherever with -1, replacing a segment left over from an
+ * earlier run.
+ */
+ring_seg*
+gen_create(char const* name, uint32_t gen, size_t n, unsigned flags,
+           int node, budget_guard& budget)
+{
+    char segname[SEGM_NAMESIZE];
+    if (!seg_name(segname, name, gen))
+        return nullptr;
+    seg_unlink(segname);
+    seg_geom g{kVarlenDesc, 0, 0, 0, varlen_size(n)};
+    auto s = new ring_seg{};
+    bool created;
+    if (seg_create(segname, seg_size(g), flags, s, &created, node) != 0) {
+        delete s;
+        return nullptr;
+    }
+    ring_hdr* h = nullptr;
+    if (created && budget.fits(s->staged.c_str())) {
+        h = hdr_init(s, n, g, flags | RING_F_VARLEN, construct_nothing, gen, node);
+        hdr_charge(h, budget);
+        if (seg_publish(segname, s) != 0)
+            h = nullptr;
+    } else if (created)
+        seg_unlink(s->staged.c_str());
+    if (h)
+        h = hdr_mirror(segname, s, h);
+    if (!h) {
+        seg_close(s);
+        delete s;
+        return nullptr;
+    }
+    return s;
+}
+
+/**
+ * The generation of r after s, mapped on first use. The caller
+ * holds the follow lock of r.
+ */
+ring_seg*
+gen_next(ring* r, ring_seg* s)
+{
+    auto next = s->next.load(std::memory_order_acquire);
+    if (!next) {
+        next = gen_open(r->name, seg_hdr(s)->next_gen.load(std::memory_order_acquire));
+        if (next)
+            s->next.store(next, std::memory_order_release);
+    }
+    return next;
+}
+
+}
+
+bool
+seg_name(char (&segname)[SEGM_NAMESIZE], char const* name, uint32_t gen)
+{
+    int len = gen == 0 ? snprintf(segname, sizeof(segname), SEGM_PREFIX "%s", name)
+                       : snprintf(segname, sizeof(segname), SEGM_PREFIX "%s.%u", name, gen);
+    return len >= 0 && static_cast<size_t>(len) < sizeof(segname);
+}
+
+bool
+varlen_gens(char const* name, ring_hdr const* h,
+            std::function<bool(ring_hdr* gen)> const& fn)
+{
+    for (uint32_t gen = h->next_gen.load(std::memory_order_acquire); gen; ) {
+        ring_seg* s = gen_open(name, gen);
+        if (!s)
+            return false;
+        bool more = fn(seg_hdr(s));
+        gen = seg_hdr(s)->next_gen.load(std::memory_order_acquire);
+        seg_close(s);
+        delete s;
+        if (!more)
+            return false;
+    }
+    return true;
+}
+
+bool
+hdr_queue_matches(ring_hdr const* h, ring_queue_desc const& d)
+{
+    return h->queue == d.kind && h->elemsz == d.elemsz && h->qsz == d.qsz;
+}
+
+bool
+hdr_elem_queue(ring_hdr const* h)
+{
+    return hdr_queue_matches(h, kElemQueue) || hdr_queue_matches(h, kTicketQueue);
+}
+
+ring_hdr*
+hdr_validate(ring_seg const* s, int retries)
+{
+    if (s->size < kHdrSz)
+        return nullptr;
+    auto h = static_cast<ring_hdr*>(s->addr);
+    for (int i = 0; h->magic.load(std::memory_order_acquire) != kRingMagic; i++) {
+        if (i == retries)
+            return nullptr;
+        usleep(100);
+    }
+    if (h->version != kRingVersion ||
+        h->segsz > s->size ||
+        h->qoff + h->qsz > h->loff ||
+        h->nlanes > RING_MAX_LANES ||
+        (h->nlanes && h->lanesz != kLaneSz) ||
+        h->loff + h->nlanes * h->lanesz > h->foff ||
+        h->foff + h->fsz > h->segsz)
+        return nullptr;
+    if ((h->flags & RING_F_BROADCAST) &&
+        (h->nslots == 0 || (h->nslots & (h->nslots - 1)) ||
+         h->boff < h->loff + h->nlanes * h->lanesz ||
+         h->boff + sizeof(ring_bcast) > h->soff ||
+         h->slotsz < sizeof(ring_slot) || h->slotsz % kLineSz ||
+         h->soff + h->nslots * h->slotsz > h->foff))
+        return nullptr;
+    if ((h->flags & RING_F_VARLEN) &&
+        (h->dsz < page_size() || (h->dsz & (h->dsz - 1)) || h->doff % page_size() ||
+         h->doff < h->foff + h->fsz || h->doff + h->dsz != h->segsz))
+        return nullptr;
+    return h;
+}
 
 extern "C"
 struct ring*
-ring_init(char const* name, size_t n, size_t elemsz)
+ring_init_attr(char const* name, size_t n, size_t elemsz,
+               struct ring_attr const* attr)
 {
+    unsigned flags = attr ? attr->flags : 0;
+    unsigned nlanes = attr ? attr->nlanes : 0;
+    int node = (flags & RING_F_NUMA) ? attr->node : -1;
+    if (nlanes > RING_MAX_LANES)
+        return fail(EINVAL);
+    /* Close to the budget of the host, new rings get fewer lanes,
+     * slots and record bytes than they ask for. The shared queue
+     * has a fixed size. */
+    budget_guard budget{attr && attr->owner ? attr->owner : name};
+    double scale = budget.scale();
+    /* Variable-length rings hold n bytes rounded up to a power of
+     * two pages. Huge pages would need the records 2MB aligned. */
+    if (flags & RING_F_VARLEN) {
+        if (n == 0 || nlanes > 0 || (flags & (RING_F_BROADCAST | RING_F_HUGEPAGES)))
+            return fail(EINVAL);
+        seg_geom const want{kVarlenDesc, 0, 0, 0, varlen_size(n)};
+        n = std::max<size_t>(n * scale, 1);
+        ring* r = ring_create(name, n, seg_geom{kVarlenDesc, 0, 0, 0, varlen_size(n)}, want,
+                              flags, construct_nothing, budget, node);
+        return stream_enable(r, attr);
+    }
     if(n > RING_CAPACITY)
-        return nullptr;
+        return fail(EINVAL);
 
-    char segname[SEGM_NAMESIZE];
-    snprintf(segname, sizeof(segname), "SEG4xRING_%s", name);
-    auto segment =
-        new bip::managed_shared_memory(bip::open_or_create,
-                                       segname,
-                                       RING_CAPACITY * elemsz * 8 + (1024 * 1024));
-    ring* r = (ring*) malloc(sizeof(*r));
-    snprintf(r->name, sizeof(r->name), "%s", name);
-    r->seg = static_cast<void*>(segment);
-    r->queue = segment->find_or_construct<ring_buffer>(r->name)();
-    assert(r->queue != nullptr);
+    /* Broadcast rings hold n records rounded up to a power of two */
+    size_t nslots = 0, want_slots = 0;
+    size_t slotsz = attr && attr->slotsz ? attr->slotsz : sizeof(ring_slot);
+    if (flags & RING_F_BROADCAST) {
+        if (n == 0 || nlanes > 0 || slotsz < sizeof(ring_slot) ||
+            slotsz % kLineSz || slotsz > kMaxSlotSz)
+            return fail(EINVAL);
+        for (want_slots = 1; want_slots < n; want_slots <<= 1)
+            ;
+        for (nslots = 1; nslots < std::max<size_t>(n * scale, 1); nslots <<= 1)
+            ;
+    }
 
-    return r;
+    /* Broadcast rings have a queue too; nothing goes through it */
+    bool ticket = (flags & RING_F_TICKET) && !(flags & RING_F_BROADCAST);
+    auto const& q = ticket ? kTicketQueue : kElemQueue;
+    seg_geom const want{q, nlanes, want_slots, slotsz, 0};
+    nlanes *= scale;
+    ring* r = ring_create(name, n, seg_geom{q, nlanes, nslots, slotsz, 0}, want, flags,
+                          ticket ? construct_ticket_queue : construct_elem_queue, budget, node);
+    return stream_enable(r, attr);
 }
 
 extern "C"
 struct ring*
-ring_lookup(char const* name)
+ring_init(char const* name, size_t n, size_t elemsz)
 {
-    char segname[SEGM_NAMESIZE];
-    snprintf(segname, sizeof(segname), "SEG4xRING_%s", name);
-    auto segment =
-        new bip::managed_shared_memory(bip::open_only, segname);
-    ring* r = (ring*) malloc(sizeof(*r));
-    snprintf(r->name, sizeof(r->name), "%s", name);
-    r->seg = static_cast<void*>(segment);
-    auto lookup_result = segment->find<ring_buffer>(r->name);
-    r->queue = lookup_result.first;
-    assert(r->queue != nullptr);
+    return ring_init_attr(name, n, elemsz, nullptr);
+}
 
-    return r;
+extern "C"
+struct ring*
+ring_lookup_group(char const* name, char const* group)
+{
+    return ring_attach(name, group, nullptr);
+}
+
+extern "C"
+struct ring*
+ring_lookup(char const* name)
+{
+    return ring_lookup_group(name, nullptr);
 }
 
 extern "C"
 int
 ring_free(struct ring* r)
 {
-    auto seg = static_cast<bip::managed_shared_memory*>(r->seg);
-    delete seg;
+    if (!r)
+        return 0;
+    auto s = static_cast<ring_seg*>(r->seg);
+    if (s->member >= 0)
+        bcast_detach(ring_hdr_of(r), s->member);
+    /* Variable-length rings: every generation the handle mapped */
+    while (s) {
+        auto next = s->next.load(std::memory_order_relaxed);
+        if (s->writer >= 0)
+            hdr_writer_remove(seg_hdr(s), s->writer);
+        seg_close(s);
+        delete s;
+        s = next;
+    }
     free(r);
     return 0;
 }
+
+int
+varlen_follow_wr(ring* r, ring_seg* s)
+{
+    auto first = ring_seg_of(r);
+    std::lock_guard<std::mutex> lock(first->follow);
+    if (varlen_wr(r) != s)
+        return 0;
+    auto next = gen_next(r, s);
+    if (!next)
+        return -1;
+    if (next->writer < 0 && (next->writer = hdr_writer_add(seg_hdr(next))) < 0)
+        return -1;
+    first->wr.store(next, std::memory_order_release);
+    /* Enqueues that picked s before the switch finish on it, then
+     * consumers may move on once they have read them */
+    while (s->inflight.load(std::memory_order_seq_cst))
+        sched_yield();
+    if (s->writer >= 0) {
+        hdr_writer_remove(seg_hdr(s), s->writer);
+        s->writer = -1;
+    }
+    return 0;
+}
+
+int
+varlen_follow_rd(ring* r, ring_seg* s)
+{
+    auto first = ring_seg_of(r);
+    std::lock_guard<std::mutex> lock(first->follow);
+    if (varlen_rd(r) != s)
+        return 0;
+    auto next = gen_next(r, s);
+    if (!next)
+        return -1;
+    first->rd.store(next, std::memory_order_release);
+    auto h = seg_hdr(s);
+    if (h->gen) {
+        /* The first generation stays, for ring_lookup() to find the
+         * others through; it skips those consumers are done with */
+        uint32_t gen = h->gen;
+        seg_hdr(first)->next_gen.compare_exchange_strong(
+            gen, h->next_gen.load(std::memory_order_acquire));
+        char segname[SEGM_NAMESIZE];
+        if (seg_name(segname, r->name, h->gen))
+            seg_unlink(segname);
+    }
+    return 0;
+}
+
+extern "C"
+int
+ring_resize(struct ring* r, size_t n)
+{
+    if (!(r->flags & RING_F_VARLEN) || n == 0)
+        return -1;
+    ring_seg* s;
+    ring_hdr* h;
+    while ((h = seg_hdr(s = varlen_wr(r)))->next_gen.load(std::memory_order_acquire))
+        if (varlen_follow_wr(r, s) != 0)
+            return -1;
+
+    /* One resize at a time; that of a producer that died midway is
+     * taken over, even if another process has its pid by now */
+    if (!writer_claim(h->resizer))
+        return -1;
+    if (h->next_gen.load(std::memory_order_acquire)) {
+        writer_release(h->resizer);
+        return -1;
+    }
+    budget_guard budget{ring_hdr_of(r)->owner_name};
+    n = std::max<size_t>(n * budget.scale(), 1);
+    auto next = gen_create(r->name, h->gen + 1, n,
+                           r->flags & (RING_F_PREFAULT | RING_F_MLOCK),
+                           h->node.load(std::memory_order_relaxed), budget);
+    if (!next) {
+        writer_release(h->resizer);
+        return -1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(ring_seg_of(r)->follow);
+        s->next.store(next, std::memory_order_release);
+    }
+    h->next_gen.store(h->gen + 1, std::memory_order_seq_cst);
+    /* Producers parked on a full ring and consumers on an empty
+     * one look again, and move on */
+    ring_wake(ring_hdr_of(r)->events[RING_EV_SPACE]);
+    ring_wake(ring_hdr_of(r)->events[RING_EV_DATA]);
+    return varlen_follow_wr(r, s);
+}
+
+extern "C"
+int
+ring_pool_keep(unsigned n)
+{
+    unsigned have = 0;
+    std::vector<std::string> extra;
+    spare_foreach([&](char const* path, bool ready) {
+        if (ready && ++have > n)
+            extra.push_back(path);
+    });
+    for (auto const& path : extra)
+        unlink(path.c_str());
+    have = std::min(have, n);
+
+    budget_guard budget{kPoolOwner};
+    seg_geom const g{kElemQueue, 0, 0, 0, 0};
+    for (; have < n; have++) {
+        ring_seg s;
+        std::string path;
+        if (spare_create(seg_size(g), RING_F_PREFAULT, &s, &path) != 0)
+            break;
+        bool fits = budget.fits();
+        if (fits)
+            hdr_init(&s, RING_CAPACITY, g, 0, construct_elem_queue);
+        seg_close(&s);
+        if (!fits || spare_publish(path) != 0) {
+            unlink(path.c_str());
+            break;
+        }
+    }
+    return have;
+}
+
+struct ring*
+ring_init_queue(char const* name, struct ring_attr const* attr,
+                ring_queue_desc const& d, void (*construct)(void* at))
+{
+    unsigned flags = attr ? attr->flags & (RING_F_HUGEPAGES | RING_F_PREFAULT | RING_F_MLOCK) : 0;
+    int node = attr && (attr->flags & RING_F_NUMA) ? attr->node : -1;
+    budget_guard budget{attr && attr->owner ? attr->owner : name};
+    seg_geom const g{d, 0, 0, 0, 0};
+    ring* r = ring_create(name, 0, g, g, flags, construct, budget, node);
+    return stream_enable(r, attr);
+}
+
+struct ring*
+ring_lookup_queue(char const* name, ring_queue_desc const& d)
+{
+    ring* r = ring_attach(name, nullptr, &d);
+    /* A typed handle has no way to read a broadcast ring, or the
+     * records producers put in lanes */
+    if (r && ((r->flags & RING_F_BROADCAST) || ring_hdr_of(r)->nlanes)) {
+        ring_free(r);
+        return nullptr;
+    }
+    return r;
+}
+
+void*
+ring_queue_of(struct ring const* r, ring_queue_desc const& d)
+{
+    auto h = ring_hdr_of(r);
+    if (!hdr_queue_matches(h, d) || h->nlanes || (h->flags & RING_F_BROADCAST))
+        return nullptr;
+    return r->queue;
+}
+
+ring_event*
+ring_events_of(struct ring const* r)
+{
+    return ring_hdr_of(r)->events;
+}
+
+std::atomic<uint32_t>*
+ring_seq_of(struct ring const* r)
+{
+    return &ring_hdr_of(r)->next_seq;
+}
@@ -1,13 +1,746 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <sys/types.h>
+
 #include <boost/lockfree/queue.hpp>
-#include <boost/interprocess/managed_shared_memory.hpp>  
+#include <boost/lockfree/spsc_queue.hpp>
 #include <boost/lockfree/policies.hpp>
 
-#include "ring_common.h"
+#include "ring.hpp"
+
+/// Cache line size, and the span that control words written by
+/// different cores are kept apart by: x86 L2 prefetchers pull in
+/// the adjacent line of every line they fetch.
+size_t const kLineSz = 64;
+size_t const kLinePairSz = 128;
+
+/* The shared queues of the C API. The node based Boost queue stays
+ * lock-free if a process dies in the middle of an operation, but
+ * costs two CAS per push and a pointer chase per record. Rings
+ * created with RING_F_TICKET hold the ticket queue instead; the
+ * header records which one in ring_hdr::queue. */
+using ring_buffer = mpl::ring<elem>::queue_type;
+using ring_ticket_buffer = mpl::ring<elem, RING_CAPACITY, mpl::ticket_policy>::queue_type;
+
+using ring_lane_buffer = boost::lockfree::spsc_queue<elem,
+                                                     boost::lockfree::capacity<RING_LANE_CAPACITY>
+                                                     >;
+
+/**
+ * A producer attached to a segment, by the pid and start time of its
+ * process, or 0 if the entry is free. A start time of 0 is not known
+ * yet, and only the pid is checked. Entries are written on every
+ * enqueue of a variable-length ring, so each has its lines to itself.
+ */
+struct alignas(kLinePairSz) ring_writer {
+    std::atomic<int32_t>    pid;
+    std::atomic<uint64_t>   start;
+    /// Variable-length rings: the enqueues of the producer that are
+    /// still writing to the segment.
+    std::atomic<uint32_t>   inflight;
+};
+
+/**
+ * A single-producer, single-consumer sub-ring. One producer thread
+ * holds it at a time; consumers take turns merging all lanes with
+ * the shared queue, see ring_hdr::drainer.
+ */
+struct ring_lane {
+    /// The process whose thread holds the lane.
+    ring_writer                         owner;
+    alignas(kLinePairSz) ring_lane_buffer   queue;
+};
+
+uint32_t const kRingMagic   = 0x524c504d;     /* "MPLR" */
+uint16_t const kRingVersion = 17;
+
+#define SEGM_PREFIX         "SEG4xRING_"
+
+/**
+ * Fixed layout at the start of every ring segment. The queue
+ * itself lives at offset qoff. A creator fills in the geometry
+ * and constructs the queue before publishing magic, so an
+ * attacher only has to map the segment and validate this header.
+ */
+struct ring_hdr {
+    std::atomic<uint32_t>   magic;
+    uint16_t                version;
+    uint16_t                flags;
+    /// The ring_queue_desc of the shared queue.
+    uint16_t                queue;
+    uint64_t                capacity;
+    uint64_t                elemsz;
+    uint64_t                segsz;
+    uint64_t                qoff;
+    uint64_t                qsz;
+    /// nlanes ring_lane structs of lanesz bytes start at loff.
+    uint32_t                nlanes;
+    uint64_t                lanesz;
+    uint64_t                loff;
+    /// Append-only table of format strings, fsz bytes at foff; see
+    /// ring_fmt.
+    uint64_t                foff;
+    uint64_t                fsz;
+    /// The producer that owns the ring. The start time tells a
+    /// live owner apart from a new process that reused its pid.
+    int32_t                 owner_pid;
+    uint64_t                owner_start;
+    /// The owner the budget of the host charges the segment to; see
+    /// ring_attr::owner.
+    char                    owner_name[RING_NAMESIZE];
+    /// When a sweep first found the owner dead with records
+    /// still queued (seconds since the epoch), or 0.
+    std::atomic<uint64_t>   orphaned_at;
+    /// Broadcast rings: a ring_bcast at boff and nslots
+    /// ring_slot structs of slotsz bytes at soff, or all 0.
+    uint64_t                boff;
+    uint64_t                soff;
+    uint64_t                nslots;
+    uint64_t                slotsz;
+    /// Variable-length rings: dsz bytes of records at doff, the
+    /// last region of the segment, or both 0.
+    uint64_t                doff;
+    uint64_t                dsz;
+    /// The lanes, broadcast slots and record bytes the creator asked
+    /// for, before the budget cut them down; see ring_init_attr().
+    /// A ring of the same name that asks for others does not attach.
+    uint32_t                want_lanes;
+    uint64_t                want_slots;
+    uint64_t                want_dsz;
+    /// Variable-length rings: the generation of this segment, 0 for
+    /// the one named after the ring, and that of the segment that
+    /// replaced it, or 0; see ring_resize(). The first generation
+    /// links to the oldest one that is left.
+    uint32_t                gen;
+    std::atomic<uint32_t>   next_gen;
+    /// The process that is creating the next generation, if any;
+    /// see writer_claim().
+    ring_writer             resizer;
+    /// The NUMA node the segment was placed on, or -1; see
+    /// ring_bind().
+    std::atomic<int32_t>    node;
+    /// The next elem::seq to hand out. Every producer writes it,
+    /// so it is kept off the geometry every consumer reads.
+    alignas(kLinePairSz) std::atomic<uint32_t>  next_seq;
+    /// Indexed by RING_EV_*.
+    ring_event              events[2];
+    /// Variable-length rings: records are reserved at vhead and
+    /// read at vtail, both byte offsets that grow without wrapping.
+    alignas(kLinePairSz) std::atomic<uint64_t>  vhead;
+    alignas(kLinePairSz) std::atomic<uint64_t>  vtail;
+    /// The producer handles attached to the segment, besides the
+    /// lanes. Consumers of a variable-length ring move on from this
+    /// generation once it is empty and none of them that is alive
+    /// has an enqueue in flight.
+    ring_writer             writers[RING_MAX_WRITERS];
+    /// Rings with lanes: the proc_token() of the consumer that is
+    /// draining them, or 0. Lanes have room for one consumer at a
+    /// time, so the others leave them alone meanwhile.
+    alignas(kLinePairSz) std::atomic<uint64_t>  drainer;
+    /// Rings with lanes: a record an ordered dequeue took off the
+    /// shared queue to compare with the lanes, which the next
+    /// dequeue hands out first. The drainer owns it.
+    bool                    has_pending;
+    elem                    pending;
+};
+
+/// ring_hdr::queue of variable-length rings, which have none.
+uint16_t const kVarlenQueue = 3;
+
+/**
+ * Header of a record of a variable-length ring, 8-byte aligned and
+ * followed by len bytes. size, the bytes up to the next record, is
+ * stored last; the consumer zeroes what it releases, so a record
+ * not committed yet reads as 0.
+ */
+struct ring_vrec {
+    std::atomic<uint32_t>   size;
+    uint32_t                len;
+};
+
+/**
+ * A slot of a broadcast ring. seq is one past the sequence number
+ * of the record held in e, 0 if the slot was never written, or
+ * kSlotBusy while a producer overwrites it. Slots start on a cache
+ * line, so that no two share one; ring_hdr::slotsz may space them
+ * further apart.
+ */
+struct alignas(kLineSz) ring_slot {
+    std::atomic<uint64_t>   seq;
+    elem                    e;
+};
+
+uint64_t const kSlotBusy = UINT64_MAX;
+
+/**
+ * A read position in a broadcast ring, shared by the members of a
+ * consumer group. Members claim up to kClaimBatch records at a time
+ * by moving claim forward; a private cursor is a group of one.
+ */
+struct alignas(kLinePairSz) ring_cursor {
+    /// Number of members, 0 if the cursor is free, or kCursorInit
+    /// while it is being set up.
+    std::atomic<uint32_t>   refs;
+    /// Empty for a private cursor.
+    char                    group[RING_GROUPNAMESIZE];
+    /// The first record no member has claimed yet.
+    std::atomic<uint64_t>   claim;
+};
+
+uint32_t const kCursorInit = UINT32_MAX;
+uint64_t const kClaimBatch = 64;
+uint64_t const kNoRange = UINT64_MAX;
+
+/**
+ * A consumer of a broadcast ring and the records it has claimed
+ * but not read yet, [pos, end), or kNoRange for both. The range
+ * lives in the segment so that the rest of the group takes over
+ * what a member that exited left unread.
+ */
+struct alignas(kLinePairSz) ring_member {
+    /// pid of the consumer, or 0 if the entry is free.
+    std::atomic<int32_t>    pid;
+    /// proc_starttime() of it, or 0 until it is known.
+    std::atomic<uint64_t>   start;
+    /// Index of the cursor it reads through.
+    std::atomic<int32_t>    cursor;
+    std::atomic<uint64_t>   pos;
+    std::atomic<uint64_t>   end;
+};
+
+/**
+ * Control block of a broadcast ring. Producers claim consecutive
+ * sequence numbers and write record s to slot s % nslots; every
+ * cursor sees all slots in order. A producer may not claim a
+ * sequence number that would overwrite a record some live cursor
+ * has yet to hand out or some member has yet to read, so the
+ * slowest consumer gates the ring.
+ */
+struct ring_bcast {
+    /// The next sequence number to claim.
+    alignas(kLinePairSz) std::atomic<uint64_t> claim;
+    /// Producers may claim below limit without looking at the
+    /// cursors; it is recomputed from them once reached.
+    alignas(kLinePairSz) std::atomic<uint64_t> limit;
+    ring_cursor                                 cursors[RING_MAX_CURSORS];
+    ring_member                                 members[RING_MAX_CONSUMERS];
+};
+
+/**
+ * An entry of the format table, followed by the nul terminated
+ * string. A registrar claims the entry by setting size, the bytes
+ * up to the next entry, where the table ends: at the first entry
+ * whose size is 0. len is published last, so an entry with len 0 is
+ * still being written, or was left by a registrar that died; either
+ * way it is skipped.
+ */
+struct ring_fmt {
+    std::atomic<uint32_t>   size;
+    std::atomic<uint32_t>   len;
+};
+
+/**
+ * @brief Check that the header of a mapped segment is published
+ * and that its geometry fits the mapping.
+ *
+ * @param retries How many 100us naps to wait for a concurrent
+ * creator to publish the header.
+ * @return The header, or nullptr if s is not a usable ring.
+ */
+ring_hdr*
+hdr_validate(struct ring_seg const* s, int retries);
+
+/**
+ * @brief Whether the shared queue of h has shape d.
+ */
+bool
+hdr_queue_matches(ring_hdr const* h, ring_queue_desc const& d);
+
+/**
+ * @brief Whether the shared queue of h is a ring_buffer or
+ * ring_ticket_buffer of the C API, rather than that of a ring<T>
+ * of another type.
+ */
+bool
+hdr_elem_queue(ring_hdr const* h);
+
+/**
+ * @brief The start time of process pid in clock ticks since
+ * boot, or 0 if there is no such process.
+ */
+uint64_t
+proc_starttime(pid_t pid);
+
+/**
+ * @brief Whether process pid is running and, unless start is 0,
+ * started at start rather than reused the pid of one that did.
+ */
+bool
+proc_alive(int32_t pid, uint64_t start);
+
+/**
+ * @brief A word that tells the calling process apart from any other,
+ * including one that reuses its pid later: the pid and the low bits
+ * of the start time.
+ */
+uint64_t
+proc_token();
+
+/**
+ * @brief Whether the process of proc_token() token is running. With
+ * full unset only the pid is checked, which saves reading procfs.
+ */
+bool
+token_alive(uint64_t token, bool full);
+
+/**
+ * @brief Take w for the calling process, unless a live process
+ * holds it.
+ *
+ * @return Whether it was taken.
+ */
+bool
+writer_claim(ring_writer& w);
+
+void
+writer_release(ring_writer& w);
+
+/**
+ * @brief Whether the owner recorded in h is still running.
+ */
+bool
+hdr_owner_alive(ring_hdr const* h);
+
+/**
+ * @brief Add the calling process to the writers of h, taking over
+ * the entry of a process that exited.
+ *
+ * @return The entry, or -1 if there is no free one.
+ */
+int
+hdr_writer_add(ring_hdr* h);
+
+inline void
+hdr_writer_remove(ring_hdr* h, int writer)
+{
+    writer_release(h->writers[writer]);
+}
+
+/**
+ * @brief The segment name of generation gen of ring name; 0 for the
+ * first one, named after the ring.
+ *
+ * @return false if it does not fit in SEGM_NAMESIZE.
+ */
+bool
+seg_name(char (&segname)[SEGM_NAMESIZE], char const* name, uint32_t gen);
+
+/**
+ * A shared memory segment mapped into this process. The segment
+ * lives either on a hugetlbfs mount or in /dev/shm.
+ */
+struct ring_seg {
+    void*       addr;
+    size_t      size;
+    /// Bytes mapped a second time right after the segment, see
+    /// seg_mirror().
+    size_t      mirror;
+    /// Identifies the file mapped.
+    ino_t       ino;
+    /// The name seg_create() set the segment up under, until
+    /// seg_publish().
+    std::string staged;
+    /// RING_F_* flags that took effect for this mapping.
+    unsigned    flags;
+    /// The lane a consumer looks at first on its next dequeue.
+    unsigned    next_lane;
+    /// Rings with lanes: proc_token() of this process, and how many
+    /// dequeues in a row found the lanes held by a live drainer.
+    uint64_t    token = 0;
+    unsigned    skipped = 0;
+    /// Producers of this handle copy records of at least this many
+    /// bytes with ring_copy_stream(), or 0.
+    size_t      stream_min = 0;
+    /// Where entries of the format table start, one bit for every
+    /// alignof(ring_fmt) bytes, as far as the handle has walked the
+    /// table: fmt_walked bytes. Entries never move.
+    std::unique_ptr<std::atomic<uint64_t>[]>    fmt_starts;
+    std::atomic<uint64_t>   fmt_walked{0};
+    std::mutex              fmt_walk;
+    /// The ring_member this handle reads a broadcast ring as,
+    /// or -1.
+    int         member = -1;
+    /// The writers entry of this producer handle, or -1, and on
+    /// variable-length rings how many of its enqueues are still
+    /// writing.
+    std::atomic<int>        writer{-1};
+    std::atomic<unsigned>   inflight;
+    /// The next generation, once this handle has mapped it. All of
+    /// them stay mapped until ring_free().
+    std::atomic<ring_seg*>  next;
+    /// In the first generation: the ones this handle reads from and
+    /// writes to, nullptr for this one, and what guards moving them.
+    std::atomic<ring_seg*>  rd;
+    std::atomic<ring_seg*>  wr;
+    std::mutex              follow;
+};
+
+inline ring_seg*
+ring_seg_of(struct ring const* r)
+{
+    return static_cast<ring_seg*>(r->seg);
+}
+
+inline ring_hdr*
+seg_hdr(ring_seg const* s)
+{
+    return static_cast<ring_hdr*>(s->addr);
+}
+
+inline ring_hdr*
+ring_hdr_of(struct ring const* r)
+{
+    return seg_hdr(ring_seg_of(r));
+}
+
+inline ring_lane*
+ring_lane_of(struct ring const* r, unsigned lane)
+{
+    auto h = ring_hdr_of(r);
+    return reinterpret_cast<ring_lane*>(
+        reinterpret_cast<char*>(h) + h->loff + lane * h->lanesz);
+}
+
+inline ring_bcast*
+ring_bcast_of(ring_hdr* h)
+{
+    return reinterpret_cast<ring_bcast*>(reinterpret_cast<char*>(h) + h->boff);
+}
+
+inline ring_slot*
+ring_slot_of(ring_hdr* h, uint64_t seq)
+{
+    return reinterpret_cast<ring_slot*>(
+        reinterpret_cast<char*>(h) + h->soff + (seq & (h->nslots - 1)) * h->slotsz);
+}
+
+/**
+ * @brief Add the calling process as a consumer of broadcast ring
+ * h. It joins the cursor of the named consumer group, or a private
+ * cursor if group is NULL or empty; a new cursor starts at the
+ * oldest record still in the ring. Entries of processes that have
+ * exited are taken over.
+ *
+ * @return The member index, or -1 if there is no free cursor or
+ * member entry.
+ */
+int
+bcast_attach(ring_hdr* h, char const* group);
+
+/**
+ * @brief Remove a member added with bcast_attach(). Records it
+ * claimed but did not read are dropped.
+ */
+void
+bcast_detach(ring_hdr* h, int member);
+
+/**
+ * @brief Write e to the next slot of broadcast ring h.
+ *
+ * @return 0, or -1 if the slowest consumer has not read the
+ * record in that slot yet.
+ */
+int
+bcast_enqueue(ring_hdr* h, elem const& e);
+
+/**
+ * @brief Copy up to n records into out, reading the range member
+ * has claimed and claiming new ones as it runs out. A member that
+ * producers lapped skips ahead to the oldest record left.
+ *
+ * @return The number of records copied.
+ */
+size_t
+bcast_read(ring_hdr* h, int member, elem* out, size_t n);
+
+/**
+ * @brief Whether the live consumers of broadcast ring h have read
+ * all records.
+ */
+bool
+bcast_drained(ring_hdr* h);
+
+/**
+ * @brief Copy e as a record into the generation of variable-length
+ * ring r that its producers write to.
+ *
+ * @return 0, or -1 if there is not enough room.
+ */
+int
+varlen_enqueue(struct ring* r, elem const& e);
+
+/**
+ * @brief Copy up to n records of variable-length ring r into out,
+ * each cut or zero-filled to sizeof(elem). Consumers move on to the
+ * next generation once they are done with the one they read.
+ *
+ * @return The number of records copied.
+ */
+size_t
+varlen_dequeue(struct ring* r, elem* out, size_t n);
+
+/**
+ * @brief Whether variable-length ring generation h holds no records.
+ */
+bool
+varlen_empty(ring_hdr* h);
+
+/**
+ * @brief Whether consumers are done with variable-length ring
+ * generation h: it was replaced, no producer is left on it and it
+ * is empty.
+ */
+bool
+varlen_retired(ring_hdr* h);
+
+/**
+ * @brief Call fn with the header of every generation of variable-
+ * length ring name after the one of h that is left, in order, until
+ * it returns false.
+ *
+ * @return false if fn did, or a generation cannot be mapped.
+ */
+bool
+varlen_gens(char const* name, ring_hdr const* h,
+            std::function<bool(ring_hdr* gen)> const& fn);
+
+/**
+ * @brief The generation of variable-length ring r that producers of
+ * the handle write to, or that its consumers read from.
+ */
+ring_seg*
+varlen_wr(struct ring const* r);
+
+ring_seg*
+varlen_rd(struct ring const* r);
+
+/**
+ * @brief Move producers of r on from generation s to the next one,
+ * once enqueues of this process that are still writing to s finish.
+ *
+ * @return 0, or -1 if the next generation cannot be mapped or has
+ * no free writers entry.
+ */
+int
+varlen_follow_wr(struct ring* r, ring_seg* s);
+
+/**
+ * @brief Move consumers of r on from retired generation s to the
+ * next one. s is removed unless it is the first generation.
+ *
+ * @return 0, or -1 if the next generation cannot be mapped.
+ */
+int
+varlen_follow_rd(struct ring* r, ring_seg* s);
+
+/**
+ * @brief Have producers of r stream their records into it if attr
+ * asks for RING_F_STREAM and the CPU can.
+ *
+ * @return r.
+ */
+struct ring*
+stream_enable(struct ring* r, struct ring_attr const* attr);
+
+/**
+ * @brief Whether producers of r copy a record of len bytes into it
+ * with ring_copy_stream().
+ */
+inline bool
+ring_streams(struct ring const* r, size_t len)
+{
+    size_t min = ring_seg_of(r)->stream_min;
+    return min && len >= min;
+}
+
+/**
+ * @brief ring_notify() event ev of h.
+ */
+inline void
+ring_notify(ring_hdr* h, unsigned ev)
+{
+    ring_notify(h->events[ev]);
+}
+
+/**
+ * @brief Map the segment named segname, creating it with the given
+ * size if it does not exist yet.
+ *
+ * A segment this call creates is out of sight of seg_open() under a
+ * name of its own, recorded in s->staged, until seg_publish() gives
+ * it segname. Until then nobody else maps it half set up.
+ *
+ * @param created Set to true if this call created the segment.
+ * @param node The NUMA node to place a new segment on, or -1.
+ * @return 0 on success, -1 on failure.
+ */
+int
+seg_create(char const* segname, size_t size, unsigned flags,
+           ring_seg* s, bool* created, int node = -1);
+
+/**
+ * @brief Rename the segment seg_create() made for s to segname,
+ * unless a segment of that name exists by now.
+ *
+ * @return 0 on success, -1 with errno set to EEXIST if another
+ * creator came first. The staged segment is gone either way.
+ */
+int
+seg_publish(char const* segname, ring_seg* s);
+
+/**
+ * @brief Map an existing segment named segname.
+ *
+ * @return 0 on success, -1 if no such segment exists.
+ */
+int
+seg_open(char const* segname, unsigned flags, ring_seg* s);
+
+/**
+ * @brief Remove the segment named segname from whichever
+ * filesystem backs it.
+ */
+void
+seg_unlink(char const* segname);
+
+/**
+ * @brief The size of the segment named segname, or 0 if there is
+ * none.
+ */
+size_t
+seg_bytes(char const* segname);
+
+/**
+ * @brief Map the last len bytes of the segment a second time, right
+ * after the segment, so that they can be read and written across
+ * their end. Both must be page aligned.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int
+seg_mirror(char const* segname, ring_seg* s, size_t len);
+
+void
+seg_close(ring_seg* s);
+
+/**
+ * @brief Prefer NUMA node node for the pages of [addr, addr + size)
+ * of a shared segment, in every process that maps it. With move,
+ * pages already faulted in elsewhere are moved there too.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int
+seg_bind(void* addr, size_t size, int node, bool move);
+
+/**
+ * @brief Call fn with the name of every ring segment on this host.
+ */
+void
+seg_foreach(std::function<void(char const* segname)> const& fn);
+
+/**
+ * @brief Create and map a spare segment of size bytes in the pool,
+ * under a name claimers skip until spare_publish().
+ *
+ * @param path Set to the path of the segment.
+ * @return 0 on success, -1 on failure.
+ */
+int
+spare_create(size_t size, unsigned flags, ring_seg* s, std::string* path);
+
+/**
+ * @brief Make the spare segment at path, set up by spare_create(),
+ * available to spare_claim().
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int
+spare_publish(std::string const& path);
+
+/**
+ * @brief Move a spare segment from the pool to segname, unless a
+ * segment of that name exists.
+ *
+ * @return 0 on success, -1 if the pool is empty or segname is
+ * taken.
+ */
+int
+spare_claim(char const* segname);
+
+/**
+ * @brief Call fn with the path of every segment in the pool, and
+ * whether it is published yet.
+ */
+void
+spare_foreach(std::function<void(char const* path, bool ready)> const& fn);
+
+/**
+ * The shared memory budget of this host, read from the file named
+ * by MPL_SHM_BUDGET or /etc/mpl/shm_budget, which new segments are
+ * charged against. Creators of segments on the host take turns
+ * while a budget is in force and a guard holds it.
+ */
+class budget_guard {
+public:
+    /// The budget for creating segments charged to owner.
+    explicit budget_guard(char const* owner);
+    ~budget_guard();
+    budget_guard(budget_guard const&) = delete;
+    budget_guard& operator=(budget_guard const&) = delete;
+
+    /**
+     * How much of the size it asks for a new ring gets: 1 unless the
+     * host is past the shrink mark of its limit, and less the
+     * closer it gets to the limit.
+     */
+    double
+    scale() const;
+
+    /**
+     * Whether the segments on the host fit in its limit and in the
+     * quota of the owner, counting segname, if given, as one just
+     * created for the owner whose header is not written yet.
+     */
+    bool
+    fits(char const* segname = nullptr);
+
+    /// The owner new segments are charged to.
+    char const*
+    owner() const
+    {
+        return owner_.c_str();
+    }
 
+private:
+    void
+    measure(char const* segname = nullptr);
 
-using ring_buffer = boost::lockfree::queue<elem,
-                                           boost::lockfree::capacity<RING_CAPACITY>,
-                                           boost::lockfree::fixed_sized<true>
-                                           >;
+    std::string owner_;
+    /// Bytes of segments on the host and of the owner, 0 for no limit.
+    size_t      limit_ = 0;
+    size_t      quota_ = 0;
+    /// Percent of the limit past which new rings get smaller.
+    unsigned    shrink_ = 100;
+    /// Bytes in use, as of the last measure().
+    size_t      host_ = 0;
+    size_t      owned_ = 0;
+    /// The lock file, held while the budget is in force.
+    int         fd_ = -1;
+};
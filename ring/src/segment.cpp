@@ -0,0 +1,401 @@
+#include "ring_lcl.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <mntent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE    1
+#endif
+
+namespace {
+
+size_t const kHugePageSz = 2 * 1024 * 1024;
+/// Spare segments wait here, out of sight of shm_open() and
+/// seg_foreach(), until a creator renames one to the name of its
+/// ring. Those whose name starts with '.' are still being set up.
+char const* const kPoolDir = RING_POOL_DIR;
+
+/**
+ * The directory of a hugetlbfs mount with 2MB pages, or an empty
+ * string if there is none. MPL_HUGETLBFS overrides the lookup.
+ */
+std::string const&
+hugetlbfs_dir()
+{
+    static std::string const dir = [] {
+        if (char const* env = getenv("MPL_HUGETLBFS"))
+            return std::string{env};
+        std::string found;
+        FILE* mnts = setmntent("/proc/mounts", "r");
+        if (!mnts)
+            return found;
+        while (mntent* m = getmntent(mnts)) {
+            if (strcmp(m->mnt_type, "hugetlbfs") != 0)
+                continue;
+            char const* psz = hasmntopt(m, "pagesize");
+            if (psz && strncmp(psz, "pagesize=2M", 11) != 0)
+                continue;
+            found = m->mnt_dir;
+            break;
+        }
+        endmntent(mnts);
+        return found;
+    }();
+    return dir;
+}
+
+std::string
+hugetlbfs_path(char const* segname)
+{
+    return hugetlbfs_dir() + "/" + segname;
+}
+
+/**
+ * Fault in every page of [addr, addr + size) for writing without
+ * changing its contents.
+ *
+ * @return 0, or -1 if there is no memory left to back them.
+ */
+int
+seg_prefault(void* addr, size_t size)
+{
+    if (madvise(addr, size, MADV_POPULATE_WRITE) == 0)
+        return 0;
+    /* Touching them would raise SIGBUS instead; kernels before 5.14
+     * know no MADV_POPULATE_WRITE and fail with EINVAL */
+    if (errno != EINVAL)
+        return -1;
+    size_t const pgsz = sysconf(_SC_PAGESIZE);
+    auto p = static_cast<char*>(addr);
+    for (size_t off = 0; off < size; off += pgsz)
+        __atomic_fetch_add(p + off, 0, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * Fault in and lock a mapping as flags ask, recording in s what took
+ * effect.
+ *
+ * @return 0, or -1 with errno set if RING_F_MLOCK was asked for and
+ * the pages cannot be faulted in or locked.
+ */
+int
+seg_pin(void* addr, size_t size, unsigned flags, ring_seg* s)
+{
+    if (flags & RING_F_MLOCK) {
+        /* mlock() faults the pages in as well */
+        if (mlock(addr, size) != 0)
+            return -1;
+        s->flags |= RING_F_MLOCK | RING_F_PREFAULT;
+    } else if ((flags & RING_F_PREFAULT) && seg_prefault(addr, size) == 0) {
+        s->flags |= RING_F_PREFAULT;
+    }
+    return 0;
+}
+
+int
+seg_map(int fd, size_t size, unsigned flags, ring_seg* s, int node = -1)
+{
+    struct stat st;
+    s->ino = fstat(fd, &st) == 0 ? st.st_ino : 0;
+    s->mirror = 0;
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return -1;
+    if ((flags & RING_F_HUGEPAGES) && !(s->flags & RING_F_HUGEPAGES))
+        madvise(addr, size, MADV_HUGEPAGE);
+    /* Before the first page is touched, so that none has to move */
+    if (node >= 0 && seg_bind(addr, size, node, false) == 0)
+        s->flags |= RING_F_NUMA;
+    if (seg_pin(addr, size, flags, s) != 0) {
+        int err = errno;
+        munmap(addr, size);
+        errno = err;
+        return -1;
+    }
+    s->addr = addr;
+    s->size = size;
+    return 0;
+}
+
+int
+seg_size(int fd, size_t* size)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return -1;
+    *size = st.st_size;
+    return 0;
+}
+
+}
+
+int
+seg_open(char const* segname, unsigned flags, ring_seg* s)
+{
+    size_t size;
+    int fd = -1;
+
+    s->flags = 0;
+    if (!hugetlbfs_dir().empty()) {
+        fd = open(hugetlbfs_path(segname).c_str(), O_RDWR);
+        if (fd >= 0)
+            s->flags |= RING_F_HUGEPAGES;
+    }
+    if (fd < 0)
+        fd = shm_open(segname, O_RDWR, 0666);
+    if (fd < 0)
+        return -1;
+    if (seg_size(fd, &size) != 0) {
+        close(fd);
+        return -1;
+    }
+    return seg_map(fd, size, flags, s);
+}
+
+int
+seg_create(char const* segname, size_t size, unsigned flags,
+           ring_seg* s, bool* created, int node)
+{
+    static std::atomic<unsigned> seq;
+    *created = false;
+    if (seg_open(segname, flags, s) == 0)
+        return 0;
+
+    /* Nobody may map it under segname before its header is written,
+     * so it is set up under a name of its own until seg_publish() */
+    char staged[SEGM_NAMESIZE];
+    snprintf(staged, sizeof(staged), SEGM_PREFIX ".new.%d.%u", getpid(), seq++);
+    s->flags = 0;
+    if ((flags & RING_F_HUGEPAGES) && !hugetlbfs_dir().empty()) {
+        auto path = hugetlbfs_path(staged);
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+        size_t hsize = (size + kHugePageSz - 1) & ~(kHugePageSz - 1);
+        if (fd >= 0) {
+            s->flags |= RING_F_HUGEPAGES;
+            if (ftruncate(fd, hsize) != 0) {
+                close(fd);
+            } else if (seg_map(fd, hsize, flags, s, node) == 0) {
+                s->staged = staged;
+                *created = true;
+                return 0;
+            }
+            /* No huge pages left in the pool; use normal pages */
+            unlink(path.c_str());
+            s->flags = 0;
+        }
+    }
+
+    int fd = shm_open(staged, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(staged);
+        return -1;
+    }
+    if (seg_map(fd, size, flags, s, node) != 0) {
+        shm_unlink(staged);
+        return -1;
+    }
+    s->staged = staged;
+    *created = true;
+    return 0;
+}
+
+int
+seg_publish(char const* segname, ring_seg* s)
+{
+    std::string dir = (s->flags & RING_F_HUGEPAGES) ? hugetlbfs_dir() : "/dev/shm";
+    std::string from = dir + "/" + s->staged;
+    std::string to = dir + "/" + segname;
+    s->staged.clear();
+    /* Whoever renames first creates the ring; the others attach */
+    if (syscall(SYS_renameat2, AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(),
+                RENAME_NOREPLACE) == 0)
+        return 0;
+    int err = errno;
+    unlink(from.c_str());
+    errno = err;
+    return -1;
+}
+
+void
+seg_unlink(char const* segname)
+{
+    if (!hugetlbfs_dir().empty())
+        unlink(hugetlbfs_path(segname).c_str());
+    shm_unlink(segname);
+}
+
+size_t
+seg_bytes(char const* segname)
+{
+    struct stat st;
+    if (!hugetlbfs_dir().empty() && stat(hugetlbfs_path(segname).c_str(), &st) == 0)
+        return st.st_size;
+    std::string path = std::string{"/dev/shm/"} + segname;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+int
+seg_mirror(char const* segname, ring_seg* s, size_t len)
+{
+    int fd = (s->flags & RING_F_HUGEPAGES) ? open(hugetlbfs_path(segname).c_str(), O_RDWR)
+                                           : shm_open(segname, O_RDWR, 0666);
+    if (fd < 0)
+        return -1;
+    /* The name may have been taken over since it was mapped */
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_ino != s->ino ||
+        static_cast<size_t>(st.st_size) != s->size) {
+        close(fd);
+        return -1;
+    }
+    /* Reserve room for both, then map the file over it twice */
+    auto base = static_cast<char*>(mmap(nullptr, s->size + len, PROT_NONE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                        -1, 0));
+    if (base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    bool ok = mmap(base, s->size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+              mmap(base + s->size, len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED, fd, s->size - len) != MAP_FAILED;
+    close(fd);
+    if (!ok) {
+        munmap(base, s->size + len);
+        return -1;
+    }
+    /* The pages stay; the page tables and locks of the old
+     * mapping go with it */
+    unsigned pinned = s->flags & (RING_F_PREFAULT | RING_F_MLOCK);
+    s->flags &= ~pinned;
+    if (seg_pin(base, s->size + len, pinned, s) != 0) {
+        munmap(base, s->size + len);
+        s->flags |= pinned;
+        return -1;
+    }
+    munmap(s->addr, s->size);
+    s->addr = base;
+    s->mirror = len;
+    return 0;
+}
+
+void
+seg_close(ring_seg* s)
+{
+    munmap(s->addr, s->size + s->mirror);
+}
+
+int
+spare_create(size_t size, unsigned flags, ring_seg* s, std::string* path)
+{
+    static std::atomic<unsigned> seq;
+    if (mkdir(kPoolDir, 0777) == 0)
+        chmod(kPoolDir, 0777);
+    else if (errno != EEXIST)
+        return -1;
+    char name[64];
+    snprintf(name, sizeof(name), "/.spare.%d.%u", getpid(), seq++);
+    *path = std::string{kPoolDir} + name;
+    int fd = open(path->c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd < 0)
+        return -1;
+    s->flags = 0;
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        unlink(path->c_str());
+        return -1;
+    }
+    if (seg_map(fd, size, flags, s) != 0) {
+        unlink(path->c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int
+spare_publish(std::string const& path)
+{
+    auto slash = path.rfind('/');
+    auto to = path.substr(0, slash + 1) + path.substr(slash + 2);
+    return rename(path.c_str(), to.c_str());
+}
+
+int
+spare_claim(char const* segname)
+{
+    DIR* d = opendir(kPoolDir);
+    if (!d)
+        return -1;
+    std::string to = std::string{"/dev/shm/"} + segname;
+    int rc = -1;
+    while (dirent* de = readdir(d)) {
+        if (de->d_name[0] == '.')
+            continue;
+        std::string from = std::string{kPoolDir} + "/" + de->d_name;
+        /* Whoever renames it first has it; the name of the ring may
+         * be taken in the meantime */
+        if (syscall(SYS_renameat2, AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(),
+                    RENAME_NOREPLACE) == 0) {
+            rc = 0;
+            break;
+        }
+        if (errno != ENOENT)
+            break;
+    }
+    closedir(d);
+    return rc;
+}
+
+void
+spare_foreach(std::function<void(char const* path, bool ready)> const& fn)
+{
+    DIR* d = opendir(kPoolDir);
+    if (!d)
+        return;
+    while (dirent* de = readdir(d)) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        std::string path = std::string{kPoolDir} + "/" + de->d_name;
+        fn(path.c_str(), de->d_name[0] != '.');
+    }
+    closedir(d);
+}
+
+void
+seg_foreach(std::function<void(char const* segname)> const& fn)
+{
+    size_t const plen = strlen(SEGM_PREFIX);
+    for (auto const& dir : {std::string{"/dev/shm"}, hugetlbfs_dir()}) {
+        if (dir.empty())
+            continue;
+        DIR* d = opendir(dir.c_str());
+        if (!d)
+            continue;
+        while (dirent* de = readdir(d))
+            if (strncmp(de->d_name, SEGM_PREFIX, plen) == 0)
+                fn(de->d_name);
+        closedir(d);
+    }
+}
@@ -0,0 +1,139 @@
+#include "ring_lcl.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/// Records smaller than this are copied with regular stores unless
+/// ring_attr::stream_min says otherwise: two cache lines.
+size_t const kStreamMin = 2 * kLineSz;
+
+#if defined(__x86_64__)
+
+using copy_fn = void (*)(void* dst, void const* src, size_t n);
+
+inline void
+stream8(char*& d, char const*& s, size_t& n)
+{
+    long long v;
+    memcpy(&v, s, sizeof(v));
+    _mm_stream_si64(reinterpret_cast<long long*>(d), v);
+    d += 8;
+    s += 8;
+    n -= 8;
+}
+
+/**
+ * Bring d up to an 8-byte boundary with regular stores, then up to
+ * an align-byte one with 8-byte non-temporal stores.
+ */
+inline void
+stream_head(char*& d, char const*& s, size_t& n, uintptr_t align)
+{
+    size_t lead = std::min<size_t>(-reinterpret_cast<uintptr_t>(d) & 7, n);
+    memcpy(d, s, lead);
+    d += lead;
+    s += lead;
+    n -= lead;
+    while (n >= 8 && reinterpret_cast<uintptr_t>(d) & (align - 1))
+        stream8(d, s, n);
+}
+
+/// What is left after the aligned stores.
+inline void
+stream_tail(char* d, char const* s, size_t n)
+{
+    if (n >= 16) {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d),
+                         _mm_loadu_si128(reinterpret_cast<__m128i const*>(s)));
+        d += 16;
+        s += 16;
+        n -= 16;
+    }
+    while (n >= 8)
+        stream8(d, s, n);
+    memcpy(d, s, n);
+}
+
+void
+copy_sse2(void* dst, void const* src, size_t n)
+{
+    auto d = static_cast<char*>(dst);
+    auto s = static_cast<char const*>(src);
+    stream_head(d, s, n, 16);
+    for (; n >= 16; d += 16, s += 16, n -= 16)
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d),
+                         _mm_loadu_si128(reinterpret_cast<__m128i const*>(s)));
+    stream_tail(d, s, n);
+    _mm_sfence();
+}
+
+__attribute__((target("avx2")))
+void
+copy_avx2(void* dst, void const* src, size_t n)
+{
+    auto d = static_cast<char*>(dst);
+    auto s = static_cast<char const*>(src);
+    stream_head(d, s, n, 16);
+    if (n >= 16 && reinterpret_cast<uintptr_t>(d) & 16) {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d),
+                         _mm_loadu_si128(reinterpret_cast<__m128i const*>(s)));
+        d += 16;
+        s += 16;
+        n -= 16;
+    }
+    for (; n >= 32; d += 32, s += 32, n -= 32)
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(d),
+                            _mm256_loadu_si256(reinterpret_cast<__m256i const*>(s)));
+    stream_tail(d, s, n);
+    _mm_sfence();
+}
+
+copy_fn
+pick_copy()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? copy_avx2 : copy_sse2;
+}
+
+#endif
+
+}
+
+extern "C"
+void
+ring_copy_stream(void* dst, void const* src, size_t n)
+{
+#if defined(__x86_64__)
+    static copy_fn const copy = pick_copy();
+    copy(dst, src, n);
+#else
+    memcpy(dst, src, n);
+#endif
+}
+
+ring*
+stream_enable(ring* r, ring_attr const* attr)
+{
+#if defined(__x86_64__)
+    /* Broadcast slots are written in place, and the Boost queue
+     * copies records into nodes of its own */
+    if (r && attr && (attr->flags & RING_F_STREAM) && !(r->flags & RING_F_BROADCAST) &&
+        (r->flags & (RING_F_TICKET | RING_F_VARLEN))) {
+        ring_seg_of(r)->stream_min = attr->stream_min ? attr->stream_min : kStreamMin;
+        r->flags |= RING_F_STREAM;
+    }
+#endif
+    return r;
+}
+
+size_t
+ring_stream_of(struct ring const* r)
+{
+    return ring_seg_of(r)->stream_min;
+}
@@ -0,0 +1,29 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include <ring.h>
+
+/**
+ * Removes ring segments left behind by dead producers.
+ *
+ * Usage: ring_sweeper [grace_sec] [interval_sec]
+ *
+ * Undrained rings of dead producers are kept for grace_sec
+ * (default 600) so that consumers can still drain them. With
+ * an interval_sec of 0 (the default) it sweeps once and exits.
+ */
+int main(int argc, char* argv[])
+{
+    unsigned grace = argc > 1 ? strtoul(argv[1], nullptr, 10) : 600;
+    unsigned interval = argc > 2 ? strtoul(argv[2], nullptr, 10) : 0;
+
+    do {
+        int n = ring_sweep(grace);
+        if (n > 0)
+            printf("Reclaimed %d orphaned ring segments\n", n);
+    } while (interval && sleep(interval) == 0);
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+#include "ring_lcl.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+/// Records start 8-byte aligned.
+size_t const kRecAlign = 8;
+
+size_t
+rec_size(size_t len)
+{
+    return (sizeof(ring_vrec) + len + kRecAlign - 1) & ~(kRecAlign - 1);
+}
+
+/**
+ * The record at byte offset pos. The records are mapped twice back
+ * to back, so one that starts near the end runs on into the second
+ * mapping.
+ */
+ring_vrec*
+vrec_at(ring_hdr* h, uint64_t pos)
+{
+    return reinterpret_cast<ring_vrec*>(
+        reinterpret_cast<char*>(h) + h->doff + (pos & (h->dsz - 1)));
+}
+
+void*
+reserve(ring_hdr* h, size_t len)
+{
+    size_t need = rec_size(len);
+    if (need > h->dsz)
+        return nullptr;
+    uint64_t head = h->vhead.load(std::memory_order_relaxed);
+    do {
+        if (head + need - h->vtail.load(std::memory_order_acquire) > h->dsz)
+            return nullptr;
+    } while (!h->vhead.compare_exchange_weak(head, head + need, std::memory_order_relaxed));
+    auto rec = vrec_at(h, head);
+    rec->len = len;
+    return rec + 1;
+}
+
+void
+commit(void* p)
+{
+    auto rec = static_cast<ring_vrec*>(p) - 1;
+    rec->size.store(rec_size(rec->len), std::memory_order_release);
+}
+
+ring_vrec*
+peek(ring_hdr* h)
+{
+    auto rec = vrec_at(h, h->vtail.load(std::memory_order_relaxed));
+    return rec->size.load(std::memory_order_acquire) ? rec : nullptr;
+}
+
+/**
+ * Zero the oldest record, so that the next lap finds its bytes
+ * uncommitted, and hand its room back to the producers.
+ */
+void
+release(ring_hdr* h, ring_vrec* rec)
+{
+    size_t size = rec->size.load(std::memory_order_relaxed);
+    memset(static_cast<void*>(rec), 0, size);
+    h->vtail.fetch_add(size, std::memory_order_release);
+}
+
+/**
+ * Add the handle r as a producer of generation s, which it writes
+ * to, on its first enqueue there.
+ */
+int
+join(ring* r, ring_seg* s)
+{
+    if (s->writer.load(std::memory_order_acquire) >= 0)
+        return 0;
+    std::lock_guard<std::mutex> lock(ring_seg_of(r)->follow);
+    if (s->writer.load(std::memory_order_relaxed) < 0)
+        s->writer.store(hdr_writer_add(seg_hdr(s)), std::memory_order_release);
+    return s->writer.load(std::memory_order_relaxed) >= 0 ? 0 : -1;
+}
+
+/**
+ * The generation of r to write to, with one more enqueue in flight
+ * on it, both in the handle and in its writers entry; see wr_exit().
+ * A producer that finds its generation replaced moves on first.
+ */
+ring_seg*
+wr_enter(ring* r)
+{
+    for (;;) {
+        auto s = varlen_wr(r);
+        if (join(r, s) != 0)
+            return nullptr;
+        /* Pairs with varlen_follow_wr(): either it sees us in
+         * flight and keeps the writers entry of the handle, or we
+         * see the next generation */
+        s->inflight.fetch_add(1, std::memory_order_seq_cst);
+        auto h = seg_hdr(s);
+        if (h->next_gen.load(std::memory_order_seq_cst) == 0) {
+            /* Likewise with varlen_retired(), which reads next_gen
+             * before the writers */
+            auto& w = h->writers[s->writer.load(std::memory_order_relaxed)];
+            w.inflight.fetch_add(1, std::memory_order_seq_cst);
+            if (h->next_gen.load(std::memory_order_seq_cst) == 0)
+                return s;
+            w.inflight.fetch_sub(1, std::memory_order_release);
+        }
+        s->inflight.fetch_sub(1, std::memory_order_release);
+        if (varlen_follow_wr(r, s) != 0)
+            return nullptr;
+    }
+}
+
+void
+wr_exit(ring_seg* s)
+{
+    /* The writers entry goes once the handle has nothing in flight */
+    seg_hdr(s)->writers[s->writer.load(std::memory_order_relaxed)].inflight.fetch_sub(
+        1, std::memory_order_release);
+    s->inflight.fetch_sub(1, std::memory_order_release);
+}
+
+/// The generation of r that p was reserved in.
+ring_seg*
+seg_holding(ring* r, void* p)
+{
+    auto c = static_cast<char*>(p);
+    for (auto s = ring_seg_of(r); s; s = s->next.load(std::memory_order_acquire)) {
+        auto a = static_cast<char*>(s->addr);
+        if (c >= a && c < a + s->size + s->mirror)
+            return s;
+    }
+    return nullptr;
+}
+
+/**
+ * The oldest record of r and the generation h it is in, moving on
+ * to the next generation once the one it reads from is retired.
+ */
+ring_vrec*
+peek_rd(ring* r, ring_hdr*& h)
+{
+    for (;;) {
+        auto s = varlen_rd(r);
+        h = seg_hdr(s);
+        if (auto rec = peek(h))
+            return rec;
+        if (!varlen_retired(h) || varlen_follow_rd(r, s) != 0)
+            return nullptr;
+    }
+}
+
+}
+
+int
+varlen_enqueue(ring* r, elem const& e)
+{
+    auto s = wr_enter(r);
+    if (!s)
+        return -1;
+    void* p = reserve(seg_hdr(s), sizeof(e));
+    if (p && ring_streams(r, sizeof(e))) {
+        ring_copy_stream(p, &e, sizeof(e));
+        commit(p);
+    } else if (p) {
+        memcpy(p, &e, sizeof(e));
+        commit(p);
+    }
+    wr_exit(s);
+    return p ? 0 : -1;
+}
+
+size_t
+varlen_dequeue(ring* r, elem* out, size_t n)
+{
+    size_t cnt = 0;
+    ring_hdr* h;
+    for (; cnt < n; cnt++) {
+        auto rec = peek_rd(r, h);
+        if (!rec)
+            break;
+        size_t len = std::min<size_t>(rec->len, sizeof(elem));
+        memcpy(static_cast<void*>(out + cnt), rec + 1, len);
+        memset(reinterpret_cast<char*>(out + cnt) + len, 0, sizeof(elem) - len);
+        release(h, rec);
+    }
+    return cnt;
+}
+
+bool
+varlen_empty(ring_hdr* h)
+{
+    return h->vhead.load(std::memory_order_acquire) ==
+           h->vtail.load(std::memory_order_acquire);
+}
+
+bool
+varlen_retired(ring_hdr* h)
+{
+    if (h->next_gen.load(std::memory_order_seq_cst) == 0)
+        return false;
+    /* Writers that enter from now on see next_gen and go to the next
+     * generation. Once none that is alive is still writing, which
+     * idle producers and this process are not, the records below
+     * vhead are all there is. */
+    for (auto& w : h->writers) {
+        if (w.inflight.load(std::memory_order_seq_cst) == 0)
+            continue;
+        int32_t pid = w.pid.load(std::memory_order_relaxed);
+        if (pid != 0 && proc_alive(pid, w.start.load(std::memory_order_relaxed)))
+            return false;
+    }
+    return varlen_empty(h);
+}
+
+ring_seg*
+varlen_wr(ring const* r)
+{
+    auto s = ring_seg_of(r);
+    auto wr = s->wr.load(std::memory_order_acquire);
+    return wr ? wr : s;
+}
+
+ring_seg*
+varlen_rd(ring const* r)
+{
+    auto s = ring_seg_of(r);
+    auto rd = s->rd.load(std::memory_order_acquire);
+    return rd ? rd : s;
+}
+
+extern "C"
+void*
+ring_reserve(ring* r, size_t len)
+{
+    if (!(r->flags & RING_F_VARLEN))
+        return nullptr;
+    /* The enqueue stays in flight until ring_commit() */
+    auto s = wr_enter(r);
+    if (!s)
+        return nullptr;
+    void* p = reserve(seg_hdr(s), len);
+    if (!p)
+        wr_exit(s);
+    return p;
+}
+
+extern "C"
+void
+ring_commit(ring* r, void* p)
+{
+    commit(p);
+    if (auto s = seg_holding(r, p))
+        wr_exit(s);
+    ring_notify(ring_hdr_of(r), RING_EV_DATA);
+}
+
+extern "C"
+void const*
+ring_peek(ring* r, size_t* len)
+{
+    if (!(r->flags & RING_F_VARLEN))
+        return nullptr;
+    ring_hdr* h;
+    auto rec = peek_rd(r, h);
+    if (!rec)
+        return nullptr;
+    *len = rec->len;
+    return rec + 1;
+}
+
+extern "C"
+void
+ring_release(ring* r)
+{
+    auto h = seg_hdr(varlen_rd(r));
+    if (auto rec = peek(h)) {
+        release(h, rec);
+        ring_notify(ring_hdr_of(r), RING_EV_SPACE);
+    }
+}
@@ -0,0 +1,137 @@
+#include "ring_lcl.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <ctime>
+
+#include <linux/futex.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace {
+
+/// Rough cost of one busy poll, used to turn a gap into polls.
+uint64_t const kPollNs = 50;
+/// Gaps up to this long are spun through; parking and being woken
+/// costs about as much.
+uint64_t const kSpinGapNs = 50 * 1000;
+unsigned const kMinSpins = 16;
+/// A parked caller rechecks at least this often.
+uint64_t const kMaxParkNs = 100 * 1000 * 1000;
+
+uint64_t
+now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/**
+ * Fold the time since the last success into the moving average of
+ * an adaptive ring_wait. Racing threads may lose an update.
+ */
+void
+adaptive_success(ring_wait* w)
+{
+    uint64_t now = now_ns();
+    uint64_t last = __atomic_exchange_n(&w->last_ns, now, __ATOMIC_RELAXED);
+    if (last == 0 || now < last)
+        return;
+    uint64_t gap = __atomic_load_n(&w->gap_ns, __ATOMIC_RELAXED);
+    gap = gap ? (gap * 7 + (now - last)) / 8 : now - last;
+    __atomic_store_n(&w->gap_ns, gap, __ATOMIC_RELAXED);
+}
+
+/**
+ * Spin for about twice the usual gap if it is short enough to be
+ * worth spinning through, otherwise park soon.
+ */
+unsigned
+adaptive_spins(ring_wait const* w)
+{
+    uint64_t gap = __atomic_load_n(&w->gap_ns, __ATOMIC_RELAXED);
+    if (gap == 0)
+        return w->spins;
+    if (gap > kSpinGapNs)
+        return kMinSpins;
+    return std::max<uint64_t>(kMinSpins, 2 * gap / kPollNs);
+}
+
+/**
+ * Sleep on e unless its epoch moved past epoch. The word is in a
+ * shared mapping, so the futex must not be process private.
+ */
+void
+park(ring_event& e, uint32_t epoch, uint64_t ns)
+{
+    timespec ts = {static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+    syscall(SYS_futex, &e.epoch, FUTEX_WAIT, epoch, &ts, nullptr, 0);
+}
+
+}
+
+void
+ring_wake(ring_event& e)
+{
+    e.epoch.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, &e.epoch, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+extern "C"
+int
+ring_wait_for(ring* r, ring_wait* w, unsigned ev,
+              int (*op)(void* arg), void* arg)
+{
+    bool adaptive = w->policy == RING_WAIT_ADAPTIVE;
+    if (op(arg)) {
+        if (adaptive)
+            adaptive_success(w);
+        return 1;
+    }
+    if (w->policy == RING_WAIT_NONE || ev > RING_EV_SPACE)
+        return 0;
+
+    uint64_t deadline = w->timeout_us ? now_ns() + w->timeout_us * 1000ull : UINT64_MAX;
+    unsigned spins = adaptive ? adaptive_spins(w) : w->spins;
+    auto& e = ring_hdr_of(r)->events[ev];
+    for (unsigned i = 0; ; i++) {
+        bool spinning = w->policy == RING_WAIT_SPIN || i < spins;
+        /* Spinners look at the clock every 64 polls */
+        uint64_t now = !spinning || i % 64 == 0 ? now_ns() : 0;
+        if (now >= deadline)
+            return 0;
+        if (spinning) {
+            cpu_relax();
+        } else if (w->policy == RING_WAIT_YIELD) {
+            sched_yield();
+        } else {
+            /* Announce ourselves before the last attempt, so that
+             * whoever makes op succeed after it sees us and wakes us */
+            e.waiters.fetch_add(1, std::memory_order_seq_cst);
+            uint32_t epoch = e.epoch.load(std::memory_order_seq_cst);
+            int ok = op(arg);
+            if (!ok)
+                park(e, epoch, std::min(kMaxParkNs, deadline - now));
+            e.waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (ok)
+                break;
+        }
+        if (op(arg))
+            break;
+    }
+    if (adaptive)
+        adaptive_success(w);
+    return 1;
+}
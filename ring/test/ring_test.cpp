@@ -1,5 +1,23 @@
 #include <gtest/gtest.h>
 #include <ring.h>
+#include <ring.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 using ::testing::EmptyTestEventListener;
 using ::testing::InitGoogleTest;
@@ -13,6 +31,34 @@ namespace {
 
 using namespace std::literals;
 
+/**
+ * Unlinks the segments of the rings a test makes, named after it as
+ * Ring.<test>, optionally followed by '.' or '_' and more, before and
+ * after the test. A test that fails, or a run that died, leaves
+ * nothing for the next run to attach to.
+ */
+class SegmentJanitor : public EmptyTestEventListener {
+    void OnTestStart(TestInfo const& t) override { Unlink(t); }
+    void OnTestEnd(TestInfo const& t) override { Unlink(t); }
+
+    static void Unlink(TestInfo const& t) {
+        std::string prefix = "SEG4xRING_"s + t.test_suite_name() + "." + t.name();
+        DIR* d = opendir("/dev/shm");
+        if (!d)
+            return;
+        while (dirent* de = readdir(d)) {
+            char next = de->d_name[std::min(prefix.size(), strlen(de->d_name))];
+            if (strncmp(de->d_name, prefix.c_str(), prefix.size()) == 0 &&
+                (next == '\0' || next == '.' || next == '_'))
+                shm_unlink(de->d_name);
+        }
+        closedir(d);
+    }
+};
+
+/* gtest_main runs the tests; the listener goes in before it does */
+bool const kJanitor = (UnitTest::GetInstance()->listeners().Append(new SegmentJanitor), true);
+
 TEST(Ring, Create) {
     auto r = ring_init("Ring.Create", 50, sizeof(elem));
     ASSERT_NE(r, nullptr);
@@ -101,4 +147,1273 @@ TEST(Ring, PushToCapacity) {
     ring_free(r);
 }
 
+TEST(Ring, SeqGapOnFull) {
+    auto r = ring_init("Ring.SeqGapOnFull", RING_CAPACITY, sizeof(elem));
+    elem e {0};
+    for (size_t i = 0; i < RING_CAPACITY; i++) {
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+        ASSERT_EQ(e.seq, i);
+    }
+    ASSERT_EQ(ring_enqueue(r, &e), -1);
+    elem* e2;
+    ASSERT_EQ(ring_dequeue(r, &e2), 0);
+    ASSERT_EQ(e2->seq, 0u);
+    free(e2);
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    ASSERT_EQ(e.seq, RING_CAPACITY + 1);
+    ring_free(r);
+}
+
+TEST(Ring, ManyProducersManyConsumers) {
+    auto r = ring_init("Ring.ManyProducersManyConsumers", RING_CAPACITY, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    size_t const kPerProducer = 50000;
+    unsigned const kThreads = 4;
+    std::vector<std::atomic<uint8_t>> seen(kThreads * kPerProducer);
+    std::atomic<size_t> popped{0};
+    std::vector<std::thread> threads;
+    for (unsigned p = 0; p < kThreads; p++) {
+        threads.emplace_back([&, p]{
+            for (size_t i = 0; i < kPerProducer; i++) {
+                elem e {p * kPerProducer + i};
+                while (ring_enqueue(r, &e) != 0)
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (unsigned c = 0; c < kThreads; c++) {
+        threads.emplace_back([&]{
+            elem out[16];
+            while (popped.load() < seen.size()) {
+                size_t n = ring_dequeue_bulk(r, out, 16);
+                for (size_t i = 0; i < n; i++)
+                    seen[out[i].id].fetch_add(1);
+                popped += n;
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    ASSERT_EQ(popped.load(), seen.size());
+    for (auto& s : seen)
+        ASSERT_EQ(s.load(), 1u);
+    ring_free(r);
+}
+
+TEST(Ring, HugePagesPushLookupPop) {
+    ring_attr attr {RING_F_HUGEPAGES | RING_F_PREFAULT};
+    auto r = ring_init_attr("Ring.HugePagesPushLookupPop",
+                            50, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    ASSERT_TRUE(r->flags & RING_F_PREFAULT);
+    elem e1 {1234, "hello"};
+    auto ret = ring_enqueue(r, &e1);
+    ASSERT_EQ(ret, 0);
+
+    auto rx = ring_lookup("Ring.HugePagesPushLookupPop");
+    ASSERT_NE(rx, nullptr);
+    ASSERT_EQ(rx->flags & RING_F_HUGEPAGES, r->flags & RING_F_HUGEPAGES);
+    elem* e2;
+    ret = ring_dequeue(rx, &e2);
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(e2->id, 1234);
+    ASSERT_STREQ(e2->data, e1.data);
+    ring_free(rx);
+    ring_free(r);
+}
+
+TEST(Ring, LookupMissing) {
+    ASSERT_EQ(ring_lookup("Ring.LookupMissing"), nullptr);
+}
+
+TEST(Ring, LookupInvalidSegment) {
+    int fd = shm_open("SEG4xRING_Ring.LookupInvalidSegment",
+                      O_RDWR | O_CREAT | O_TRUNC, 0666);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, "garbage", 7), 7);
+    close(fd);
+    ASSERT_EQ(ring_lookup("Ring.LookupInvalidSegment"), nullptr);
+
+    /* The producer takes the name over from the stale segment */
+    auto r = ring_init("Ring.LookupInvalidSegment", 50, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    auto rx = ring_lookup("Ring.LookupInvalidSegment");
+    ASSERT_NE(rx, nullptr);
+    ring_free(rx);
+    ring_free(r);
+}
+
+TEST(Ring, ConcurrentCreate) {
+    /* Every caller gets the one ring, none a segment half set up */
+    size_t const kThreads = 8;
+    std::atomic<bool> go{false};
+    std::vector<ring*> rings(kThreads);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < kThreads; i++)
+        threads.emplace_back([&, i] {
+            while (!go.load())
+                ;
+            rings[i] = ring_init("Ring.ConcurrentCreate", 50, sizeof(elem));
+        });
+    go = true;
+    for (auto& t : threads)
+        t.join();
+    for (auto r : rings)
+        ASSERT_NE(r, nullptr);
+    elem e1 {77};
+    ASSERT_EQ(ring_enqueue(rings[0], &e1), 0);
+    elem* e2;
+    ASSERT_EQ(ring_dequeue(rings[kThreads - 1], &e2), 0);
+    ASSERT_EQ(e2->id, 77u);
+    for (auto r : rings)
+        ring_free(r);
+}
+
+/* Create a ring in a child process that exits right away */
+void
+DeadProducer(char const* name, size_t nrecords)
+{
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        auto r = ring_init(name, 50, sizeof(elem));
+        for (size_t i = 0; i < nrecords; i++) {
+            elem e {i};
+            ring_enqueue(r, &e);
+        }
+        _exit(0);
+    }
+    ASSERT_EQ(waitpid(pid, nullptr, 0), pid);
+}
+
+TEST(Ring, OwnerAlive) {
+    auto r = ring_init("Ring.OwnerAlive", 50, sizeof(elem));
+    ASSERT_EQ(ring_owner_alive(r), 1);
+    ASSERT_EQ(ring_reclaim(r), -1);
+    ring_free(r);
+}
+
+TEST(Ring, DrainThenReclaim) {
+    DeadProducer("Ring.DrainThenReclaim", 3);
+    auto r = ring_lookup("Ring.DrainThenReclaim");
+    ASSERT_NE(r, nullptr);
+    ASSERT_EQ(ring_owner_alive(r), 0);
+    ASSERT_EQ(ring_reclaim(r), -1);
+    elem* e;
+    for (size_t i = 0; i < 3; i++) {
+        ASSERT_EQ(ring_dequeue(r, &e), 0);
+        ASSERT_EQ(e->id, i);
+        free(e);
+    }
+    ASSERT_EQ(ring_reclaim(r), 0);
+    ring_free(r);
+    ASSERT_EQ(ring_lookup("Ring.DrainThenReclaim"), nullptr);
+}
+
+TEST(Ring, SweepOrphans) {
+    DeadProducer("Ring.SweepOrphans.Empty", 0);
+    DeadProducer("Ring.SweepOrphans.Queued", 1);
+    auto live = ring_init("Ring.SweepOrphans.Live", 50, sizeof(elem));
+
+    ASSERT_GE(ring_sweep(3600), 1);
+    ASSERT_EQ(ring_lookup("Ring.SweepOrphans.Empty"), nullptr);
+    auto queued = ring_lookup("Ring.SweepOrphans.Queued");
+    ASSERT_NE(queued, nullptr);
+    ring_free(queued);
+
+    /* Out of grace: undrained orphans go too */
+    ring_sweep(0);
+    ASSERT_EQ(ring_lookup("Ring.SweepOrphans.Queued"), nullptr);
+    auto rx = ring_lookup("Ring.SweepOrphans.Live");
+    ASSERT_NE(rx, nullptr);
+    ring_free(rx);
+    ring_free(live);
+}
+
+TEST(Ring, SweepKeepsAttachedProducer) {
+    char const* name = "Ring.SweepKeepsAttachedProducer";
+    int up[2], down[2];
+    ASSERT_EQ(pipe(up), 0);
+    ASSERT_EQ(pipe(down), 0);
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        ring_init(name, 50, sizeof(elem));
+        char c = 0;
+        (void) !write(up[1], &c, 1);
+        close(down[1]);
+        (void) !read(down[0], &c, 1);
+        _exit(0);
+    }
+    char c;
+    ASSERT_EQ(read(up[0], &c, 1), 1);
+    /* Attached while the owner is alive, then outlives it */
+    auto r = ring_init(name, 50, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    close(down[1]);
+    ASSERT_EQ(waitpid(pid, nullptr, 0), pid);
+    ASSERT_EQ(ring_owner_alive(r), 0);
+
+    ring_sweep(0);
+    auto rx = ring_lookup(name);
+    ASSERT_NE(rx, nullptr);
+    ASSERT_EQ(ring_reclaim(rx), -1);
+    ring_free(r);
+    ASSERT_EQ(ring_reclaim(rx), 0);
+    ring_free(rx);
+    ASSERT_EQ(ring_lookup(name), nullptr);
+    for (int fd : {up[0], up[1], down[0]})
+        close(fd);
+}
+
+TEST(Ring, ReclaimRemovesGenerations) {
+    char const* name = "Ring.ReclaimRemovesGenerations";
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        ring_attr attr {RING_F_VARLEN};
+        auto r = ring_init_attr(name, 4096, 0, &attr);
+        elem e {};
+        ring_enqueue(r, &e);
+        ring_resize(r, 8192);
+        ring_enqueue(r, &e);
+        ring_resize(r, 16384);
+        _exit(0);
+    }
+    ASSERT_EQ(waitpid(pid, nullptr, 0), pid);
+    ASSERT_EQ(access("/dev/shm/SEG4xRING_Ring.ReclaimRemovesGenerations.2", F_OK), 0);
+
+    auto rx = ring_lookup(name);
+    ASSERT_NE(rx, nullptr);
+    ASSERT_EQ(ring_reclaim(rx), -1);
+    elem* e;
+    ASSERT_EQ(ring_dequeue(rx, &e), 0);
+    free(e);
+    ASSERT_EQ(ring_dequeue(rx, &e), 0);
+    free(e);
+    ASSERT_EQ(ring_reclaim(rx), 0);
+    ring_free(rx);
+    for (char const* gen : {"", ".1", ".2"})
+        ASSERT_NE(access(("/dev/shm/SEG4xRING_"s + name + gen).c_str(), F_OK), 0);
+}
+
+TEST(Ring, LaneClaimRelease) {
+    ring_attr attr {0, 2};
+    auto r = ring_init_attr("Ring.LaneClaimRelease", 50, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    ASSERT_EQ(ring_lane_claim(r), 0);
+    ASSERT_EQ(ring_lane_claim(r), 1);
+    ASSERT_EQ(ring_lane_claim(r), -1);
+    ring_lane_release(r, 1);
+    ASSERT_EQ(ring_lane_claim(r), 1);
+    ring_lane_release_all(r);
+    ASSERT_EQ(ring_lane_claim(r), 0);
+    ring_free(r);
+}
+
+TEST(Ring, GeometryMismatch) {
+    char const* name = "Ring.GeometryMismatch";
+    ring_attr lanes {0, 2};
+    auto r = ring_init_attr(name, 50, sizeof(elem), &lanes);
+    ASSERT_NE(r, nullptr);
+    auto same = ring_init_attr(name, 50, sizeof(elem), &lanes);
+    ASSERT_NE(same, nullptr);
+    ring_free(same);
+
+    /* Another geometry does not attach to it, nor replace it */
+    errno = 0;
+    ASSERT_EQ(ring_init(name, 50, sizeof(elem)), nullptr);
+    ASSERT_EQ(errno, EEXIST);
+    ring_attr more {0, 4};
+    ASSERT_EQ(ring_init_attr(name, 50, sizeof(elem), &more), nullptr);
+    ASSERT_EQ(errno, EEXIST);
+    ASSERT_EQ(ring_lane_claim(r), 0);
+    ring_free(r);
+    shm_unlink("SEG4xRING_Ring.GeometryMismatch");
+
+    ring_attr bcast {RING_F_BROADCAST};
+    r = ring_init_attr(name, 8, sizeof(elem), &bcast);
+    ASSERT_NE(r, nullptr);
+    ASSERT_EQ(ring_init_attr(name, 16, sizeof(elem), &bcast), nullptr);
+    ASSERT_EQ(errno, EEXIST);
+    bcast.slotsz = 256;
+    ASSERT_EQ(ring_init_attr(name, 8, sizeof(elem), &bcast), nullptr);
+    ASSERT_EQ(errno, EEXIST);
+    ring_free(r);
+    shm_unlink("SEG4xRING_Ring.GeometryMismatch");
+
+    ring_attr varlen {RING_F_VARLEN};
+    r = ring_init_attr(name, 4096, 0, &varlen);
+    ASSERT_NE(r, nullptr);
+    ASSERT_EQ(ring_init_attr(name, 8192, 0, &varlen), nullptr);
+    ASSERT_EQ(errno, EEXIST);
+    ring_free(r);
+    shm_unlink("SEG4xRING_Ring.GeometryMismatch");
+}
+
+TEST(Ring, DequeueBulk) {
+    ring_attr attr {0, 1};
+    auto r = ring_init_attr("Ring.DequeueBulk", 50, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    int l0 = ring_lane_claim(r);
+    elem e {0};
+    for (size_t id : {1, 2, 3}) {
+        e.id = id;
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    }
+    for (size_t id : {4, 5}) {
+        e.id = id;
+        ASSERT_EQ(ring_lane_enqueue(r, l0, &e), 0);
+    }
+
+    elem out[4];
+    ASSERT_EQ(ring_dequeue_bulk(r, out, 4), 4u);
+    for (size_t i = 0; i < 4; i++)
+        ASSERT_EQ(out[i].id, i + 1);
+    ASSERT_EQ(ring_dequeue_bulk(r, out, 4), 1u);
+    ASSERT_EQ(out[0].id, 5u);
+    ASSERT_EQ(ring_dequeue_bulk(r, out, 4), 0u);
+    ring_lane_release_all(r);
+    ring_free(r);
+}
+
+TEST(Ring, FormatTable) {
+    auto r = ring_init("Ring.FormatTable", 50, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    auto a = ring_fmt_register(r, "a long enough format %d");
+    auto b = ring_fmt_register(r, "b %s");
+    ASSERT_NE(a, 0u);
+    ASSERT_NE(b, 0u);
+    ASSERT_EQ(ring_fmt_register(r, "a long enough format %d"), a);
+
+    auto rx = ring_lookup("Ring.FormatTable");
+    ASSERT_NE(rx, nullptr);
+    ASSERT_STREQ(ring_fmt_lookup(rx, b), "b %s");
+    ASSERT_STREQ(ring_fmt_lookup(rx, a), "a long enough format %d");
+    /* Only the start of an entry is an id */
+    for (uint32_t id = a + 1; id < b; id++)
+        ASSERT_EQ(ring_fmt_lookup(rx, id), nullptr) << id;
+    ASSERT_EQ(ring_fmt_lookup(rx, b + 8), nullptr);
+    ASSERT_EQ(ring_fmt_lookup(rx, 0), nullptr);
+
+    /* A string that does not fit takes no room from later ones */
+    std::string big(RING_FMT_TABLESZ, 'x');
+    ASSERT_EQ(ring_fmt_register(r, big.c_str()), 0u);
+    auto c = ring_fmt_register(r, "c %u");
+    ASSERT_NE(c, 0u);
+    ASSERT_STREQ(ring_fmt_lookup(rx, c), "c %u");
+    ring_free(rx);
+    ring_free(r);
+}
+
+TEST(Ring, LanesDequeueOrdered) {
+    ring_attr attr {0, 2};
+    auto r = ring_init_attr("Ring.LanesDequeueOrdered", 50, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    int l0 = ring_lane_claim(r);
+    int l1 = ring_lane_claim(r);
+    elem e {0};
+    for (size_t ts : {1, 4, 5}) {
+        e.id = e.ts = ts;
+        ASSERT_EQ(ring_lane_enqueue(r, l0, &e), 0);
+    }
+    for (size_t ts : {2, 3, 7}) {
+        e.id = e.ts = ts;
+        ASSERT_EQ(ring_lane_enqueue(r, l1, &e), 0);
+    }
+    e.id = e.ts = 6;
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+
+    auto rx = ring_lookup("Ring.LanesDequeueOrdered");
+    elem* e2;
+    for (size_t ts = 1; ts <= 7; ts++) {
+        ASSERT_EQ(ring_dequeue_ordered(rx, &e2), 0);
+        ASSERT_EQ(e2->id, ts);
+        free(e2);
+    }
+    ASSERT_EQ(ring_dequeue_ordered(rx, &e2), -1);
+    ASSERT_EQ(ring_dequeue(rx, &e2), -1);
+    ring_free(rx);
+    ring_lane_release_all(r);
+    ring_free(r);
+}
+
+TEST(Ring, LanesManyConsumers) {
+    ring_attr attr {0, 2};
+    auto r = ring_init_attr("Ring.LanesManyConsumers", 50, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    int lanes[] = {ring_lane_claim(r), ring_lane_claim(r)};
+    ring* rx[3];
+    for (auto& c : rx)
+        c = ring_lookup("Ring.LanesManyConsumers");
+
+    /* Consumers race for full lanes, which have room for one */
+    size_t const batch = 2 * RING_LANE_CAPACITY;
+    std::vector<int> seen(20 * batch);
+    for (size_t id = 0; id < seen.size(); ) {
+        for (size_t i = 0; i < batch; i++, id++) {
+            elem e {id};
+            e.ts = id;
+            ASSERT_EQ(ring_lane_enqueue(r, lanes[i % 2], &e), 0);
+        }
+        std::atomic<long> left{static_cast<long>(batch)};
+        std::vector<std::vector<size_t>> got(3);
+        std::vector<std::thread> consumers;
+        for (int c = 0; c < 3; c++)
+            consumers.emplace_back([&, c] {
+                elem* e;
+                while (left > 0) {
+                    if ((c == 0 ? ring_dequeue_ordered(rx[c], &e) : ring_dequeue(rx[c], &e)) != 0)
+                        continue;
+                    got[c].push_back(e->id);
+                    left--;
+                    free(e);
+                }
+            });
+        for (auto& t : consumers)
+            t.join();
+        for (auto& ids : got)
+            for (size_t i : ids)
+                seen.at(i)++;
+    }
+    ASSERT_EQ(std::count(seen.begin(), seen.end(), 1), static_cast<long>(seen.size()));
+    for (auto c : rx)
+        ring_free(c);
+    ring_free(r);
+    shm_unlink("SEG4xRING_Ring.LanesManyConsumers");
+}
+
+TEST(Ring, LanesLookaheadOutlivesHandle) {
+    ring_attr attr {0, 1};
+    auto r = ring_init_attr("Ring.LanesLookaheadOutlivesHandle", 50, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    int lane = ring_lane_claim(r);
+    elem older {1};
+    older.ts = 1;
+    elem newer {2};
+    newer.ts = 2;
+    ASSERT_EQ(ring_enqueue(r, &newer), 0);
+    ASSERT_EQ(ring_lane_enqueue(r, lane, &older), 0);
+
+    /* The ordered merge holds the shared queue's record back */
+    auto a = ring_lookup("Ring.LanesLookaheadOutlivesHandle");
+    elem* e;
+    ASSERT_EQ(ring_dequeue_ordered(a, &e), 0);
+    ASSERT_EQ(e->id, 1u);
+    free(e);
+    ring_free(a);
+
+    auto b = ring_lookup("Ring.LanesLookaheadOutlivesHandle");
+    ASSERT_EQ(ring_dequeue(b, &e), 0);
+    ASSERT_EQ(e->id, 2u);
+    free(e);
+    ring_free(b);
+    ring_free(r);
+    shm_unlink("SEG4xRING_Ring.LanesLookaheadOutlivesHandle");
+}
+
+TEST(Ring, BroadcastFanOut) {
+    ring_attr attr {RING_F_BROADCAST};
+    auto r = ring_init_attr("Ring.BroadcastFanOut", 8, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    ASSERT_TRUE(r->flags & RING_F_BROADCAST);
+    auto a = ring_lookup("Ring.BroadcastFanOut");
+    auto b = ring_lookup("Ring.BroadcastFanOut");
+    ASSERT_NE(a, nullptr);
+    ASSERT_NE(b, nullptr);
+    for (size_t i = 0; i < 5; i++) {
+        elem e {i};
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    }
+    for (auto rx : {a, b}) {
+        elem* e;
+        for (size_t i = 0; i < 5; i++) {
+            ASSERT_EQ(ring_dequeue(rx, &e), 0);
+            ASSERT_EQ(e->id, i);
+            free(e);
+        }
+        ASSERT_EQ(ring_dequeue(rx, &e), -1);
+    }
+    ring_free(b);
+    ring_free(a);
+    ring_free(r);
+}
+
+TEST(Ring, BroadcastSlowestGates) {
+    ring_attr attr {RING_F_BROADCAST};
+    auto r = ring_init_attr("Ring.BroadcastSlowestGates", 4, sizeof(elem), &attr);
+    auto fast = ring_lookup("Ring.BroadcastSlowestGates");
+    auto slow = ring_lookup("Ring.BroadcastSlowestGates");
+    elem e {0};
+    for (size_t i = 0; i < 4; i++)
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    ASSERT_EQ(ring_enqueue(r, &e), -1);
+
+    elem out[4];
+    ASSERT_EQ(ring_dequeue_bulk(fast, out, 4), 4u);
+    ASSERT_EQ(ring_enqueue(r, &e), -1);
+    ASSERT_EQ(ring_dequeue_bulk(slow, out, 2), 2u);
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    ASSERT_EQ(ring_enqueue(r, &e), -1);
+
+    /* Once the slow consumer leaves, only the fast one gates */
+    ring_free(slow);
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    ASSERT_EQ(ring_dequeue_bulk(fast, out, 4), 3u);
+    ASSERT_EQ(out[0].seq, 6u);
+    ASSERT_EQ(out[2].seq, 9u);
+    ring_free(fast);
+    ring_free(r);
+}
+
+TEST(Ring, BroadcastDeadConsumer) {
+    ring_attr attr {RING_F_BROADCAST};
+    auto r = ring_init_attr("Ring.BroadcastDeadConsumer", 4, sizeof(elem), &attr);
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        ring_lookup("Ring.BroadcastDeadConsumer");
+        _exit(0);
+    }
+    ASSERT_EQ(waitpid(pid, nullptr, 0), pid);
+
+    /* The cursor of the exited consumer does not hold the ring, and
+     * without consumers the oldest records are overwritten */
+    for (size_t i = 0; i < 10; i++) {
+        elem e {i};
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    }
+    auto rx = ring_lookup("Ring.BroadcastDeadConsumer");
+    elem out[8];
+    ASSERT_EQ(ring_dequeue_bulk(rx, out, 8), 4u);
+    ASSERT_EQ(out[0].id, 6u);
+    ASSERT_EQ(out[3].id, 9u);
+    ring_free(rx);
+    ring_free(r);
+}
+
+TEST(Ring, GroupSplitsRecords) {
+    ring_attr attr {RING_F_BROADCAST};
+    auto r = ring_init_attr("Ring.GroupSplitsRecords", 256, sizeof(elem), &attr);
+    auto a = ring_lookup_group("Ring.GroupSplitsRecords", "archive");
+    auto b = ring_lookup_group("Ring.GroupSplitsRecords", "archive");
+    auto tail = ring_lookup("Ring.GroupSplitsRecords");
+    ASSERT_NE(a, nullptr);
+    ASSERT_NE(b, nullptr);
+    for (size_t i = 0; i < 200; i++) {
+        elem e {i};
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    }
+
+    /* Each member claims a batch of its own */
+    elem* e;
+    ASSERT_EQ(ring_dequeue(a, &e), 0);
+    ASSERT_EQ(e->id, 0u);
+    free(e);
+    ASSERT_EQ(ring_dequeue(b, &e), 0);
+    ASSERT_EQ(e->id, 64u);
+    free(e);
+
+    std::vector<elem> out(256);
+    std::vector<int> seen(200);
+    seen[0] = seen[64] = 1;
+    auto n = ring_dequeue_bulk(a, out.data(), out.size());
+    for (size_t i = 0; i < n; i++)
+        seen[out[i].id]++;
+    n = ring_dequeue_bulk(b, out.data(), out.size());
+    for (size_t i = 0; i < n; i++)
+        seen[out[i].id]++;
+    ASSERT_EQ(std::count(seen.begin(), seen.end(), 1), 200);
+
+    /* The rest of the group does not take records from other readers */
+    ASSERT_EQ(ring_dequeue_bulk(tail, out.data(), out.size()), 200u);
+    ring_free(tail);
+    ring_free(b);
+    ring_free(a);
+    ring_free(r);
+}
+
+TEST(Ring, GroupTakesOverDeadMember) {
+    ring_attr attr {RING_F_BROADCAST};
+    auto r = ring_init_attr("Ring.GroupTakesOverDeadMember", 128, sizeof(elem), &attr);
+    for (size_t i = 0; i < 100; i++) {
+        elem e {i};
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    }
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        /* Claim the first batch, read one record and die */
+        auto rx = ring_lookup_group("Ring.GroupTakesOverDeadMember", "g");
+        elem* e;
+        _exit(ring_dequeue(rx, &e) == 0 && e->id == 0 ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    auto rx = ring_lookup_group("Ring.GroupTakesOverDeadMember", "g");
+    std::vector<elem> out(128);
+    ASSERT_EQ(ring_dequeue_bulk(rx, out.data(), out.size()), 99u);
+    ASSERT_EQ(out[0].id, 64u);
+    ASSERT_EQ(out[36].id, 1u);
+    ASSERT_EQ(ring_dequeue_bulk(rx, out.data(), out.size()), 0u);
+    ring_free(rx);
+    ring_free(r);
+}
+
+TEST(Ring, BroadcastWithLanes) {
+    ring_attr attr {RING_F_BROADCAST, 2};
+    ASSERT_EQ(ring_init_attr("Ring.BroadcastWithLanes", 8, sizeof(elem), &attr), nullptr);
+}
+
+TEST(Ring, BroadcastSlotSize) {
+    ring_attr attr {RING_F_BROADCAST, 0, 100};
+    ASSERT_EQ(ring_init_attr("Ring.BroadcastSlotSize", 8, sizeof(elem), &attr), nullptr);
+    attr.slotsz = 64;
+    ASSERT_EQ(ring_init_attr("Ring.BroadcastSlotSize", 8, sizeof(elem), &attr), nullptr);
+    attr.slotsz = 256;
+    auto r = ring_init_attr("Ring.BroadcastSlotSize", 8, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    auto rx = ring_lookup("Ring.BroadcastSlotSize");
+    ASSERT_NE(rx, nullptr);
+    for (size_t i = 0; i < 20; i++) {
+        elem e {i};
+        snprintf(e.data, sizeof(e.data), "record %zu", i);
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+        elem* out;
+        ASSERT_EQ(ring_dequeue(rx, &out), 0);
+        ASSERT_EQ(out->id, i);
+        ASSERT_STREQ(out->data, e.data);
+        free(out);
+    }
+    ring_free(rx);
+    ring_free(r);
+}
+
+struct Sample {
+    uint64_t    ts;
+    double      value;
+    uint32_t    sensor;
+};
+
+TEST(Ring, TypedPushLookupPop) {
+    auto tx = mpl::ring<Sample, 1024>::create("Ring.TypedPushLookupPop");
+    ASSERT_TRUE(tx);
+    auto rx = mpl::ring<Sample, 1024>::lookup("Ring.TypedPushLookupPop");
+    ASSERT_TRUE(rx);
+    for (uint32_t i = 0; i < 1024; i++)
+        ASSERT_TRUE(tx.push(Sample{i, i * 0.5, i % 7}));
+    ASSERT_FALSE(tx.push(Sample{}));
+    for (uint32_t i = 0; i < 1024; i++) {
+        Sample s;
+        ASSERT_TRUE(rx.pop(s));
+        ASSERT_EQ(s.ts, i);
+        ASSERT_EQ(s.value, i * 0.5);
+        ASSERT_EQ(s.sensor, i % 7);
+    }
+    Sample s;
+    ASSERT_FALSE(rx.pop(s));
+
+    /* Handles of another record type or queue do not attach */
+    ASSERT_FALSE((mpl::ring<elem>::lookup("Ring.TypedPushLookupPop")));
+    ASSERT_FALSE((mpl::ring<Sample, 2048>::lookup("Ring.TypedPushLookupPop")));
+    ASSERT_EQ(ring_lookup("Ring.TypedPushLookupPop"), nullptr);
+}
+
+TEST(Ring, StreamCopy) {
+    char src[512], dst[512 + 64];
+    for (size_t i = 0; i < sizeof(src); i++)
+        src[i] = static_cast<char>(i * 31 + 7);
+    for (size_t off = 0; off < 40; off++) {
+        for (size_t n : {0, 1, 7, 8, 15, 16, 31, 33, 64, 100, 152, 255, 512}) {
+            memset(dst, 0, sizeof(dst));
+            ring_copy_stream(dst + off, src, n);
+            ASSERT_EQ(memcmp(dst + off, src, n), 0);
+            for (size_t i = 0; i < sizeof(dst); i++)
+                ASSERT_TRUE((i >= off && i < off + n) || dst[i] == 0);
+        }
+    }
+}
+
+TEST(Ring, StreamEnqueue) {
+    ring_attr attr {RING_F_STREAM | RING_F_TICKET};
+    auto r = ring_init_attr("Ring.StreamEnqueue", RING_CAPACITY, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    auto rx = ring_lookup("Ring.StreamEnqueue");
+    ASSERT_NE(rx, nullptr);
+    /* Only the producer handle streams, where the CPU can */
+    ASSERT_FALSE(rx->flags & RING_F_STREAM);
+    mpl::ring<elem, RING_CAPACITY, mpl::ticket_policy> q{r};
+    ASSERT_TRUE(q);
+    for (uint32_t i = 0; i < 1000; i++) {
+        elem e {i};
+        snprintf(e.data, sizeof(e.data), "record %u", i);
+        if (i % 2)
+            ASSERT_EQ(ring_enqueue(r, &e), 0);
+        else
+            ASSERT_TRUE(q.push(e));
+    }
+    for (uint32_t i = 0; i < 1000; i++) {
+        elem* out;
+        ASSERT_EQ(ring_dequeue(rx, &out), 0);
+        ASSERT_EQ(out->id, i);
+        ASSERT_EQ(std::string{out->data}, "record " + std::to_string(i));
+        free(out);
+    }
+
+    /* Records smaller than stream_min are copied as before */
+    ring_attr big {RING_F_STREAM};
+    big.stream_min = 4096;
+    auto tx = mpl::ring<Sample, 1024, mpl::ticket_policy>::create("Ring.StreamEnqueue.typed", &big);
+    ASSERT_TRUE(tx);
+    ASSERT_EQ(ring_stream_of(tx.handle()), (tx.handle()->flags & RING_F_STREAM) ? 4096u : 0u);
+    ASSERT_TRUE(tx.push(Sample{1, 0.5, 2}));
+    Sample smp;
+    auto ty = mpl::ring<Sample, 1024, mpl::ticket_policy>::lookup("Ring.StreamEnqueue.typed");
+    ASSERT_TRUE(ty.pop(smp));
+    ASSERT_EQ(smp.ts, 1u);
+    ring_free(rx);
+    ring_free(r);
+
+    /* The Boost queue copies records into nodes of its own */
+    auto rb = ring_init_attr("Ring.StreamEnqueue.boost", RING_CAPACITY, sizeof(elem), &big);
+    ASSERT_NE(rb, nullptr);
+    ASSERT_FALSE(rb->flags & RING_F_STREAM);
+    ring_free(rb);
+}
+
+/* The ticket queue drops records in place, the Boost queue pops them */
+template <typename Policy>
+void
+TypedPopIf(char const* name)
+{
+    auto tx = mpl::ring<Sample, 1024, Policy>::create(name);
+    ASSERT_TRUE(tx);
+    for (uint32_t i = 0; i < 100; i++)
+        ASSERT_TRUE(tx.push(Sample{i, 0, i % 3}));
+    std::size_t seen = 0;
+    auto odd = [&seen](Sample const& s) {
+        seen++;
+        return s.ts % 2 == 1;
+    };
+    Sample s;
+    for (uint32_t i = 1; i < 100; i += 2) {
+        ASSERT_TRUE(tx.pop_if(s, odd));
+        ASSERT_EQ(s.ts, i);
+    }
+    ASSERT_FALSE(tx.pop_if(s, odd));
+    ASSERT_EQ(seen, 100u);
+    /* The dropped records made room */
+    for (uint32_t i = 0; i < 1024; i++)
+        ASSERT_TRUE(tx.push(Sample{i}));
+}
+
+TEST(Ring, TypedPopIf) {
+    TypedPopIf<mpl::boost_policy>("Ring.TypedPopIf");
+    TypedPopIf<mpl::ticket_policy>("Ring.TypedPopIf.ticket");
+}
+
+TEST(Ring, TypedViewOfCRing) {
+    auto r = ring_init("Ring.TypedViewOfCRing", RING_CAPACITY, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    mpl::ring<elem> q{r};
+    ASSERT_TRUE(q);
+    elem e {7, "typed"};
+    e.seq = q.next_seq();
+    ASSERT_TRUE(q.push(e));
+    elem* out;
+    ASSERT_EQ(ring_dequeue(r, &out), 0);
+    ASSERT_EQ(out->id, 7u);
+    ASSERT_STREQ(out->data, "typed");
+    ASSERT_EQ(out->seq, 0u);
+    free(out);
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    ASSERT_EQ(e.seq, 1u);
+    elem back;
+    ASSERT_TRUE(q.pop(back));
+    ASSERT_EQ(back.seq, 1u);
+    ring_free(r);
+
+    /* Records of rings with lanes do not all go through the queue */
+    ring_attr attr {0, 2};
+    r = ring_init_attr("Ring.TypedViewOfCRing.lanes", RING_CAPACITY, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    ASSERT_FALSE(mpl::ring<elem>{r});
+    ring_free(r);
+}
+
+TEST(Ring, TicketQueue) {
+    auto plain = ring_init("Ring.TicketQueue.boost", 50, sizeof(elem));
+    ASSERT_NE(plain, nullptr);
+    ASSERT_FALSE(plain->flags & RING_F_TICKET);
+    ring_free(plain);
+
+    ring_attr attr {RING_F_TICKET};
+    auto r = ring_init_attr("Ring.TicketQueue", 50, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    ASSERT_TRUE(r->flags & RING_F_TICKET);
+    ASSERT_FALSE(mpl::ring<elem>{r});
+    mpl::ring<elem, RING_CAPACITY, mpl::ticket_policy> q{r};
+    ASSERT_TRUE(q);
+
+    /* Later handles take the queue the segment holds */
+    auto tx = ring_init("Ring.TicketQueue", 50, sizeof(elem));
+    ASSERT_NE(tx, nullptr);
+    ASSERT_TRUE(tx->flags & RING_F_TICKET);
+    auto rx = ring_lookup("Ring.TicketQueue");
+    ASSERT_NE(rx, nullptr);
+    ASSERT_TRUE(rx->flags & RING_F_TICKET);
+    elem e1 {5};
+    ASSERT_EQ(ring_enqueue(tx, &e1), 0);
+    elem* e2;
+    ASSERT_EQ(ring_dequeue(rx, &e2), 0);
+    ASSERT_EQ(e2->id, 5u);
+    free(e2);
+    ASSERT_EQ(ring_dequeue(rx, &e2), -1);
+    ring_free(rx);
+    ring_free(tx);
+    ring_free(r);
+}
+
+TEST(Ring, VarlenWrapsContiguously) {
+    ring_attr attr {RING_F_VARLEN};
+    auto r = ring_init_attr("Ring.VarlenWrapsContiguously", 4096, 0, &attr);
+    ASSERT_NE(r, nullptr);
+    ASSERT_TRUE(r->flags & RING_F_VARLEN);
+    auto rx = ring_lookup("Ring.VarlenWrapsContiguously");
+    ASSERT_NE(rx, nullptr);
+    size_t len;
+    ASSERT_EQ(ring_peek(rx, &len), nullptr);
+    ASSERT_EQ(ring_reserve(r, 4096), nullptr);
+
+    /* 1000 byte records take 1008 bytes with their header, so the
+     * fifth one runs over the end of the ring */
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 4; i++) {
+            auto p = static_cast<char*>(ring_reserve(r, 1000));
+            ASSERT_NE(p, nullptr);
+            memset(p, 'a' + round * 4 + i, 1000);
+            ring_commit(r, p);
+        }
+        ASSERT_EQ(ring_reserve(r, 1000), nullptr);
+        for (int i = 0; i < 4; i++) {
+            auto p = static_cast<char const*>(ring_peek(rx, &len));
+            ASSERT_NE(p, nullptr);
+            ASSERT_EQ(len, 1000u);
+            for (size_t j = 0; j < len; j++)
+                ASSERT_EQ(p[j], 'a' + round * 4 + i);
+            ring_release(rx);
+        }
+        ASSERT_EQ(ring_peek(rx, &len), nullptr);
+    }
+
+    /* elems travel as records of their own size */
+    elem e {42, "varlen"};
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    elem* out;
+    ASSERT_EQ(ring_dequeue(rx, &out), 0);
+    ASSERT_EQ(out->id, 42u);
+    ASSERT_STREQ(out->data, "varlen");
+    free(out);
+    ASSERT_EQ(ring_dequeue(rx, &out), -1);
+    ring_free(rx);
+    ring_free(r);
+}
+
+TEST(Ring, VarlenBadAttributes) {
+    char const* name = "Ring.VarlenBadAttributes";
+    for (unsigned flags : {RING_F_HUGEPAGES, RING_F_BROADCAST}) {
+        ring_attr attr {RING_F_VARLEN | flags};
+        errno = 0;
+        ASSERT_EQ(ring_init_attr(name, 4096, 0, &attr), nullptr);
+        ASSERT_EQ(errno, EINVAL);
+    }
+    ring_attr lanes {RING_F_VARLEN, 1};
+    ASSERT_EQ(ring_init_attr(name, 4096, 0, &lanes), nullptr);
+    ASSERT_EQ(errno, EINVAL);
+    ASSERT_EQ(ring_lookup(name), nullptr);
+}
+
+TEST(Ring, VarlenResizeKeepsOrder) {
+    char const* name = "Ring.VarlenResizeKeepsOrder";
+    ring_attr attr {RING_F_VARLEN};
+    auto r = ring_init_attr(name, 4096, 0, &attr);
+    ASSERT_NE(r, nullptr);
+    auto r2 = ring_init_attr(name, 4096, 0, &attr);
+    ASSERT_NE(r2, nullptr);
+    auto rx = ring_lookup(name);
+    ASSERT_NE(rx, nullptr);
+    ASSERT_EQ(ring_resize(r, 0), -1);
+
+    /* Fill the first generation, r2 writing to it as well, then
+     * grow the ring and keep going */
+    size_t sent = 0;
+    elem e {};
+    ASSERT_EQ(ring_enqueue(r2, &e), 0);
+    for (e.id = ++sent; ring_enqueue(r, &e) == 0; e.id = ++sent)
+        ;
+    ASSERT_EQ(ring_resize(r, 64 * 1024), 0);
+    for (int i = 0; i < 100; i++) {
+        e.id = sent++;
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    }
+
+    /* The consumer reads the first generation out and goes on with
+     * the second, where r2 writes next */
+    size_t got = 0;
+    elem* out;
+    e.id = sent++;
+    ASSERT_EQ(ring_enqueue(r2, &e), 0);
+    for (; got < sent; got++) {
+        ASSERT_EQ(ring_dequeue(rx, &out), 0);
+        ASSERT_EQ(out->id, got);
+        free(out);
+    }
+    ASSERT_EQ(ring_dequeue(rx, &out), -1);
+
+    /* Shrink it: the second generation is removed once it is read,
+     * the first stays for lookups to find the third through */
+    ASSERT_EQ(ring_resize(r2, 4096), 0);
+    e.id = sent++;
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    ASSERT_EQ(ring_dequeue(rx, &out), 0);
+    ASSERT_EQ(out->id, sent - 1);
+    free(out);
+    ASSERT_EQ(shm_open("SEG4xRING_Ring.VarlenResizeKeepsOrder.1", O_RDONLY, 0), -1);
+    auto ry = ring_lookup(name);
+    ASSERT_NE(ry, nullptr);
+    e.id = sent++;
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    ASSERT_EQ(ring_dequeue(ry, &out), 0);
+    ASSERT_EQ(out->id, sent - 1);
+    free(out);
+
+    ring_free(ry);
+    ring_free(rx);
+    ring_free(r2);
+    ring_free(r);
+    shm_unlink("SEG4xRING_Ring.VarlenResizeKeepsOrder.2");
+}
+
+TEST(Ring, VarlenIdleProducer) {
+    char const* name = "Ring.VarlenIdleProducer";
+    ring_attr attr {RING_F_VARLEN};
+    auto r = ring_init_attr(name, 4096, 0, &attr);
+    ASSERT_NE(r, nullptr);
+    /* A second producer that never writes, and reads the ring too */
+    auto idle = ring_init_attr(name, 4096, 0, &attr);
+    ASSERT_NE(idle, nullptr);
+
+    size_t sent = 0;
+    elem e {};
+    for (e.id = sent; ring_enqueue(r, &e) == 0; e.id = ++sent)
+        ;
+    ASSERT_EQ(ring_resize(r, 64 * 1024), 0);
+    for (int i = 0; i < 10; i++) {
+        e.id = sent++;
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    }
+
+    /* Neither keeps the first generation from being retired */
+    elem* out;
+    for (size_t got = 0; got < sent; got++) {
+        ASSERT_EQ(ring_dequeue(idle, &out), 0) << got;
+        ASSERT_EQ(out->id, got);
+        free(out);
+    }
+    ASSERT_EQ(ring_dequeue(idle, &out), -1);
+    ring_free(idle);
+    ring_free(r);
+}
+
+TEST(Ring, NumaBind) {
+    ring_attr attr {RING_F_NUMA};
+    attr.node = 0;
+    auto r = ring_init_attr("Ring.NumaBind", 50, sizeof(elem), &attr);
+    ASSERT_NE(r, nullptr);
+    /* Kernels without NUMA support create the ring all the same */
+    if (!(r->flags & RING_F_NUMA)) {
+        ASSERT_EQ(ring_node(r), -1);
+        ring_free(r);
+        return;
+    }
+    ASSERT_EQ(ring_node(r), 0);
+    auto rx = ring_lookup("Ring.NumaBind");
+    ASSERT_NE(rx, nullptr);
+    ASSERT_TRUE(rx->flags & RING_F_NUMA);
+    ASSERT_EQ(ring_node(rx), 0);
+
+    /* A consumer moves it to its own node, for all handles to see */
+    int node = ring_cpu_node();
+    ASSERT_GE(node, 0);
+    ASSERT_EQ(ring_bind(rx, node), 0);
+    ASSERT_EQ(ring_node(r), node);
+    ASSERT_EQ(ring_bind(rx, 1023), -1);
+    ASSERT_EQ(ring_node(r), node);
+    /* Only new pages go there; it is recorded all the same */
+    ASSERT_EQ(ring_prefer(r, 0), 0);
+    ASSERT_EQ(ring_node(rx), 0);
+    ASSERT_EQ(ring_prefer(r, 1023), -1);
+    ASSERT_EQ(ring_bind(rx, node), 0);
+    ASSERT_EQ(ring_run_on_node(node), 0);
+    ASSERT_EQ(ring_cpu_node(), node);
+    ASSERT_EQ(ring_run_on_node(-1), -1);
+
+    elem e {};
+    elem* out;
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    ASSERT_EQ(ring_dequeue(rx, &out), 0);
+    free(out);
+    ring_free(rx);
+    ring_free(r);
+}
+
+/* Spares ready in the pool */
+int
+Spares()
+{
+    int n = 0;
+    DIR* d = opendir(RING_POOL_DIR);
+    while (dirent* de = d ? readdir(d) : nullptr)
+        n += de->d_name[0] != '.';
+    if (d)
+        closedir(d);
+    return n;
+}
+
+TEST(Ring, PoolSpareClaimed) {
+    ASSERT_EQ(ring_pool_keep(2), 2);
+    ASSERT_EQ(ring_pool_keep(2), 2);
+
+    /* ring_init() takes a spare over as its segment */
+    auto r = ring_init("Ring.PoolSpareClaimed", 50, sizeof(elem));
+    ASSERT_NE(r, nullptr);
+    ASSERT_EQ(Spares(), 1);
+    ASSERT_EQ(ring_owner_alive(r), 1);
+    auto rx = ring_lookup("Ring.PoolSpareClaimed");
+    ASSERT_NE(rx, nullptr);
+    elem e {};
+    e.id = 7;
+    elem* out;
+    ASSERT_EQ(ring_enqueue(r, &e), 0);
+    ASSERT_EQ(ring_dequeue(rx, &out), 0);
+    ASSERT_EQ(out->id, 7u);
+    free(out);
+
+    /* Rings of another shape are set up as before */
+    ring_attr attr {0, 2};
+    auto rl = ring_init_attr("Ring.PoolSpareClaimed.lanes", 50, sizeof(elem), &attr);
+    ASSERT_NE(rl, nullptr);
+    ASSERT_EQ(Spares(), 1);
+    ASSERT_EQ(ring_pool_keep(0), 0);
+    ASSERT_EQ(Spares(), 0);
+    ring_free(rl);
+    ring_free(rx);
+    ring_free(r);
+    shm_unlink("SEG4xRING_Ring.PoolSpareClaimed");
+    shm_unlink("SEG4xRING_Ring.PoolSpareClaimed.lanes");
+}
+
+/* kB of memory this process has locked */
+long
+LockedKb()
+{
+    FILE* f = fopen("/proc/self/status", "r");
+    char line[128];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "VmLck: %ld", &kb) == 1)
+            break;
+    fclose(f);
+    return kb;
+}
+
+TEST(Ring, MlockPrefault) {
+    long before = LockedKb();
+    ring_attr attr {RING_F_MLOCK};
+    auto r = ring_init_attr("Ring.MlockPrefault", 50, sizeof(elem), &attr);
+    /* Past RLIMIT_MEMLOCK the ring is not created at all */
+    if (!r) {
+        ASSERT_TRUE(errno == ENOMEM || errno == EPERM || errno == EAGAIN);
+        return;
+    }
+    ASSERT_EQ(r->flags & (RING_F_MLOCK | RING_F_PREFAULT), RING_F_MLOCK | RING_F_PREFAULT);
+    ASSERT_GT(LockedKb(), before);
+
+    /* The double mapping of a variable-length ring stays locked */
+    ring_attr vattr {RING_F_MLOCK | RING_F_VARLEN};
+    auto v = ring_init_attr("Ring.MlockPrefault.v", 16 * 1024, 0, &vattr);
+    ASSERT_NE(v, nullptr);
+    ASSERT_TRUE(v->flags & RING_F_MLOCK);
+    void* p = ring_reserve(v, 100);
+    ASSERT_NE(p, nullptr);
+    ring_commit(v, p);
+    ASSERT_EQ(ring_resize(v, 32 * 1024), 0);
+
+    /* Bad attributes are told apart from the rest */
+    ring_attr bad {0, RING_MAX_LANES + 1};
+    ASSERT_EQ(ring_init_attr("Ring.MlockPrefault.bad", 50, sizeof(elem), &bad), nullptr);
+    ASSERT_EQ(errno, EINVAL);
+
+    ring_free(v);
+    ring_free(r);
+    shm_unlink("SEG4xRING_Ring.MlockPrefault.v");
+    shm_unlink("SEG4xRING_Ring.MlockPrefault.v.1");
+    ASSERT_EQ(LockedKb(), before);
+}
+
+/* Bytes of ring segments in /dev/shm */
+size_t
+ShmBytes()
+{
+    size_t total = 0;
+    DIR* d = opendir("/dev/shm");
+    while (dirent* de = readdir(d)) {
+        struct stat st;
+        std::string path = std::string{"/dev/shm/"} + de->d_name;
+        if (strncmp(de->d_name, "SEG4xRING_", 10) == 0 && stat(path.c_str(), &st) == 0)
+            total += st.st_size;
+    }
+    closedir(d);
+    return total;
+}
+
+TEST(Ring, BudgetQuotaAndShrink) {
+    char budget[] = "/tmp/ring_budgetXXXXXX";
+    int fd = mkstemp(budget);
+    ASSERT_GE(fd, 0);
+    FILE* f = fdopen(fd, "w");
+    fprintf(f, "# ring segments on this host\n"
+               "quota budget_owner_1 4M\n"
+               "quota * 1G\n");
+    fclose(f);
+    setenv("MPL_SHM_BUDGET", budget, 1);
+
+    /* An elem ring takes about 1.6MB, so the owner gets two. The
+     * owner is what the creator says, whatever the ring's name. */
+    ring_attr owned {};
+    owned.owner = "budget_owner_1";
+    auto a = ring_init_attr("Ring.BudgetQuotaAndShrink.a", 50, sizeof(elem), &owned);
+    ASSERT_NE(a, nullptr);
+    auto b = ring_init_attr("Ring.BudgetQuotaAndShrink.b", 50, sizeof(elem), &owned);
+    ASSERT_NE(b, nullptr);
+    ASSERT_EQ(ring_init_attr("Ring.BudgetQuotaAndShrink.c", 50, sizeof(elem), &owned), nullptr);
+    ASSERT_EQ(errno, ENOSPC);
+    ASSERT_EQ(ring_lookup("Ring.BudgetQuotaAndShrink.c"), nullptr);
+    /* Attaching to a ring that exists costs nothing */
+    auto a2 = ring_init_attr("Ring.BudgetQuotaAndShrink.a", 50, sizeof(elem), &owned);
+    ASSERT_NE(a2, nullptr);
+    /* A ring created without an owner is its own */
+    auto other = ring_init("Ring.BudgetQuotaAndShrink.other", 50, sizeof(elem));
+    ASSERT_NE(other, nullptr);
+
+    /* With 4MB left and shrinking from 0%, a 3MB ring gets a record
+     * area of 2MB or less instead of 4MB */
+    f = fopen(budget, "w");
+    fprintf(f, "limit %zu\nshrink 0\n", ShmBytes() + 4 * 1024 * 1024);
+    fclose(f);
+    ring_attr attr {RING_F_VARLEN};
+    auto v = ring_init_attr("Ring.BudgetQuotaAndShrink.shrink_v", 3 * 1024 * 1024, 0, &attr);
+    ASSERT_NE(v, nullptr);
+    struct stat st;
+    ASSERT_EQ(stat("/dev/shm/SEG4xRING_Ring.BudgetQuotaAndShrink.shrink_v", &st), 0);
+    ASSERT_LT(st.st_size, 3 * 1024 * 1024);
+    void* p = ring_reserve(v, 1024);
+    ASSERT_NE(p, nullptr);
+    ring_commit(v, p);
+
+    unsetenv("MPL_SHM_BUDGET");
+    unlink(budget);
+    for (auto r : {a, b, a2, other, v}) {
+        ring_reclaim(r);
+        ring_free(r);
+    }
+}
+
+struct PopOp {
+    ring*   r;
+    elem*   e;
+};
+
+int
+pop_op(void* arg)
+{
+    auto op = static_cast<PopOp*>(arg);
+    return ring_dequeue(op->r, &op->e) == 0;
+}
+
+TEST(Ring, WaitForData) {
+    auto r = ring_init("Ring.WaitForData", 50, sizeof(elem));
+    auto rx = ring_lookup("Ring.WaitForData");
+    for (unsigned policy : {RING_WAIT_SPIN, RING_WAIT_YIELD, RING_WAIT_PARK,
+                            RING_WAIT_ADAPTIVE}) {
+        std::thread producer{[r]{
+            std::this_thread::sleep_for(20ms);
+            elem e {7};
+            ring_enqueue(r, &e);
+        }};
+        ring_wait w {policy, 100, 5000000};
+        PopOp op {rx, nullptr};
+        ASSERT_EQ(ring_wait_for(rx, &w, RING_EV_DATA, pop_op, &op), 1);
+        ASSERT_EQ(op.e->id, 7u);
+        free(op.e);
+        producer.join();
+    }
+    ring_free(rx);
+    ring_free(r);
+}
+
+TEST(Ring, WaitTimesOut) {
+    auto r = ring_init("Ring.WaitTimesOut", 50, sizeof(elem));
+    ring_wait w {RING_WAIT_PARK, 10, 20000};
+    PopOp op {r, nullptr};
+    auto t0 = std::chrono::steady_clock::now();
+    ASSERT_EQ(ring_wait_for(r, &w, RING_EV_DATA, pop_op, &op), 0);
+    ASSERT_GE(std::chrono::steady_clock::now() - t0, 20ms);
+
+    ring_wait none {};
+    ASSERT_EQ(ring_wait_for(r, &none, RING_EV_DATA, pop_op, &op), 0);
+    ring_free(r);
+}
+
+TEST(Ring, EnqueueWaitsForSpace) {
+    ring_attr attr {RING_F_BROADCAST};
+    auto r = ring_init_attr("Ring.EnqueueWaitsForSpace", 4, sizeof(elem), &attr);
+    auto rx = ring_lookup("Ring.EnqueueWaitsForSpace");
+    elem e {0};
+    for (size_t i = 0; i < 4; i++)
+        ASSERT_EQ(ring_enqueue(r, &e), 0);
+    std::thread consumer{[rx]{
+        std::this_thread::sleep_for(20ms);
+        elem out[4];
+        ring_dequeue_bulk(rx, out, 4);
+    }};
+    ring_wait w {RING_WAIT_PARK, 10, 5000000};
+    ASSERT_EQ(ring_enqueue_wait(r, &e, &w), 0);
+    /* One sequence number however long it waited */
+    ASSERT_EQ(e.seq, 4u);
+    consumer.join();
+    ring_free(rx);
+    ring_free(r);
+}
+
+TEST(Ring, AdaptiveWaitMeasuresGaps) {
+    auto r = ring_init("Ring.AdaptiveWaitMeasuresGaps", 50, sizeof(elem));
+    ring_wait w {RING_WAIT_ADAPTIVE, 100, 1000};
+    for (size_t i = 0; i < 10; i++) {
+        elem e {i};
+        ring_enqueue(r, &e);
+    }
+    PopOp op {r, nullptr};
+    for (size_t i = 0; i < 10; i++) {
+        ASSERT_EQ(ring_wait_for(r, &w, RING_EV_DATA, pop_op, &op), 1);
+        free(op.e);
+    }
+    ASSERT_GT(w.last_ns, 0u);
+    ASSERT_GT(w.gap_ns, 0u);
+    ring_free(r);
+}
+
 }
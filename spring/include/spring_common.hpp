@@ -1,17 +1,34 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <stdexcept>
 #include <string>
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-#include <ring.h>
+#include <ring.hpp>
+
+#include "spring_format.hpp"
+#include "spring_record.hpp"
+
+struct SpringError: public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
 
 /**
  * Used by any client to create a Spring to register on a
  * Registry and generate data items and publish them to
  * a ring buffer.
+ *
+ * If MPL_RELAY is set (e.g. "10.0.0.5:40050") the ring is
+ * registered as kFar at that relay address, so that Extractors on
+ * other hosts can read it.
+ *
+ * The constructors throw SpringError if the ring cannot be created,
+ * e.g. because it does not fit in the shared memory budget of the
+ * host or RING_F_MLOCK cannot lock it.
  * 
  */
 class Spring {
@@ -22,6 +39,30 @@ public:
                 std::size_t sz,
                 std::string addr = "127.0.0.1",
                 in_port_t port = 40040);
+    /**
+     * Same as above, but the ring is created with the given
+     * ring_attr (e.g. RING_F_HUGEPAGES | RING_F_PREFAULT).
+     * Producers that cannot afford a page fault in Push() ask for
+     * RING_F_MLOCK, which faults in and locks the whole segment up
+     * front.
+     * RING_F_STREAM has Push() write records into the ring with
+     * non-temporal stores, so that logging does not evict the
+     * working set of the pushing thread from its caches.
+     *
+     * With a non-zero ring_attr::nlanes the Spring runs in
+     * per-thread mode: each pushing thread claims its own
+     * single-producer lane in the channel's segment on its first
+     * Push, and timestamps its records so that an Extractor can
+     * merge the lanes in order. Threads that find no free lane
+     * share the multi-producer queue.
+     */
+    Spring(std::string ownr_name,
+                std::string channel_name,
+                std::size_t n,
+                std::size_t sz,
+                ring_attr const& attr,
+                std::string addr = "127.0.0.1",
+                in_port_t port = 40040);
     Spring(Spring const&) = delete;
     Spring(Spring&&) = delete;
     Spring& operator=(Spring const&) = delete;
@@ -30,14 +71,113 @@ public:
     void
     Push(std::string data, std::size_t id = 0);
 
+    /**
+     * Choose what Push() and Log() do when the ring is full. By
+     * default (RING_WAIT_NONE) the record is dropped; otherwise they
+     * wait for room as w says and drop it only on its timeout.
+     * Set it before pushing from several threads.
+     */
+    void
+    SetWaitStrategy(ring_wait const& w);
+
+    /**
+     * Move the channel to a ring of n bytes while it is in use, to
+     * grow one that keeps running full or shrink an idle one. Only
+     * rings created with RING_F_VARLEN can be resized; see
+     * ring_resize().
+     */
+    bool
+    Resize(std::size_t n);
+
+    /**
+     * Publish a printf-style format string for Log() and return
+     * its id. Call it once per call site and keep the id; the
+     * string is stored once in the channel's segment.
+     */
+    std::uint32_t
+    Format(char const* fmt);
+
+    /**
+     * Push a structured record: the id of a format string from
+     * Format() and the raw binary values of its arguments. The
+     * text is rendered by Extractor::Render(), so the producer
+     * only copies the arguments.
+     */
+    template <typename... Args>
+    void
+    Log(std::uint32_t fmt, std::size_t id, Args const&... args);
+
     ~Spring();
 
+    /**
+     * Push a structured record for the format string Fmt::str(),
+     * which is parsed and checked against Args at compile time.
+     * Use it through SPRING_LOG(), which passes the format string
+     * literal on as fmt as well; only Fmt::str() is used.
+     */
+    template <typename Fmt, typename... Args>
+    void
+    LogStatic(std::size_t id, char const* fmt, Args const&... args);
+
 private:
+    /// Call sites of SPRING_LOG() whose format id is cached.
+    static constexpr std::size_t kMaxLogSites = 1024;
+
+    void
+    Enqueue(elem& e);
+
+    /// The format id of a SPRING_LOG() call site on this Spring.
+    std::uint32_t
+    SiteFormat(std::size_t site, char const* fmt);
+
     /**
      * A multi-producer multi-consumer lockfree ring buffer
      * that resides in a shared memory by all interested parties.
      * This is unique for all BufferLocation instances that
-     * compare equal.
+     * compare equal. Threads that hold a lane in it keep a
+     * weak reference so they can hand the lane back on exit.
      */
-    ring* ring_;
-};
\ No newline at end of file
+    std::shared_ptr<ring> ring_;
+    /// ring_ as a typed ring whose push is compiled in here, unless
+    /// it has lanes or is a broadcast ring.
+    mpl::ring<elem> queue_;
+    /// Whether pushes go to per-thread lanes.
+    bool lanes_;
+    /// Shared by the pushing threads.
+    ring_wait wait_ = {};
+    /// Format ids of SPRING_LOG() call sites, 0 until published.
+    std::unique_ptr<std::atomic<std::uint32_t>[]> sites_;
+};
+
+template <typename... Args>
+void
+Spring::Log(std::uint32_t fmt, std::size_t id, Args const&... args)
+{
+    elem e;
+    e.id = id;
+    e.fmt = fmt;
+    record::EncodeAll(e.data, sizeof(e.data), args...);
+    Enqueue(e);
+}
+
+inline std::uint32_t
+Spring::SiteFormat(std::size_t site, char const* fmt)
+{
+    if (site >= kMaxLogSites)
+        return Format(fmt);
+    auto id = sites_[site].load(std::memory_order_relaxed);
+    if (!id) {
+        id = Format(fmt);
+        sites_[site].store(id, std::memory_order_relaxed);
+    }
+    return id;
+}
+
+template <typename Fmt, typename... Args>
+void
+Spring::LogStatic(std::size_t id, char const*, Args const&... args)
+{
+    static_assert(logfmt::Check<Fmt, Args...>());
+    static std::size_t const site = logfmt::NextSite();
+    Log(SiteFormat(site, Fmt::str()), id, args...);
+}
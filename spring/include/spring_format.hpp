@@ -0,0 +1,216 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include <ring.h>
+
+/**
+ * Compile-time parsing of printf-style format strings for
+ * SPRING_LOG(). A format string is turned into a fixed list of
+ * argument kinds, which is checked against the argument types
+ * of the call site; mismatches fail to compile.
+ */
+namespace logfmt {
+
+/// The argument kind a conversion specifier expects.
+enum class Kind : char {
+    kInteger,
+    kFloat,
+    kString,
+    kPointer,
+    kInvalid,
+};
+
+constexpr std::size_t npos = SIZE_MAX;
+
+constexpr Kind
+KindOf(char conv)
+{
+    switch (conv) {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        return Kind::kInteger;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        return Kind::kFloat;
+    case 's':
+        return Kind::kString;
+    case 'p':
+        return Kind::kPointer;
+    default:
+        return Kind::kInvalid;
+    }
+}
+
+constexpr bool
+IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+constexpr bool
+IsFlag(char c)
+{
+    return c == '-' || c == '+' || c == ' ' || c == '#' || c == '0';
+}
+
+constexpr bool
+IsLengthModifier(char c)
+{
+    return c == 'h' || c == 'l' || c == 'L' || c == 'q' ||
+           c == 'j' || c == 'z' || c == 't';
+}
+
+/**
+ * Count the conversions in fmt and store up to max of their kinds
+ * in kinds. Returns npos if fmt is malformed or uses a conversion
+ * structured records cannot carry (e.g. '*' widths or %n).
+ */
+constexpr std::size_t
+Parse(char const* f, Kind* kinds, std::size_t max)
+{
+    std::size_t n = 0;
+    while (*f) {
+        if (*f++ != '%')
+            continue;
+        if (*f == '%') {
+            f++;
+            continue;
+        }
+        while (IsFlag(*f))
+            f++;
+        while (IsDigit(*f))
+            f++;
+        if (*f == '.') {
+            f++;
+            while (IsDigit(*f))
+                f++;
+        }
+        while (IsLengthModifier(*f))
+            f++;
+        Kind k = KindOf(*f);
+        if (k == Kind::kInvalid)
+            return npos;
+        if (n < max)
+            kinds[n] = k;
+        n++;
+        f++;
+    }
+    return n;
+}
+
+/**
+ * The argument layout of the format string F::str(). Call sites
+ * are checked against it; the arguments themselves are encoded by
+ * record::EncodeAll(), whose tags follow their types.
+ */
+template <typename F>
+struct Layout {
+    static constexpr std::size_t kCount = Parse(F::str(), nullptr, 0);
+    static_assert(kCount != npos, "Malformed log format string");
+    static constexpr std::size_t kSize = kCount == npos ? 0 : kCount;
+
+    static constexpr std::array<Kind, kSize> kKinds = [] {
+        std::array<Kind, kSize> kinds{};
+        Parse(F::str(), kinds.data(), kSize);
+        return kinds;
+    }();
+};
+
+template <typename T>
+constexpr bool
+Accepts(Kind k)
+{
+    using U = std::decay_t<T>;
+    switch (k) {
+    case Kind::kInteger:
+        return std::is_integral_v<U> || std::is_enum_v<U>;
+    case Kind::kFloat:
+        return std::is_floating_point_v<U>;
+    case Kind::kString:
+        return std::is_same_v<U, char*> || std::is_same_v<U, char const*> ||
+               std::is_convertible_v<T const&, std::string_view>;
+    case Kind::kPointer:
+        return std::is_pointer_v<U>;
+    default:
+        return false;
+    }
+}
+
+template <typename F, typename... Args, std::size_t... I>
+constexpr bool
+Matches(std::index_sequence<I...>)
+{
+    return (Accepts<Args>(Layout<F>::kKinds[I]) && ...);
+}
+
+/// Encoded size of an argument, counting strings as empty.
+template <typename T>
+constexpr std::size_t
+MinEncodedSize()
+{
+    using U = std::decay_t<T>;
+    if constexpr (std::is_arithmetic_v<U> || std::is_enum_v<U> ||
+                  (std::is_pointer_v<U> && !Accepts<T>(Kind::kString)))
+        return 1 + sizeof(uint64_t);
+    else
+        return 1 + sizeof(uint16_t);
+}
+
+/**
+ * Check a call site at compile time: the argument count and
+ * types must match the conversions of F::str(), and the fixed
+ * size arguments must fit into one record.
+ */
+template <typename F, typename... Args>
+constexpr bool
+Check()
+{
+    static_assert(Layout<F>::kCount == sizeof...(Args),
+                  "Log format string and argument count differ");
+    if constexpr (Layout<F>::kCount == sizeof...(Args)) {
+        static_assert(Matches<F, Args...>(std::index_sequence_for<Args...>{}),
+                      "Log argument type does not match its conversion");
+        static_assert((MinEncodedSize<Args>() + ... + 0) <= kElemDataSz,
+                      "Log arguments do not fit into a record");
+    }
+    return true;
+}
+
+/**
+ * A process-wide index for every SPRING_LOG() call site, used by
+ * a Spring to cache the id of the site's format string.
+ */
+inline std::size_t
+NextSite()
+{
+    static std::atomic<std::size_t> sites{0};
+    return sites.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace logfmt
+
+/**
+ * Push a structured record through spring, checking fmt against
+ * the arguments at compile time:
+ *
+ *     SPRING_LOG(sp, id, "user %s logged in %d times", user, count);
+ *
+ * The format string is published the first time the call site
+ * runs on a Spring; afterwards a call only copies its arguments.
+ */
+#define SPRING_LOG(spring, id, ...)                                     \
+    do {                                                                \
+        struct SpringLogFmt_ {                                          \
+            static constexpr char const* str() {                        \
+                return SPRING_LOG_FMT_(__VA_ARGS__, _);                 \
+            }                                                           \
+        };                                                              \
+        (spring).LogStatic<SpringLogFmt_>((id), __VA_ARGS__);           \
+    } while (0)
+
+#define SPRING_LOG_FMT_(fmt, ...) fmt
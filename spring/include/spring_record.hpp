@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+#include <ring.h>
+
+/**
+ * Binary encoding of the arguments of structured Spring records.
+ * Each argument is a ring_arg_type tag followed by its raw value;
+ * the Extractor renders them against the published format string.
+ */
+namespace record {
+
+template <typename T>
+inline constexpr bool kUnsupported = false;
+
+/**
+ * Append a tag and the bytes of v at p, if both fit before end.
+ */
+template <typename T>
+inline bool
+Put(char*& p, char const* end, ring_arg_type tag, T v)
+{
+    if (end - p < static_cast<std::ptrdiff_t>(1 + sizeof(v)))
+        return false;
+    *p++ = tag;
+    memcpy(p, &v, sizeof(v));
+    p += sizeof(v);
+    return true;
+}
+
+/**
+ * Append a string argument, truncated to what fits before end.
+ */
+inline bool
+PutStr(char*& p, char const* end, std::string_view s)
+{
+    if (end - p < 3)
+        return false;
+    uint16_t n = std::min<std::size_t>({s.size(),
+                                        static_cast<std::size_t>(end - p - 3),
+                                        UINT16_MAX});
+    *p++ = RING_ARG_STR;
+    memcpy(p, &n, sizeof(n));
+    p += sizeof(n);
+    memcpy(p, s.data(), n);
+    p += n;
+    return true;
+}
+
+template <typename T>
+inline bool
+Encode(char*& p, char const* end, T const& v)
+{
+    using U = std::decay_t<T>;
+    if constexpr (std::is_array_v<T> &&
+                  std::is_same_v<std::remove_cv_t<std::remove_extent_t<T>>, char>)
+        return PutStr(p, end, std::string_view{v, strnlen(v, std::extent_v<T>)});
+    else if constexpr (std::is_same_v<U, bool> ||
+                  (std::is_integral_v<U> && std::is_unsigned_v<U>))
+        return Put(p, end, RING_ARG_U64, static_cast<uint64_t>(v));
+    else if constexpr (std::is_integral_v<U> || std::is_enum_v<U>)
+        return Put(p, end, RING_ARG_I64, static_cast<int64_t>(v));
+    else if constexpr (std::is_floating_point_v<U>)
+        return Put(p, end, RING_ARG_F64, static_cast<double>(v));
+    else if constexpr (std::is_same_v<U, char*> || std::is_same_v<U, char const*>)
+        return PutStr(p, end, v ? std::string_view{v} : std::string_view{"(null)"});
+    else if constexpr (std::is_convertible_v<U const&, std::string_view>)
+        return PutStr(p, end, std::string_view{v});
+    else if constexpr (std::is_pointer_v<U>)
+        return Put(p, end, RING_ARG_PTR, reinterpret_cast<uint64_t>(v));
+    else
+        static_assert(kUnsupported<U>, "Unsupported structured log argument type");
+}
+
+/**
+ * Encode args into buf; arguments that do not fit are dropped
+ * and show up as missing when the record is rendered.
+ */
+template <typename... Args>
+inline void
+EncodeAll(char* buf, std::size_t sz, Args const&... args)
+{
+    char* p = buf;
+    char const* end = buf + sz;
+    static_cast<void>((Encode(p, end, args) && ...));
+    if (p < end)
+        *p = RING_ARG_END;
+}
+
+} // namespace record
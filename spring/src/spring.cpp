@@ -1,5 +1,9 @@
-#include <registry_client.hpp>
-#include "spring_lcl.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -8,33 +12,162 @@
 #include <registry_client.hpp>
 
 #include "spring_lcl.hpp"
-#include <ring.h>
+#include <ring.hpp>
+
+namespace {
+
+/**
+ * The lanes the calling thread has claimed, one per per-thread
+ * mode Spring it has pushed to. Lanes of Springs that are still
+ * around are handed back when the thread exits.
+ */
+class ThreadLanes {
+public:
+    ThreadLanes() = default;
+    ThreadLanes(ThreadLanes const&) = delete;
+    ThreadLanes& operator=(ThreadLanes const&) = delete;
+
+    ~ThreadLanes() {
+        for (auto& l : lanes_)
+            if (auto r = l.owner.lock(); r && l.lane >= 0)
+                ring_lane_release(r.get(), l.lane);
+    }
+
+    /**
+     * The lane of this thread in r, claimed on first use. Returns
+     * -1 if all lanes were taken when this thread first asked.
+     */
+    int Get(std::shared_ptr<ring> const& r) {
+        for (auto const& l : lanes_)
+            if (l.r == r.get() && !l.owner.expired())
+                return l.lane;
+        lanes_.erase(std::remove_if(begin(lanes_), end(lanes_),
+                                    [](auto const& l){ return l.owner.expired(); }),
+                     end(lanes_));
+        int lane = ring_lane_claim(r.get());
+        lanes_.push_back({r, r.get(), lane});
+        return lane;
+    }
+
+private:
+    struct Lane {
+        std::weak_ptr<ring> owner;
+        ring*               r;
+        int                 lane;
+    };
+    std::vector<Lane> lanes_;
+};
+
+thread_local ThreadLanes tl_lanes;
+
+uint64_t
+timestamp()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+}
+
+Spring::Spring(std::string ownr_name,
+               std::string channel_name,
+               std::size_t n,
+               std::size_t sz,
+               std::string addr,
+               in_port_t port)
+    : Spring{ownr_name, channel_name, n, sz, ring_attr{}, addr, port}
+{}
 
 Spring::Spring(std::string ownr_name,
                std::string channel_name,
                std::size_t n,
                std::size_t sz,
+               ring_attr const& attr,
                std::string addr,
                in_port_t port)
+    : lanes_{attr.nlanes > 0},
+      sites_{new std::atomic<std::uint32_t>[kMaxLogSites]()}
 {
     using namespace registry;
     auto ring_name = ownr_name + "_" + channel_name;
     sockaddr_in reg_sin = {AF_INET, port, 0};
     inet_pton(AF_INET, addr.c_str(), &(reg_sin.sin_addr));
     SpringRegistryClient const src{ownr_name, RegistryLocation{reg_sin}};
+    /* Rings of a host that runs a relay are published as kFar so
+     * that extractors elsewhere read them through it. */
     BufferLocation bloc = BufferLocation{channel_name};
+    if (char const* relay = getenv("MPL_RELAY")) {
+        auto raddr = netaddr_from_string(relay);
+        if (!std::holds_alternative<std::monostate>(raddr))
+            bloc = BufferLocation{channel_name, raddr};
+    }
+    /* The budget of the host charges the ring to its owner */
+    ring_attr owned = attr;
+    owned.owner = ownr_name.c_str();
+    /* Only a ring that exists is published */
+    ring_ = std::shared_ptr<ring>{ring_init_attr(ring_name.c_str(), n, sz, &owned),
+                                  ring_free};
+    if (!ring_)
+        throw SpringError{"cannot create ring " + ring_name + ": " + strerror(errno)};
+    queue_ = mpl::ring<elem>{ring_.get()};
     src.publish(bloc);
-    ring_ = ring_init(ring_name.c_str(), n, sz);
 }
 
 Spring::~Spring()
-{}
+{
+    /* The segment stays behind so that extractors can drain it;
+     * they reclaim it once they notice we are gone. */
+    if (lanes_)
+        ring_lane_release_all(ring_.get());
+}
 
 void
 Spring::Push(std::string data, std::size_t id)
 {
     elem e;
     e.id = id;
+    e.fmt = 0;
     snprintf(e.data, sizeof(e.data), "%s", data.c_str());
-    ring_enqueue(ring_, &e);
+    Enqueue(e);
+}
+
+std::uint32_t
+Spring::Format(char const* fmt)
+{
+    return ring_fmt_register(ring_.get(), fmt);
+}
+
+void
+Spring::SetWaitStrategy(ring_wait const& w)
+{
+    wait_ = w;
+}
+
+bool
+Spring::Resize(std::size_t n)
+{
+    return ring_resize(ring_.get(), n) == 0;
+}
+
+void
+Spring::Enqueue(elem& e)
+{
+    if (queue_) {
+        e.ts = 0;
+        e.seq = queue_.next_seq();
+        queue_.push(e, wait_);
+        return;
+    }
+    if (!lanes_) {
+        e.ts = 0;
+        ring_enqueue_wait(ring_.get(), &e, &wait_);
+        return;
+    }
+    e.ts = timestamp();
+    int lane = tl_lanes.Get(ring_);
+    if (lane >= 0)
+        ring_lane_enqueue_wait(ring_.get(), lane, &e, &wait_);
+    else
+        ring_enqueue_wait(ring_.get(), &e, &wait_);
 }
@@ -1,8 +1,17 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include <ring.h>
 #include <spring.hpp>
 
+#include <unistd.h>
+#include <sys/mman.h>
+
 using ::testing::EmptyTestEventListener;
 using ::testing::InitGoogleTest;
 using ::testing::Test;
@@ -22,6 +31,91 @@ TEST(Spring, Create) {
     sp.Push("[128572] a log item is here", 128570);
 }
 
+TEST(Spring, CreateHugePages) {
+    ring_attr attr {RING_F_HUGEPAGES | RING_F_PREFAULT};
+    Spring sp{"python2.7", "hp_chan", 128, sizeof(elem), attr};
+    sp.Push("[128572] a log item is here", 128570);
+}
+
+TEST(Spring, CreateLocked) {
+    ring_attr attr {RING_F_MLOCK};
+    try {
+        Spring sp{"python2.7", "lk_chan", 128, sizeof(elem), attr};
+        sp.Push("[128572] a log item is here", 128570);
+    } catch (SpringError const& e) {
+        /* Only past RLIMIT_MEMLOCK */
+        ASSERT_NE(strstr(e.what(), "lk_chan"), nullptr);
+    }
+    ring_attr bad {0, RING_MAX_LANES + 1};
+    ASSERT_THROW((Spring{"python2.7", "bad_chan", 128, sizeof(elem), bad}), SpringError);
+}
+
+TEST(Spring, PerThreadPush) {
+    ring_attr attr {0, 4};
+    {
+        Spring sp{"python2.7", "pt_chan", 128, sizeof(elem), attr};
+        std::vector<std::thread> producers;
+        for (int t = 0; t < 6; t++)
+            producers.emplace_back([&sp]{
+                for (int i = 0; i < 100; i++)
+                    sp.Push("[128572] a log item is here", i);
+            });
+        for (auto& p : producers)
+            p.join();
+    }
+    auto r = ring_lookup("python2.7_pt_chan");
+    ASSERT_NE(r, nullptr);
+    elem* e;
+    int count = 0;
+    while (ring_dequeue(r, &e) == 0) {
+        count++;
+        free(e);
+    }
+    ASSERT_EQ(count, 600);
+    ring_free(r);
+}
+
+TEST(Spring, OwnerQuota) {
+    char const* segs[] = {"SEG4xRING_spring_owner_1_q1_chan", "SEG4xRING_spring_owner_1_q2_chan"};
+    for (auto seg : segs)
+        shm_unlink(seg);
+    char budget[] = "/tmp/spring_budgetXXXXXX";
+    int fd = mkstemp(budget);
+    ASSERT_GE(fd, 0);
+    FILE* f = fdopen(fd, "w");
+    fprintf(f, "quota spring_owner_1 2M\n"
+               "quota * 1G\n");
+    fclose(f);
+    setenv("MPL_SHM_BUDGET", budget, 1);
 
+    /* The quota of the owner holds one ring of about 1.6MB, though
+     * its name has '_' in it like the names of its rings */
+    {
+        Spring sp{"spring_owner_1", "q1_chan", 128, sizeof(elem)};
+        ASSERT_THROW((Spring{"spring_owner_1", "q2_chan", 128, sizeof(elem)}), SpringError);
+    }
+
+    unsetenv("MPL_SHM_BUDGET");
+    unlink(budget);
+    for (auto seg : segs)
+        shm_unlink(seg);
 }
 
+static_assert(logfmt::Parse("no conversions", nullptr, 0) == 0);
+static_assert(logfmt::Parse("%-8s took %5.2fms (%lu, %%)", nullptr, 0) == 3);
+static_assert(logfmt::Parse("%*d", nullptr, 0) == logfmt::npos);
+static_assert(logfmt::Parse("trailing %", nullptr, 0) == logfmt::npos);
+static_assert(logfmt::Accepts<char const*>(logfmt::Kind::kString));
+static_assert(!logfmt::Accepts<double>(logfmt::Kind::kString));
+static_assert(!logfmt::Accepts<char const*>(logfmt::Kind::kInteger));
+static_assert(logfmt::Accepts<float>(logfmt::Kind::kFloat));
+static_assert(!logfmt::Accepts<int>(logfmt::Kind::kFloat));
+
+TEST(Spring, LogStatic) {
+    Spring sp{"python2.7", "st_chan", 128, sizeof(elem)};
+    for (int i = 0; i < 3; i++)
+        SPRING_LOG(sp, i, "request %s took %.3f ms", "GET /", 1.5 * i);
+    SPRING_LOG(sp, 3, "no arguments");
+}
+
+}
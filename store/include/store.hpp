@@ -0,0 +1,7 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "store_common.hpp"
+
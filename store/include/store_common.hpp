@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace store
+{
+
+struct StoreError: public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+struct StoreOptions {
+    /// Seal the data file and start a new segment past this size.
+    std::size_t max_segment = 256 << 20;
+    /// Records of one channel covered by one index entry.
+    unsigned block_records = 64;
+};
+
+/**
+ * @brief One stored record, as handed to a query callback. The
+ * views are valid for the duration of the callback only.
+ */
+struct Record {
+    /// Wall clock time the record was stored, in ns since the epoch.
+    std::uint64_t       time;
+    /// The elem::id of the record.
+    std::uint64_t       id;
+    std::string_view    owner;
+    std::string_view    channel;
+    std::string_view    text;
+};
+
+class Segment;
+
+/**
+ * @brief An append-only store of collected records that can be
+ * queried by channel and time or id range without scanning.
+ *
+ * Records go to a series of segments in dir: a data file that
+ * records are appended to and, once the segment is sealed, a
+ * sparse index. Each index entry covers a block of consecutive
+ * records of one channel and holds their time span and id range.
+ * Entries are sorted by channel and time, so a time window is
+ * located by binary search on the memory-mapped index; id queries
+ * skip every block whose id range does not overlap.
+ *
+ * A segment left without an index by a crash is re-indexed when
+ * the store is opened.
+ */
+class LogStore {
+public:
+    using Visitor = std::function<void(Record const&)>;
+
+    /**
+     * Open the store in dir, creating it if needed.
+     *
+     * @throw StoreError if dir cannot be used.
+     */
+    LogStore(std::string dir, StoreOptions opts = {});
+    LogStore(LogStore const&) = delete;
+    LogStore(LogStore&&) = delete;
+    LogStore& operator=(LogStore const&) = delete;
+    LogStore& operator=(LogStore&&) = delete;
+    ~LogStore();
+
+    /**
+     * Append a record stamped with the current time (never earlier
+     * than the previous record's).
+     *
+     * @throw StoreError on write errors.
+     */
+    void Append(std::string_view owner, std::string_view channel,
+                std::uint64_t id, std::string_view text);
+
+    /**
+     * Write buffered records to the active data file.
+     */
+    void Flush();
+
+    /**
+     * Visit the records of owner/channel stored in [t0, t1), oldest
+     * first.
+     *
+     * @return The number of records visited.
+     */
+    std::size_t Query(std::string_view owner, std::string_view channel,
+                      std::uint64_t t0, std::uint64_t t1,
+                      Visitor const& fn);
+
+    /**
+     * Visit the records of owner/channel whose id is in [id0, id1],
+     * oldest first.
+     *
+     * @return The number of records visited.
+     */
+    std::size_t QueryId(std::string_view owner, std::string_view channel,
+                        std::uint64_t id0, std::uint64_t id1,
+                        Visitor const& fn);
+
+private:
+    void Seal();
+    void Start();
+
+    std::string dir_;
+    StoreOptions opts_;
+    std::vector<std::unique_ptr<Segment>> sealed_;
+    std::unique_ptr<Segment> active_;
+    unsigned seq_ = 0;
+    std::uint64_t last_time_ = 0;
+};
+
+}
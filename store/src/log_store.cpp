@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "store_lcl.hpp"
+
+namespace store
+{
+
+namespace {
+
+uint64_t
+wallclock()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * The numbers of the <n>.dat files in dir, in ascending order.
+ */
+std::vector<unsigned>
+list_segments(std::string const& dir)
+{
+    std::vector<unsigned> seqs;
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+        throw StoreError{"opendir " + dir + ": " + strerror(errno)};
+    while (auto de = readdir(d)) {
+        char* end;
+        auto n = strtoul(de->d_name, &end, 10);
+        if (end != de->d_name && strcmp(end, ".dat") == 0)
+            seqs.push_back(n);
+    }
+    closedir(d);
+    std::sort(begin(seqs), end(seqs));
+    return seqs;
+}
+
+}
+
+LogStore::LogStore(std::string dir, StoreOptions opts)
+    : dir_{std::move(dir)},
+      opts_{opts}
+{
+    if (mkdir(dir_.c_str(), 0755) < 0 && errno != EEXIST)
+        throw StoreError{"mkdir " + dir_ + ": " + strerror(errno)};
+    for (auto seq : list_segments(dir_)) {
+        auto s = Segment::Open(dir_, seq, opts_.block_records);
+        seq_ = seq + 1;
+        if (s->Empty()) {
+            s->Discard();
+            continue;
+        }
+        last_time_ = std::max(last_time_, s->TMax());
+        sealed_.push_back(std::move(s));
+    }
+    Start();
+}
+
+LogStore::~LogStore()
+{
+    try {
+        if (active_->Empty())
+            active_->Discard();
+        else
+            active_->Seal();
+    } catch (StoreError const&) {}
+}
+
+void
+LogStore::Start()
+{
+    active_ = Segment::Create(dir_, seq_++, opts_.block_records);
+}
+
+void
+LogStore::Seal()
+{
+    active_->Seal();
+    sealed_.push_back(std::move(active_));
+    Start();
+}
+
+void
+LogStore::Append(std::string_view owner, std::string_view channel,
+                 std::uint64_t id, std::string_view text)
+{
+    /* Keep time non-decreasing so that the index stays sorted even
+     * if the wall clock steps back. */
+    last_time_ = std::max(wallclock(), last_time_);
+    active_->Append(last_time_, owner, channel, id, text);
+    if (active_->Size() >= opts_.max_segment)
+        Seal();
+}
+
+void
+LogStore::Flush()
+{
+    active_->Flush();
+}
+
+std::size_t
+LogStore::Query(std::string_view owner, std::string_view channel,
+                std::uint64_t t0, std::uint64_t t1, Visitor const& fn)
+{
+    std::size_t n = 0;
+    for (auto const& s : sealed_)
+        n += s->Query(owner, channel, true, t0, t1, fn);
+    return n + active_->Query(owner, channel, true, t0, t1, fn);
+}
+
+std::size_t
+LogStore::QueryId(std::string_view owner, std::string_view channel,
+                  std::uint64_t id0, std::uint64_t id1, Visitor const& fn)
+{
+    std::size_t n = 0;
+    for (auto const& s : sealed_)
+        n += s->Query(owner, channel, false, id0, id1, fn);
+    return n + active_->Query(owner, channel, false, id0, id1, fn);
+}
+
+}
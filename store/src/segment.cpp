@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "store_lcl.hpp"
+
+namespace store
+{
+
+namespace {
+
+constexpr std::size_t kWriteBuf = 64 * 1024;
+
+std::string
+seg_path(std::string const& dir, unsigned seq, char const* ext)
+{
+    return dir + "/" + std::to_string(seq) + ext;
+}
+
+[[noreturn]] void
+throw_errno(std::string const& what)
+{
+    throw StoreError{what + ": " + strerror(errno)};
+}
+
+/**
+ * Map all of path read only. Returns nullptr if the file is
+ * missing or empty.
+ */
+char const*
+map_file(std::string const& path, std::size_t& size)
+{
+    size = 0;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        throw_errno("mmap " + path);
+    size = st.st_size;
+    return static_cast<char const*>(p);
+}
+
+void
+write_all(int fd, char const* p, std::size_t len, std::string const& path)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw_errno("write " + path);
+        p += n;
+        len -= n;
+    }
+}
+
+/// Unmaps on scope exit.
+struct Mapping {
+    char const* p = nullptr;
+    std::size_t size = 0;
+    ~Mapping() {
+        if (p)
+            munmap(const_cast<char*>(p), size);
+    }
+};
+
+}
+
+Segment::Segment(std::string const& dir, unsigned seq, unsigned block_records)
+    : data_path_{seg_path(dir, seq, ".dat")},
+      idx_path_{seg_path(dir, seq, ".idx")},
+      block_records_{std::max(block_records, 1u)}
+{}
+
+std::unique_ptr<Segment>
+Segment::Create(std::string const& dir, unsigned seq, unsigned block_records)
+{
+    std::unique_ptr<Segment> s{new Segment{dir, seq, block_records}};
+    s->fd_ = open(s->data_path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (s->fd_ < 0)
+        throw_errno("open " + s->data_path_);
+    return s;
+}
+
+std::unique_ptr<Segment>
+Segment::Open(std::string const& dir, unsigned seq, unsigned block_records)
+{
+    std::unique_ptr<Segment> s{new Segment{dir, seq, block_records}};
+    if (!s->LoadIndex())
+        s->Rebuild();
+    return s;
+}
+
+Segment::~Segment()
+{
+    if (fd_ >= 0) {
+        try {
+            Flush();
+        } catch (StoreError const&) {}
+        close(fd_);
+    }
+    if (idx_map_)
+        munmap(const_cast<char*>(idx_map_), idx_size_);
+    if (data_map_)
+        munmap(const_cast<char*>(data_map_), data_size_);
+}
+
+uint32_t
+Segment::Stream(std::string_view owner, std::string_view channel)
+{
+    std::string key{owner};
+    key += '\0';
+    key += channel;
+    auto it = stream_ids_.find(key);
+    if (it != stream_ids_.end())
+        return it->second;
+
+    uint32_t s = streams_.size();
+    streams_.emplace_back(owner, channel);
+    stream_ids_.emplace(key, s);
+    open_.push_back(-1);
+    Write(RecHdr{0, s, kStreamDef, static_cast<uint32_t>(key.size())}, key);
+    return s;
+}
+
+void
+Segment::Append(uint64_t time, std::string_view owner, std::string_view channel,
+                uint64_t id, std::string_view text)
+{
+    auto s = Stream(owner, channel);
+    RecHdr h{time, id, s, static_cast<uint32_t>(text.size())};
+    auto off = Size();
+    Write(h, text);
+    Index(h, off);
+}
+
+void
+Segment::Write(RecHdr const& h, std::string_view text)
+{
+    static char const kPad[8] = {};
+    buf_.append(reinterpret_cast<char const*>(&h), sizeof(h));
+    buf_.append(text);
+    buf_.append(kPad, rec_size(h.len) - sizeof(h) - h.len);
+    if (buf_.size() >= kWriteBuf)
+        Flush();
+}
+
+void
+Segment::Index(RecHdr const& h, uint64_t off)
+{
+    tmin_ = std::min(tmin_, h.time);
+    tmax_ = std::max(tmax_, h.time);
+    auto& o = open_[h.stream];
+    if (o < 0 || entries_[o].count >= block_records_) {
+        entries_.push_back(IdxEntry{h.stream, 0, h.time, h.time, h.id, h.id, off, off});
+        o = entries_.size() - 1;
+    }
+    auto& e = entries_[o];
+    e.count++;
+    e.time_last = h.time;
+    e.id_min = std::min(e.id_min, h.id);
+    e.id_max = std::max(e.id_max, h.id);
+    e.off_last = off;
+}
+
+void
+Segment::Flush()
+{
+    if (buf_.empty())
+        return;
+    write_all(fd_, buf_.data(), buf_.size(), data_path_);
+    size_ += buf_.size();
+    buf_.clear();
+}
+
+void
+Segment::Seal()
+{
+    Flush();
+    close(fd_);
+    fd_ = -1;
+    WriteIndex();
+    if (!LoadIndex())
+        throw StoreError{"cannot load index " + idx_path_};
+}
+
+void
+Segment::Discard()
+{
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    buf_.clear();
+    unlink(data_path_.c_str());
+    unlink(idx_path_.c_str());
+}
+
+void
+Segment::WriteIndex()
+{
+    std::stable_sort(begin(entries_), end(entries_),
+                     [](auto const& a, auto const& b){ return a.stream < b.stream; });
+
+    std::string out(sizeof(IdxHdr), '\0');
+    for (auto const& [owner, channel] : streams_) {
+        uint16_t len[2] = {static_cast<uint16_t>(owner.size()),
+                           static_cast<uint16_t>(channel.size())};
+        out.append(reinterpret_cast<char const*>(len), sizeof(len));
+        out += owner;
+        out += channel;
+    }
+    out.resize((out.size() + 7) & ~std::size_t{7}, '\0');
+    IdxHdr hdr{kIdxMagic, kIdxVersion, size_, tmin_, tmax_,
+               static_cast<uint32_t>(streams_.size()),
+               static_cast<uint32_t>(entries_.size()),
+               out.size() - sizeof(IdxHdr)};
+    memcpy(out.data(), &hdr, sizeof(hdr));
+    out.append(reinterpret_cast<char const*>(entries_.data()),
+               entries_.size() * sizeof(IdxEntry));
+
+    /* Readers either see the previous index or the whole new one. */
+    auto tmp = idx_path_ + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw_errno("open " + tmp);
+    try {
+        write_all(fd, out.data(), out.size(), tmp);
+    } catch (StoreError const&) {
+        close(fd);
+        unlink(tmp.c_str());
+        throw;
+    }
+    close(fd);
+    if (rename(tmp.c_str(), idx_path_.c_str()) < 0)
+        throw_errno("rename " + tmp);
+    entries_.clear();
+    entries_.shrink_to_fit();
+}
+
+bool
+Segment::LoadIndex()
+{
+    Mapping idx;
+    idx.p = map_file(idx_path_, idx.size);
+    if (!idx.p || idx.size < sizeof(IdxHdr))
+        return false;
+    IdxHdr hdr;
+    memcpy(&hdr, idx.p, sizeof(hdr));
+    struct stat st;
+    if (hdr.magic != kIdxMagic || hdr.version != kIdxVersion ||
+        stat(data_path_.c_str(), &st) < 0 ||
+        static_cast<uint64_t>(st.st_size) != hdr.data_size ||
+        sizeof(hdr) + hdr.streams_size + uint64_t{hdr.nentries} * sizeof(IdxEntry) > idx.size)
+        return false;
+
+    streams_.clear();
+    stream_ids_.clear();
+    char const* p = idx.p + sizeof(hdr);
+    char const* end = p + hdr.streams_size;
+    for (uint32_t i = 0; i < hdr.nstreams; i++) {
+        uint16_t len[2];
+        if (end - p < static_cast<std::ptrdiff_t>(sizeof(len)))
+            return false;
+        memcpy(len, p, sizeof(len));
+        p += sizeof(len);
+        if (end - p < len[0] + len[1])
+            return false;
+        std::string owner{p, len[0]};
+        std::string channel{p + len[0], len[1]};
+        p += len[0] + len[1];
+        stream_ids_.emplace(owner + '\0' + channel, i);
+        streams_.emplace_back(std::move(owner), std::move(channel));
+    }
+
+    data_map_ = map_file(data_path_, data_size_);
+    size_ = data_size_;
+    tmin_ = hdr.tmin;
+    tmax_ = hdr.tmax;
+    sealed_ = reinterpret_cast<IdxEntry const*>(end);
+    nsealed_ = hdr.nentries;
+    idx_map_ = idx.p;
+    idx_size_ = idx.size;
+    idx.p = nullptr;
+    return true;
+}
+
+void
+Segment::Rebuild()
+{
+    Mapping data;
+    data.p = map_file(data_path_, data.size);
+    uint64_t off = 0;
+    while (data.p && off + sizeof(RecHdr) <= data.size) {
+        RecHdr h;
+        memcpy(&h, data.p + off, sizeof(h));
+        if (off + rec_size(h.len) > data.size)
+            break;
+        if (h.stream == kStreamDef) {
+            std::string key{data.p + off + sizeof(h), h.len};
+            auto nul = key.find('\0');
+            if (h.id != streams_.size() || nul == std::string::npos)
+                break;
+            stream_ids_.emplace(key, h.id);
+            streams_.emplace_back(key.substr(0, nul), key.substr(nul + 1));
+            open_.push_back(-1);
+        } else if (h.stream < streams_.size()) {
+            Index(h, off);
+        } else {
+            break;
+        }
+        off += rec_size(h.len);
+    }
+    /* Whatever follows the last whole record was torn by a crash. */
+    if (off < data.size && truncate(data_path_.c_str(), off) < 0)
+        throw_errno("truncate " + data_path_);
+    size_ = off;
+    WriteIndex();
+    if (!LoadIndex())
+        throw StoreError{"cannot load index " + idx_path_};
+}
+
+std::size_t
+Segment::Query(std::string_view owner, std::string_view channel,
+               bool by_time, uint64_t lo, uint64_t hi,
+               LogStore::Visitor const& fn)
+{
+    if (Empty() || (by_time && (hi <= tmin_ || lo > tmax_)))
+        return 0;
+    std::string key{owner};
+    key += '\0';
+    key += channel;
+    auto sit = stream_ids_.find(key);
+    if (sit == stream_ids_.end())
+        return 0;
+    uint32_t s = sit->second;
+
+    IdxEntry const* first;
+    IdxEntry const* last;
+    char const* data;
+    Mapping active;
+    std::vector<IdxEntry> mine;
+    if (fd_ < 0) {
+        auto cmp = [](IdxEntry const& e, uint32_t s){ return e.stream < s; };
+        first = std::lower_bound(sealed_, sealed_ + nsealed_, s, cmp);
+        last = first;
+        while (last != sealed_ + nsealed_ && last->stream == s)
+            last++;
+        data = data_map_;
+    } else {
+        Flush();
+        for (auto const& e : entries_)
+            if (e.stream == s)
+                mine.push_back(e);
+        first = mine.data();
+        last = first + mine.size();
+        active.p = map_file(data_path_, active.size);
+        data = active.p;
+    }
+    if (!data)
+        return 0;
+
+    if (by_time)
+        first = std::partition_point(first, last,
+                                     [&](IdxEntry const& e){ return e.time_last < lo; });
+    std::size_t n = 0;
+    for (auto it = first; it != last; ++it) {
+        if (by_time && it->time_first >= hi)
+            break;
+        if (!by_time && (it->id_max < lo || it->id_min > hi))
+            continue;
+        for (uint64_t off = it->off_first; off <= it->off_last; ) {
+            RecHdr h;
+            memcpy(&h, data + off, sizeof(h));
+            if (h.stream == s) {
+                bool in = by_time ? (h.time >= lo && h.time < hi)
+                                  : (h.id >= lo && h.id <= hi);
+                if (in) {
+                    auto const& names = streams_[s];
+                    fn(Record{h.time, h.id, names.first, names.second,
+                              std::string_view{data + off + sizeof(h), h.len}});
+                    n++;
+                }
+            }
+            off += rec_size(h.len);
+        }
+    }
+    return n;
+}
+
+}
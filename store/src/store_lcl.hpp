@@ -0,0 +1,140 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "store_common.hpp"
+
+namespace store
+{
+
+/*
+ * Segment files. <n>.dat holds the records back to back, each a
+ * RecHdr followed by its text and padded to 8 bytes. The first
+ * record of each channel in a segment is preceded by a definition
+ * record (stream kStreamDef, id = the stream number, text =
+ * owner '\0' channel), so that the data file alone is enough to
+ * rebuild the index.
+ *
+ * <n>.idx, written when the segment is sealed, is an IdxHdr, the
+ * stream table (for each stream a 16 bit owner length, a 16 bit
+ * channel length and the two names; padded to 8 bytes) and the
+ * IdxEntry array sorted by stream and time. Integers are in host
+ * byte order; stores are not meant to move between hosts.
+ */
+constexpr uint32_t kIdxMagic = 0x4d504c49;     // "MPLI"
+constexpr uint32_t kIdxVersion = 1;
+constexpr uint32_t kStreamDef = 0xffffffff;
+
+struct RecHdr {
+    uint64_t time;
+    uint64_t id;
+    uint32_t stream;
+    uint32_t len;
+};
+
+struct IdxHdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t data_size;
+    uint64_t tmin;
+    uint64_t tmax;
+    uint32_t nstreams;
+    uint32_t nentries;
+    uint64_t streams_size;
+};
+
+/**
+ * A block of consecutive records of one stream. Records of other
+ * streams may sit between off_first and off_last.
+ */
+struct IdxEntry {
+    uint32_t stream;
+    uint32_t count;
+    uint64_t time_first;
+    uint64_t time_last;
+    uint64_t id_min;
+    uint64_t id_max;
+    uint64_t off_first;
+    uint64_t off_last;
+};
+
+inline std::size_t
+rec_size(std::size_t len)
+{
+    return (sizeof(RecHdr) + len + 7) & ~std::size_t{7};
+}
+
+/**
+ * @brief One data file and its index. A segment is active (being
+ * appended to, index in memory) until Seal() writes its index and
+ * maps both files read only.
+ */
+class Segment {
+public:
+    /// Start a new, empty segment number seq in dir.
+    static std::unique_ptr<Segment> Create(std::string const& dir, unsigned seq,
+                                           unsigned block_records);
+
+    /**
+     * Open sealed segment seq in dir. A missing or stale index is
+     * rebuilt from the data file, dropping a torn last record.
+     */
+    static std::unique_ptr<Segment> Open(std::string const& dir, unsigned seq,
+                                         unsigned block_records);
+
+    Segment(Segment const&) = delete;
+    Segment& operator=(Segment const&) = delete;
+    ~Segment();
+
+    void Append(uint64_t time, std::string_view owner, std::string_view channel,
+                uint64_t id, std::string_view text);
+    void Flush();
+    void Seal();
+    /// Remove the files of an empty active segment.
+    void Discard();
+
+    std::size_t Query(std::string_view owner, std::string_view channel,
+                      bool by_time, uint64_t lo, uint64_t hi,
+                      LogStore::Visitor const& fn);
+
+    uint64_t Size() const { return size_ + buf_.size(); }
+    uint64_t TMax() const { return tmax_; }
+    bool Empty() const { return tmin_ > tmax_; }
+
+private:
+    Segment(std::string const& dir, unsigned seq, unsigned block_records);
+
+    uint32_t Stream(std::string_view owner, std::string_view channel);
+    void Write(RecHdr const& h, std::string_view text);
+    void Index(RecHdr const& h, uint64_t off);
+    bool LoadIndex();
+    void Rebuild();
+    void WriteIndex();
+
+    std::string data_path_;
+    std::string idx_path_;
+    unsigned block_records_;
+
+    std::vector<std::pair<std::string, std::string>> streams_;
+    std::unordered_map<std::string, uint32_t> stream_ids_;
+    uint64_t tmin_ = UINT64_MAX;
+    uint64_t tmax_ = 0;
+
+    /* Active segments. */
+    int fd_ = -1;
+    uint64_t size_ = 0;
+    std::string buf_;
+    std::vector<IdxEntry> entries_;
+    /// Per stream, the entry of its open block, or -1.
+    std::vector<int64_t> open_;
+
+    /* Sealed segments. */
+    char const* idx_map_ = nullptr;
+    std::size_t idx_size_ = 0;
+    char const* data_map_ = nullptr;
+    std::size_t data_size_ = 0;
+    IdxEntry const* sealed_ = nullptr;
+    uint32_t nsealed_ = 0;
+};
+
+}
@@ -0,0 +1,157 @@
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <store.hpp>
+
+using ::testing::EmptyTestEventListener;
+using ::testing::InitGoogleTest;
+using ::testing::Test;
+using ::testing::TestEventListeners;
+using ::testing::TestInfo;
+using ::testing::TestPartResult;
+using ::testing::UnitTest;
+
+namespace {
+
+using namespace std::literals;
+using store::LogStore;
+using store::Record;
+using store::StoreOptions;
+
+struct Rec {
+    uint64_t time;
+    uint64_t id;
+    std::string text;
+};
+
+std::string
+make_tmpdir()
+{
+    char tmpl[] = "/tmp/log_store.XXXXXX";
+    return mkdtemp(tmpl);
+}
+
+void
+remove_dir(std::string const& dir)
+{
+    std::string cmd = "rm -rf " + dir;
+    ASSERT_EQ(system(cmd.c_str()), 0);
+}
+
+std::vector<Rec>
+query(LogStore& ls, std::string_view owner, std::string_view channel,
+      uint64_t t0 = 0, uint64_t t1 = UINT64_MAX)
+{
+    std::vector<Rec> out;
+    ls.Query(owner, channel, t0, t1, [&](Record const& r) {
+        out.push_back({r.time, r.id, std::string{r.text}});
+    });
+    return out;
+}
+
+StoreOptions
+small_segments()
+{
+    StoreOptions opts;
+    opts.max_segment = 4096;
+    opts.block_records = 8;
+    return opts;
+}
+
+void
+fill(LogStore& ls, int n)
+{
+    for (int i = 0; i < n; i++) {
+        ls.Append("Owner", "chan" + std::to_string(i % 2), i, "record " + std::to_string(i));
+        if (i % 100 == 0)
+            usleep(100);
+    }
+}
+
+TEST(LogStore, QueryTimeRange) {
+    auto dir = make_tmpdir();
+    LogStore ls{dir, small_segments()};
+    fill(ls, 1000);
+
+    auto all = query(ls, "Owner", "chan1");
+    ASSERT_EQ(all.size(), 500u);
+    for (std::size_t i = 0; i < all.size(); i++) {
+        ASSERT_EQ(all[i].id, 2 * i + 1);
+        ASSERT_EQ(all[i].text, "record " + std::to_string(2 * i + 1));
+    }
+
+    uint64_t t0 = all[100].time;
+    uint64_t t1 = all[300].time;
+    std::size_t expected = 0;
+    for (auto const& r : all)
+        expected += r.time >= t0 && r.time < t1;
+    auto window = query(ls, "Owner", "chan1", t0, t1);
+    ASSERT_EQ(window.size(), expected);
+    for (auto const& r : window) {
+        ASSERT_GE(r.time, t0);
+        ASSERT_LT(r.time, t1);
+    }
+    ASSERT_TRUE(query(ls, "Owner", "chan2").empty());
+    ASSERT_TRUE(query(ls, "Owner", "chan1", 0, all[0].time).empty());
+    remove_dir(dir);
+}
+
+TEST(LogStore, QueryIdRange) {
+    auto dir = make_tmpdir();
+    LogStore ls{dir, small_segments()};
+    fill(ls, 1000);
+
+    std::vector<uint64_t> ids;
+    ls.QueryId("Owner", "chan0", 500, 519, [&](Record const& r) {
+        ASSERT_EQ(r.channel, "chan0");
+        ids.push_back(r.id);
+    });
+    ASSERT_EQ(ids, (std::vector<uint64_t>{500, 502, 504, 506, 508,
+                                          510, 512, 514, 516, 518}));
+    remove_dir(dir);
+}
+
+TEST(LogStore, Reopen) {
+    auto dir = make_tmpdir();
+    {
+        LogStore ls{dir, small_segments()};
+        fill(ls, 300);
+    }
+    LogStore ls{dir, small_segments()};
+    ASSERT_EQ(query(ls, "Owner", "chan0").size(), 150u);
+    ls.Append("Owner", "chan0", 300, "after reopen");
+    auto all = query(ls, "Owner", "chan0");
+    ASSERT_EQ(all.size(), 151u);
+    ASSERT_EQ(all.back().text, "after reopen");
+    remove_dir(dir);
+}
+
+TEST(LogStore, RebuildAfterCrash) {
+    auto dir = make_tmpdir();
+    pid_t pid = fork();
+    if (pid == 0) {
+        LogStore ls{dir};
+        fill(ls, 100);
+        ls.Flush();
+        std::ofstream{dir + "/0.dat", std::ios::app} << "torn";
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    LogStore ls{dir};
+    auto all = query(ls, "Owner", "chan1");
+    ASSERT_EQ(all.size(), 50u);
+    ASSERT_EQ(all.back().text, "record 99");
+    remove_dir(dir);
+}
+
+}